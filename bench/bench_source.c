@@ -0,0 +1,182 @@
+/* Parse TAP files through tap_source and report the throughput,
+ * compressed files are decompressed on the fly.  Compare a file
+ * with its .gz to see what decompression costs.
+ *
+ * usage: bench_source [-r repeat] file...
+ */
+
+#include <sys/stat.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "tap_parser.h"
+#include "tap_source.h"
+
+static size_t text_bytes;
+static int read_error;
+
+/* Sits on top of the real source to catch why reading stopped,
+ * tap_parser_next() only says that it did */
+static ssize_t
+check_read(tap_source *src, char *buf, size_t len)
+{
+    ssize_t ret;
+    tap_source *real = (tap_source *)src->arbitrary;
+
+    ret = real->ops->read(real, buf, len);
+    if (ret == -1 && errno != EAGAIN)
+        read_error = errno;
+
+    return ret;
+}
+
+static int
+check_wait(tap_source *src, int timeout)
+{
+    tap_source *real = (tap_source *)src->arbitrary;
+
+    return real->ops->wait(real, timeout);
+}
+
+static const tap_source_ops check_ops = { check_read, check_wait, NULL };
+
+static void
+count_cb(tap_parser *tp)
+{
+    text_bytes += strlen(tp->buffer);
+}
+
+static double
+now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+static int
+run(const char *file, double *secs, long *tests)
+{
+    int fd;
+    int ret;
+    double start;
+    tap_parser tp;
+    tap_source fsrc;
+    tap_source dsrc;
+    tap_source csrc;
+
+    fd = open(file, O_RDONLY);
+    if (fd == -1)
+        return errno;
+
+    ret = tap_parser_init(&tp, 0);
+    if (ret != 0) {
+        close(fd);
+        return ret;
+    }
+
+    tap_source_init_fd(&fsrc, fd);
+    ret = tap_source_init_decompress(&dsrc, &fsrc);
+    if (ret != 0) {
+        tap_source_close(&fsrc);
+        tap_parser_fini(&tp);
+        return ret;
+    }
+
+    memset(&csrc, 0, sizeof(csrc));
+    csrc.ops = &check_ops;
+    csrc.arbitrary = &dsrc;
+
+    tap_parser_set_preparse_callback(&tp, count_cb);
+    tap_parser_set_source(&tp, &csrc);
+
+    read_error = 0;
+    start = now();
+    while (tap_parser_next(&tp) == 0)
+        ;
+    *secs = now() - start;
+    *tests = tp.tests_run;
+
+    tap_source_close(&dsrc);
+    tap_parser_fini(&tp);
+
+    return read_error;
+}
+
+int
+main(int argc, char **argv)
+{
+    int i;
+    int r;
+    int opt;
+    int ret;
+    int repeat;
+    long tests;
+    double secs;
+    double best;
+    struct stat sb;
+
+    repeat = 3;
+    tests = 0;
+    secs = 0.0;
+    while ((opt = getopt(argc, argv, "r:")) != -1) {
+        switch (opt) {
+        case 'r':
+            repeat = atoi(optarg);
+            if (repeat < 1)
+                repeat = 1;
+            break;
+        default:
+            fprintf(stderr, "usage: %s [-r repeat] file...\n", argv[0]);
+            return 1;
+        }
+    }
+
+    if (optind == argc) {
+        fprintf(stderr, "usage: %s [-r repeat] file...\n", argv[0]);
+        return 1;
+    }
+
+    printf("%-30s %12s %12s %10s %9s %10s %10s\n", "file", "file bytes",
+           "TAP bytes", "tests", "best s", "file MB/s", "TAP MB/s");
+
+    for (i = optind; i < argc; ++i) {
+        if (stat(argv[i], &sb) == -1) {
+            fprintf(stderr, "%s: %s\n", argv[i], strerror(errno));
+            return 1;
+        }
+
+        best = -1.0;
+        for (r = 0; r < repeat; ++r) {
+            text_bytes = 0;
+            ret = run(argv[i], &secs, &tests);
+            if (ret != 0) {
+                fprintf(stderr, "%s: %s\n", argv[i], strerror(ret));
+                return 1;
+            }
+
+            if (best < 0.0 || secs < best)
+                best = secs;
+        }
+
+        if (best <= 0.0)
+            best = 1e-9;
+
+        printf("%-30s %12lld %12lu %10ld %9.3f %10.1f %10.1f\n", argv[i],
+               (long long)sb.st_size, (unsigned long)text_bytes, tests, best,
+               (double)sb.st_size / best / 1e6,
+               (double)text_bytes / best / 1e6);
+    }
+
+    return 0;
+}
+
+/* vim: set ts=4 sw=4 sts=4 expandtab: */
@@ -0,0 +1,7 @@
+#!/bin/bash
+
+# pragma +binary frames, one split across writes, garbage and
+# "pragma -binary", see check_text for the same in text
+exec "$(dirname "$0")/../test/check" binary
+
+# vim:ts=4:sw=4:syntax=sh
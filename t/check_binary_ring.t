@@ -0,0 +1,6 @@
+#!/bin/bash
+
+# check_binary through the ring, its list entry offers it
+exec "$(dirname "$0")/../test/check" binary
+
+# vim:ts=4:sw=4:syntax=sh
@@ -0,0 +1,6 @@
+#!/bin/bash
+
+# A test scribbling over the head of the ring, its list entry offers it
+exec "$(dirname "$0")/../test/check" broken_ring
+
+# vim:ts=4:sw=4:syntax=sh
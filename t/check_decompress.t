@@ -0,0 +1,9 @@
+#!/bin/bash
+
+# Empty gzip members between ones with TAP in them, the way appending
+# to a .gz file leaves them
+(printf '1..3\nok 1\n' | gzip; printf '' | gzip; printf '' | gzip
+ printf 'ok 2\n' | gzip; printf '' | gzip; printf 'ok 3\n' | gzip) |
+    exec "$(dirname "$0")/../test/check" decompress
+
+# vim:ts=4:sw=4:syntax=sh
@@ -0,0 +1,6 @@
+#!/bin/bash
+
+# A stream added to a tap_mux from a parser callback
+exec "$(dirname "$0")/../test/check" mux
+
+# vim:ts=4:sw=4:syntax=sh
@@ -0,0 +1,6 @@
+#!/bin/bash
+
+# Frames longer than the parser's buffer through the mux
+exec "$(dirname "$0")/../test/check" mux_frames
+
+# vim:ts=4:sw=4:syntax=sh
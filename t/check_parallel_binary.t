@@ -0,0 +1,6 @@
+#!/bin/bash
+
+# Parsing a file that switches to frames on several threads
+exec "$(dirname "$0")/../test/check" parallel_binary
+
+# vim:ts=4:sw=4:syntax=sh
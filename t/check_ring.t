@@ -0,0 +1,6 @@
+#!/bin/bash
+
+# A test going on with the ring after closing stdout
+exec "$(dirname "$0")/../test/check" ring
+
+# vim:ts=4:sw=4:syntax=sh
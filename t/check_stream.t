@@ -0,0 +1,6 @@
+#!/bin/bash
+
+# A plan far bigger than the window of a stream
+exec "$(dirname "$0")/../test/check" stream
+
+# vim:ts=4:sw=4:syntax=sh
@@ -0,0 +1,6 @@
+#!/bin/bash
+
+# The results check_binary gives as frames, as text lines
+exec "$(dirname "$0")/../test/check" text
+
+# vim:ts=4:sw=4:syntax=sh
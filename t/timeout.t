@@ -0,0 +1,8 @@
+#!/bin/bash
+
+echo 1..2
+echo ok 1
+sleep 30
+echo ok 2
+
+# vim:ts=4:sw=4:syntax=sh
@@ -8,6 +8,9 @@
 /* Default buffer size for tap input */
 #define DEFAULT_BUFFER_LEN 512
 
+/* How much is read ahead from a tap_source at a time */
+#define SOURCE_READ_LEN (64 * 1024)
+
 /* Current default TAP version */
 #define DEFAULT_TAP_VERSION 12
 
@@ -0,0 +1,304 @@
+#include <errno.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef TAP_ZLIB
+#include <zlib.h>
+#endif
+#ifdef TAP_ZSTD
+#include <zstd.h>
+#endif
+
+#include "tap_source.h"
+
+/* Compressed bytes read from the inner source at a time */
+#define DECOMPRESS_IN_LEN (64 * 1024)
+
+enum dc_format {
+    DC_DETECT,  /* not enough read to tell yet */
+    DC_PLAIN,
+    DC_GZIP,
+    DC_ZSTD
+};
+
+typedef struct {
+    enum dc_format format;
+    int inner_eof;
+    int stream_end; /* the last gzip member or zstd frame ended */
+
+    char in[DECOMPRESS_IN_LEN];
+    size_t in_pos;
+    size_t in_len;
+
+#ifdef TAP_ZLIB
+    z_stream zs;
+    int zs_init;
+#endif
+#ifdef TAP_ZSTD
+    ZSTD_DStream *zds;
+#endif
+} dc_state;
+
+static const unsigned char gzip_magic[] = { 0x1f, 0x8b };
+static const unsigned char zstd_magic[] = { 0x28, 0xb5, 0x2f, 0xfd };
+
+/* Top up the compressed input, returns like read(2) */
+static ssize_t
+fill_in(tap_source *src, dc_state *st)
+{
+    ssize_t ret;
+
+    if (st->in_pos == st->in_len)
+        st->in_pos = st->in_len = 0;
+
+    if (st->in_len == DECOMPRESS_IN_LEN) {
+        /* Shift out what's used up */
+        memmove(st->in, st->in + st->in_pos, st->in_len - st->in_pos);
+        st->in_len -= st->in_pos;
+        st->in_pos = 0;
+    }
+
+    ret = src->inner->ops->read(src->inner, st->in + st->in_len,
+                                DECOMPRESS_IN_LEN - st->in_len);
+    if (ret == 0)
+        st->inner_eof = 1;
+    if (ret > 0)
+        st->in_len += (size_t)ret;
+
+    return ret;
+}
+
+static int
+detect(tap_source *src, dc_state *st)
+{
+    ssize_t ret;
+    size_t have;
+
+    while (st->in_len < sizeof(zstd_magic) && !st->inner_eof) {
+        ret = fill_in(src, st);
+        if (ret == -1)
+            return -1;
+    }
+
+    have = st->in_len;
+    st->format = DC_PLAIN;
+
+    if (have >= sizeof(gzip_magic) && memcmp(st->in, gzip_magic, sizeof(gzip_magic)) == 0) {
+#ifdef TAP_ZLIB
+        /* 16 + window bits to only take gzip */
+        if (inflateInit2(&st->zs, 16 + MAX_WBITS) != Z_OK) {
+            errno = ENOMEM;
+            return -1;
+        }
+        st->zs_init = 1;
+        st->format = DC_GZIP;
+#else
+        errno = EPROTONOSUPPORT;
+        return -1;
+#endif
+    }
+    else if (have >= sizeof(zstd_magic) && memcmp(st->in, zstd_magic, sizeof(zstd_magic)) == 0) {
+#ifdef TAP_ZSTD
+        st->zds = ZSTD_createDStream();
+        if (st->zds == NULL) {
+            errno = ENOMEM;
+            return -1;
+        }
+        ZSTD_initDStream(st->zds);
+        st->format = DC_ZSTD;
+#else
+        errno = EPROTONOSUPPORT;
+        return -1;
+#endif
+    }
+
+    return 0;
+}
+
+#ifdef TAP_ZLIB
+/* One step of inflate, returns bytes made, 0 if it needs input,
+ * -1 with errno on a corrupt stream */
+static ssize_t
+gzip_step(dc_state *st, char *buf, size_t len)
+{
+    int ret;
+
+    st->zs.next_in = (Bytef *)(st->in + st->in_pos);
+    st->zs.avail_in = (uInt)(st->in_len - st->in_pos);
+    st->zs.next_out = (Bytef *)buf;
+    st->zs.avail_out = (uInt)len;
+
+    ret = inflate(&st->zs, Z_NO_FLUSH);
+    st->in_pos = st->in_len - st->zs.avail_in;
+
+    switch (ret) {
+    case Z_STREAM_END:
+        /* gzip files can be several members back to back */
+        st->stream_end = 1;
+        inflateReset(&st->zs);
+        break;
+    case Z_OK:
+    case Z_BUF_ERROR:
+        st->stream_end = 0;
+        break;
+    default:
+        errno = EIO;
+        return -1;
+    }
+
+    return (ssize_t)(len - st->zs.avail_out);
+}
+#endif
+
+#ifdef TAP_ZSTD
+static ssize_t
+zstd_step(dc_state *st, char *buf, size_t len)
+{
+    size_t ret;
+    ZSTD_inBuffer in;
+    ZSTD_outBuffer out;
+
+    in.src = st->in;
+    in.size = st->in_len;
+    in.pos = st->in_pos;
+    out.dst = buf;
+    out.size = len;
+    out.pos = 0;
+
+    ret = ZSTD_decompressStream(st->zds, &out, &in);
+    st->in_pos = in.pos;
+    if (ZSTD_isError(ret)) {
+        errno = EIO;
+        return -1;
+    }
+
+    /* 0 is returned exactly when a frame is done */
+    st->stream_end = (ret == 0);
+
+    return (ssize_t)out.pos;
+}
+#endif
+
+static ssize_t
+dc_read(tap_source *src, char *buf, size_t len)
+{
+    ssize_t ret;
+    size_t n;
+    size_t pos;
+    int stream_end;
+    dc_state *st = (dc_state *)src->state;
+
+    if (st->format == DC_DETECT && detect(src, st) == -1)
+        return -1;
+
+    if (st->format == DC_PLAIN) {
+        /* Hand over what detect() read, then get out of the way */
+        if (st->in_pos < st->in_len) {
+            n = st->in_len - st->in_pos;
+            if (n > len)
+                n = len;
+            memcpy(buf, st->in + st->in_pos, n);
+            st->in_pos += n;
+            return (ssize_t)n;
+        }
+
+        if (st->inner_eof)
+            return 0;
+        return src->inner->ops->read(src->inner, buf, len);
+    }
+
+    for (;;) {
+        ret = 0;
+        if (st->in_pos < st->in_len) {
+            pos = st->in_pos;
+            stream_end = st->stream_end;
+#ifdef TAP_ZLIB
+            if (st->format == DC_GZIP)
+                ret = gzip_step(st, buf, len);
+#endif
+#ifdef TAP_ZSTD
+            if (st->format == DC_ZSTD)
+                ret = zstd_step(st, buf, len);
+#endif
+            if (ret != 0)
+                return ret;
+
+            /* Nothing made but something done, like a gzip member or
+             * zstd frame ending without output: step again */
+            if (st->in_pos != pos || (st->stream_end && !stream_end))
+                continue;
+        }
+
+        if (st->inner_eof) {
+            if (st->in_pos < st->in_len || !st->stream_end) {
+                /* Cut off or trailing garbage */
+                errno = EIO;
+                return -1;
+            }
+            return 0;
+        }
+
+        /* The decompressor wants more */
+        ret = fill_in(src, st);
+        if (ret == -1)
+            return -1;
+    }
+}
+
+static int
+dc_wait(tap_source *src, int timeout)
+{
+    dc_state *st = (dc_state *)src->state;
+
+    /* Compressed input may already be waiting */
+    if (st->in_pos < st->in_len)
+        return 1;
+
+    return src->inner->ops->wait(src->inner, timeout);
+}
+
+static void
+dc_close(tap_source *src)
+{
+    dc_state *st = (dc_state *)src->state;
+
+    if (st != NULL) {
+#ifdef TAP_ZLIB
+        if (st->zs_init)
+            inflateEnd(&st->zs);
+#endif
+#ifdef TAP_ZSTD
+        if (st->zds != NULL)
+            ZSTD_freeDStream(st->zds);
+#endif
+        free(st);
+    }
+    src->state = NULL;
+
+    if (src->inner != NULL)
+        tap_source_close(src->inner);
+    src->inner = NULL;
+}
+
+static const tap_source_ops dc_ops = { dc_read, dc_wait, dc_close };
+
+int
+tap_source_init_decompress(tap_source *src, tap_source *inner)
+{
+    dc_state *st;
+
+    st = (dc_state *)calloc(1, sizeof(dc_state));
+    if (st == NULL)
+        return errno;
+
+    memset(src, 0, sizeof(*src));
+    src->ops = &dc_ops;
+    src->fd = -1;
+    src->inner = inner;
+    src->state = st;
+
+    return 0;
+}
+
+/* vim: set ts=4 sw=4 sts=4 expandtab: */
@@ -0,0 +1,178 @@
+#include <errno.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "tap_diag.h"
+
+/* Tests the ring of diags starts with */
+#define DIAGS_INITIAL_LEN 16
+
+int
+tap_diags_init(tap_diags *d, size_t cap, size_t test_cap)
+{
+    memset(d, 0, sizeof(*d));
+
+    if (cap == 0)
+        return EINVAL;
+
+    d->data = (char *)malloc(cap);
+    if (d->data == NULL)
+        return errno;
+
+    d->cap = cap;
+    d->test_cap = (test_cap == 0 || test_cap > cap) ? cap : test_cap;
+
+    return 0;
+}
+
+void
+tap_diags_fini(tap_diags *d)
+{
+    free(d->data);
+    free(d->diags);
+    memset(d, 0, sizeof(*d));
+}
+
+static inline tap_diag*
+diag_at(const tap_diags *d, size_t i)
+{
+    return &d->diags[(d->first + i) % d->diags_len];
+}
+
+/* Room for one more test, the ring is laid out oldest first again */
+static int
+grow_diags(tap_diags *d)
+{
+    size_t i;
+    size_t len;
+    tap_diag *p;
+
+    len = (d->diags_len == 0) ? DIAGS_INITIAL_LEN : d->diags_len * 2;
+    p = (tap_diag *)malloc(len * sizeof(tap_diag));
+    if (p == NULL)
+        return errno;
+
+    for (i = 0; i < d->count; ++i)
+        p[i] = *diag_at(d, i);
+
+    free(d->diags);
+    d->diags = p;
+    d->diags_len = len;
+    d->first = 0;
+
+    return 0;
+}
+
+static void
+ring_put(tap_diags *d, const char *buf, size_t len)
+{
+    size_t n;
+    size_t off;
+
+    while (len > 0) {
+        off = d->head % d->cap;
+        n = d->cap - off;
+        if (n > len)
+            n = len;
+
+        memcpy(d->data + off, buf, n);
+        d->head += n;
+        buf += n;
+        len -= n;
+    }
+}
+
+int
+tap_diags_add(tap_diags *d, long test_num, const char *line, size_t len)
+{
+    int ret;
+    tap_diag *last;
+
+    last = (d->count > 0) ? diag_at(d, d->count - 1) : NULL;
+    if (last != NULL && test_num < last->test_num)
+        return 0;
+
+    if (last == NULL || last->test_num != test_num) {
+        if (d->count == d->diags_len) {
+            ret = grow_diags(d);
+            if (ret != 0)
+                return ret;
+        }
+
+        last = diag_at(d, d->count++);
+        last->test_num = test_num;
+        last->pos = d->head;
+        last->len = 0;
+        last->truncated = 0;
+    }
+
+    if (last->len + len + 1 > d->test_cap) {
+        last->truncated = 1;
+        return 0;
+    }
+
+    /* Make room, the last test alone always fits since test_cap <= cap */
+    while (d->head + len + 1 - diag_at(d, 0)->pos > d->cap) {
+        d->first = (d->first + 1) % d->diags_len;
+        d->count--;
+        d->evicted++;
+    }
+
+    ring_put(d, line, len);
+    ring_put(d, "\n", 1);
+    last->len += len + 1;
+
+    return 0;
+}
+
+const tap_diag*
+tap_diags_find(const tap_diags *d, long test_num)
+{
+    size_t lo;
+    size_t hi;
+    size_t mid;
+    tap_diag *diag;
+
+    /* Tests are in increasing order */
+    lo = 0;
+    hi = d->count;
+    while (lo < hi) {
+        mid = lo + (hi - lo) / 2;
+        diag = diag_at(d, mid);
+
+        if (diag->test_num == test_num)
+            return (diag->len > 0) ? diag : NULL;
+        if (diag->test_num < test_num)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+
+    return NULL;
+}
+
+size_t
+tap_diags_copy(const tap_diags *d, const tap_diag *diag, char *buf, size_t len)
+{
+    size_t n;
+    size_t off;
+    size_t first;
+
+    if (len == 0)
+        return diag->len;
+
+    n = (diag->len < len - 1) ? diag->len : len - 1;
+    off = diag->pos % d->cap;
+    first = d->cap - off;
+    if (first > n)
+        first = n;
+
+    memcpy(buf, d->data + off, first);
+    memcpy(buf + first, d->data, n - first);
+    buf[n] = '\0';
+
+    return diag->len;
+}
+
+/* vim: set ts=4 sw=4 sts=4 expandtab: */
@@ -0,0 +1,58 @@
+#ifndef _H_TAP_DIAG
+#define _H_TAP_DIAG
+
+#include <stddef.h>
+
+/* Comment and unknown lines kept with the test line they came after,
+ * so the "# got: ... expected: ..." of a failure outlives the parse
+ * without keeping all the output.  See tap_parser_set_diags().
+ *
+ * The text goes into a ring of cap bytes, when that's full the lines
+ * of the oldest tests are dropped to make room.  No test keeps more
+ * than test_cap bytes, later lines of a chatty test are dropped and
+ * the test is marked truncated.
+ */
+
+typedef struct {
+    long test_num;  /* 0 for the lines before the first test */
+    size_t pos;     /* where the text starts, counted like head */
+    size_t len;
+    int truncated;  /* lines were dropped past test_cap */
+} tap_diag;
+
+typedef struct {
+    /* Text of the lines, newline terminated */
+    char *data;
+    size_t cap;
+    size_t test_cap;
+    size_t head;    /* bytes appended, ever, taken modulo cap */
+
+    /* Tests with lines, a ring from first, oldest first */
+    tap_diag *diags;
+    size_t diags_len;
+    size_t first;
+    size_t count;
+
+    long evicted;   /* tests whose lines were dropped to make room */
+} tap_diags;
+
+/* Allocate the ring, test_cap is capped at cap.  Returns errno. */
+extern int tap_diags_init(tap_diags *d, size_t cap, size_t test_cap);
+
+extern void tap_diags_fini(tap_diags *d);
+
+/* Add len bytes of line (without a newline, one is added) to the
+ * lines of test_num.  Tests have to come in increasing order, lines
+ * of an older test than the last one are dropped.  Returns errno. */
+extern int tap_diags_add(tap_diags *d, long test_num, const char *line, size_t len);
+
+/* The lines kept for test_num, NULL if none are */
+extern const tap_diag* tap_diags_find(const tap_diags *d, long test_num);
+
+/* Copy the text of diag into buf like snprintf(), returns diag->len */
+extern size_t tap_diags_copy(const tap_diags *d, const tap_diag *diag,
+                             char *buf, size_t len);
+
+#endif /* _H_TAP_DIAG */
+
+/* vim: set ts=4 sw=4 sts=4 expandtab: */
@@ -6,6 +6,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 
 #include "tap_parser.h"
 #include "tap_utils.h"
@@ -32,6 +33,10 @@
 static void init_results_array(tap_parser *tp, long len);
 static void set_results_array(tap_parser *tp, long idx, enum tap_test_type value);
 static int invalid(tap_parser *tp, int err, const char *fmt, ...);
+static void keep_diag(tap_parser *tp);
+static int eval_frame(tap_parser *tp, const char *buf, size_t len);
+static int put_test(tap_parser *tp, enum tap_test_type type,
+                    const char *reason, const char *directive);
 
 /* Default callback functions */
 
@@ -106,6 +111,12 @@ tap_default_pragma_callback(tap_parser *tp, int state, char *pragma)
         return 0;
     }
 
+    /* Frames from the next line on, see tap_frame.h */
+    if (strncmp(pragma, "binary", sizeof("binary") - 1) == 0) {
+        tp->binary = state;
+        return 0;
+    }
+
     /* always report invalid pragmas */
     return invalid(tp, TE_PRAGMA_UNKNOWN, "Unknown pragma: %s", pragma);
 }
@@ -350,6 +361,26 @@ parse_plan(tap_parser *tp)
     ret_call2(tp, plan_callback, upper, chomp(buf));
 }
 
+/* The # starting the directive, "\\#" is a # in the description.
+ * Unescapes the description as it goes. */
+static char*
+find_directive(char *buf)
+{
+    char *c;
+    char *end;
+
+    for (c = buf; (c = strchr(c, '#')) != NULL; ++c) {
+        if (c == buf || c[-1] != '\\')
+            return c;
+
+        end = c + strlen(c);
+        memmove(c - 1, c, end - c + 1);
+        --c;
+    }
+
+    return NULL;
+}
+
 static int
 parse_test(tap_parser *tp)
 {
@@ -446,7 +477,7 @@ rasons:
     if (*buf != '#') {
         /* description! */
         char *c;
-        c = strchr(buf, '#');
+        c = find_directive(buf);
         if (c == NULL) {
             /* We only have a description */
             ttr.type = type;
@@ -543,8 +574,10 @@ tap_eval(tap_parser *tp)
     }
 
     /* check for comment */
-    if (tp->buffer[0] == '#')
+    if (tp->buffer[0] == '#') {
+        keep_diag(tp);
         ret_call0(tp, comment_callback);
+    }
 
     /* check the plan */
     ret = parse_plan(tp);
@@ -555,6 +588,7 @@ tap_eval(tap_parser *tp)
     if (ret != -1)
         return ret;
 
+    keep_diag(tp);
     ret_call0(tp, unknown_callback);
 }
 
@@ -563,7 +597,8 @@ static int
 invalid(struct _tap_parser *tp, int err, const char *fmt, ...)
 {
     va_list ap;
-    static char msg[1024];
+    /* not static, parsers may run on several threads */
+    char msg[1024];
 
     va_start(ap, fmt);
     vsnprintf(msg, 1024, fmt, ap);
@@ -575,13 +610,102 @@ invalid(struct _tap_parser *tp, int err, const char *fmt, ...)
     return tp->invalid_callback(tp, err, msg);
 }
 
+static inline int
+is_failure(enum tap_test_type type)
+{
+    return type == TTT_NOT_OK || type == TTT_TODO_PASSED || type == TTT_SKIP_FAILED;
+}
+
+/* Did the last test line fail? */
+static int
+last_failed(tap_parser *tp)
+{
+    if (tp->test_num < tp->results_base)
+        return 0;
+
+    if (tp->tr->recent != NULL)
+        return is_failure(tap_results_get(tp->tr, tp->test_num));
+
+    if (tp->tr->results == NULL || (size_t)tp->test_num >= tp->tr->results_len)
+        return 0;
+
+    return is_failure(tp->tr->results[tp->test_num - tp->results_base]);
+}
+
+/* Keep the line in tp->buffer with the test line before it */
+static void
+keep_diag(tap_parser *tp)
+{
+    int ret;
+    size_t len;
+
+    if (tp->diag_cap == 0)
+        return;
+
+    if (tp->tr == NULL) {
+        tp->tr = (tap_results *)calloc(1, sizeof(tap_results));
+        if (tp->tr == NULL) {
+            invalid(tp, errno, "calloc failed: %s", strerror(errno));
+            return;
+        }
+    }
+
+    if (tp->diag_failing && !last_failed(tp))
+        return;
+
+    if (tp->tr->diags == NULL) {
+        tp->tr->diags = (tap_diags *)malloc(sizeof(tap_diags));
+        if (tp->tr->diags == NULL) {
+            invalid(tp, errno, "malloc failed: %s", strerror(errno));
+            return;
+        }
+
+        ret = tap_diags_init(tp->tr->diags, tp->diag_cap, tp->diag_test_cap);
+        if (ret != 0) {
+            free(tp->tr->diags);
+            tp->tr->diags = NULL;
+            invalid(tp, ret, "malloc failed: %s", strerror(ret));
+            return;
+        }
+    }
+
+    len = strlen(tp->buffer);
+    if (len > 0 && tp->buffer[len - 1] == '\n')
+        --len;
+
+    ret = tap_diags_add(tp->tr->diags, tp->test_num, tp->buffer, len);
+    if (ret != 0)
+        invalid(tp, ret, "malloc failed: %s", strerror(ret));
+}
+
+/* Grow the timings along with the results, old is the previous length */
+static void
+init_timings_array(tap_parser *tp, size_t old, size_t len)
+{
+    void *p;
+
+    if (tp->tr->timings == NULL)
+        old = 0;
+
+    p = realloc(tp->tr->timings, len * sizeof(double));
+    if (p == NULL) {
+        invalid(tp, errno, "realloc failed: %s", strerror(errno));
+        return;
+    }
+
+    tp->tr->timings = (double *)p;
+    memset(&(tp->tr->timings[old]), 0, (len - old) * sizeof(double));
+}
+
 static void
 init_results_array(tap_parser *tp, long len)
 {
     void *p;
-    long delta;
+    size_t have;
+    size_t want;
 
-    if (len == 0)
+    /* A stream keeps its window instead, however big the plan */
+    if (len == 0 || tp->stream)
         return;
 
     if (tp->tr == NULL) {
@@ -596,75 +720,618 @@ init_results_array(tap_parser *tp, long len)
     /* Increment since test num 0 will never exist. */
     ++len;
 
-    if (tp->tr->results == NULL) {
-        p = malloc(len * sizeof(enum tap_test_type));
+    /* don't bother calling realloc if it wont do anything */
+    if (tp->tr->results != NULL && (size_t)len <= tp->tr->results_len)
+        return;
+
+    /* Only tests from results_base on are stored,
+     * results_len still counts from test 0 */
+    have = 0;
+    if (tp->tr->results != NULL && tp->tr->results_len > (size_t)tp->results_base)
+        have = tp->tr->results_len - tp->results_base;
+
+    want = 0;
+    if (len > tp->results_base)
+        want = len - tp->results_base;
+
+    if (want > have) {
+        /* Use a second pointer. If realloc fails,
+         * the first pointer isn't deallocated */
+        p = realloc(tp->tr->results, want * sizeof(enum tap_test_type));
         if (p == NULL) {
-            invalid(tp, errno, "malloc failed: %s", strerror(errno));
+            invalid(tp, errno, "realloc failed: %s", strerror(errno));
             return;
         }
 
         tp->tr->results = (enum tap_test_type *)p;
-        tp->tr->results_len = len;
 
         /* TTT_INVALID is 0 by the definition of an enum, so
          * setting all bytes to 0 initializes everything properly */
-        memset(tp->tr->results, 0, len * sizeof(enum tap_test_type));
-        return;
+        memset(&(tp->tr->results[have]), 0,
+               (want - have) * sizeof(enum tap_test_type));
+
+        if (tp->timing)
+            init_timings_array(tp, have, want);
     }
 
-    /* don't bother calling realloc if it wont do anything */
-    if (len <= tp->tr->results_len)
-        return;
+    if ((size_t)len > tp->tr->results_len)
+        tp->tr->results_len = len;
+}
 
-    /* Use a second pointer. If realloc fails,
-     * the first pointer isn't deallocated */
-    p = realloc(tp->tr->results, len * sizeof(enum tap_test_type));
-    if (p == NULL) {
-        invalid(tp, errno, "realloc failed: %s", strerror(errno));
+/* Count a test of a stream towards the rates and the window */
+static void
+set_recent(tap_parser *tp, long idx, enum tap_test_type value)
+{
+    long n;
+    long len;
+    long slot;
+    long sec;
+    struct timespec ts;
+    tap_results *tr;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    sec = (long)ts.tv_sec;
+    slot = sec % TAP_RATE_SECONDS;
+    if (tp->rate[slot].sec != sec) {
+        tp->rate[slot].sec = sec;
+        tp->rate[slot].passed = tp->rate[slot].failed = 0;
+    }
+    if (is_failure(value))
+        tp->rate[slot].failed++;
+    else
+        tp->rate[slot].passed++;
+
+    if (tp->tr == NULL) {
+        tp->tr = (tap_results *)calloc(1, sizeof(tap_results));
+        if (tp->tr == NULL) {
+            invalid(tp, errno, "calloc failed: %s", strerror(errno));
+            return;
+        }
+    }
+
+    tr = tp->tr;
+    if (tp->window == 0) {
+        if (idx >= tr->recent_end)
+            tr->recent_end = idx + 1;
         return;
     }
 
-    tp->tr->results = (enum tap_test_type *)p;
+    if (tr->recent == NULL) {
+        tr->recent = (enum tap_test_type *)calloc(tp->window, sizeof(enum tap_test_type));
+        if (tr->recent == NULL) {
+            invalid(tp, errno, "calloc failed: %s", strerror(errno));
+            return;
+        }
+        tr->recent_len = tp->window;
+    }
+
+    len = (long)tr->recent_len;
 
-    /* memset the new members */
-    delta = len - tp->tr->results_len;
-    memset(&(tp->tr->results[tp->tr->results_len + 1]), 0,
-           delta * sizeof(enum tap_test_type));
+    /* Slide the window up to idx, what it passes over went missing */
+    if (idx >= tr->recent_end) {
+        n = tr->recent_end;
+        if (n < idx - len + 1)
+            n = idx - len + 1;
 
-    tp->tr->results_len = len;
+        for (; n <= idx; ++n) {
+            if (is_failure(tr->recent[n % len]))
+                tr->recent_failed--;
+            tr->recent[n % len] = TTT_INVALID;
+        }
+        tr->recent_end = idx + 1;
+    }
+    else if (idx < tr->recent_end - len) {
+        /* Fell out of the window already */
+        return;
+    }
+
+    if (is_failure(tr->recent[idx % len]))
+        tr->recent_failed--;
+    tr->recent[idx % len] = value;
+    if (is_failure(value))
+        tr->recent_failed++;
 }
 
 static void
 set_results_array(tap_parser *tp, long idx, enum tap_test_type value)
 {
+    if (tp->stream) {
+        set_recent(tp, idx, value);
+        return;
+    }
 
     /* Results needs to be reallocated in these cases */
     if (tp->tr == NULL || tp->tr->results == NULL
-            || tp->tr->results_len < idx) {
+            || tp->tr->results_len <= idx) {
         init_results_array(tp, idx);
     }
 
     /* Failed to resize results array, just return, no report  */
     if (tp->tr == NULL || tp->tr->results == NULL
-            || tp->tr->results_len < idx) {
+            || tp->tr->results_len <= idx) {
         return;
     }
 
+    /* Not stored by this parser */
+    if (idx < tp->results_base)
+        return;
+
     /* Guarnateed to have idx exist now */
+    idx -= tp->results_base;
     tp->tr->results[idx] = value;
+
+    if (tp->timing && tp->tr->timings != NULL) {
+        tp->tr->timings[idx] = tp->line_stamp - tp->test_stamp;
+        tp->test_stamp = tp->line_stamp;
+    }
+}
+
+/* Count the line and publish the counters it changed */
+static inline void
+line_done(tap_parser *tp)
+{
+    if (!tp->stats_on)
+        return;
+
+    tp->stats_lines++;
+    tap_parser_publish_stats(tp);
+}
+
+static int
+alloc_frame(tap_parser *tp)
+{
+    if (tp->frame == NULL)
+        tp->frame = (char *)malloc(TAP_FRAME_MAX);
+
+    return (tp->frame == NULL) ? -1 : 0;
+}
+
+/* A frame out of len bytes of tp->frame */
+static int
+frame_done(tap_parser *tp, size_t len)
+{
+    int ret;
+
+    tp->partial_len = 0;
+    stamp_line(tp);
+    ret = eval_frame(tp, tp->frame, len);
+    line_done(tp);
+    return ret;
+}
+
+/* Returns 1 and the next byte of input in *c, 0 at its end.
+ * Waits for input like get_line(). */
+static int
+next_byte(tap_parser *tp, char *c)
+{
+    int iter = 0;
+    ssize_t ret;
+    tap_source *src = tp->source;
+
+    if (src == NULL) {
+        for (;;) {
+            ret = read(tp->fd, c, 1);
+            if (ret == 1)
+                return 1;
+            if (ret == -1 && errno == EINTR)
+                continue;
+            if (ret == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)
+                    && iter++ < tp->blocking_time) {
+                sleep(1);
+                continue;
+            }
+            return 0;
+        }
+    }
+
+    while (tp->source_pos == tp->source_len) {
+        ret = src->ops->read(src, tp->source_buf, SOURCE_READ_LEN);
+        if (ret == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            if (src->ops->wait(src, tp->blocking_time * 1000) == 1)
+                continue;
+            return 0;
+        }
+        if (ret <= 0)
+            return 0;
+
+        tp->source_pos = 0;
+        tp->source_len = (size_t)ret;
+    }
+
+    *c = tp->source_buf[tp->source_pos++];
+    return 1;
+}
+
+/* tap_parser_next() after "pragma +binary" */
+static int
+next_frame(tap_parser *tp)
+{
+    size_t n;
+    size_t len;
+
+    if (alloc_frame(tp) == -1)
+        return 1;
+
+    if (tp->source != NULL && tp->source_buf == NULL) {
+        tp->source_buf = (char *)malloc(SOURCE_READ_LEN);
+        if (tp->source_buf == NULL)
+            return 1;
+        tp->source_pos = tp->source_len = 0;
+    }
+
+    len = 0;
+    do {
+        if (!next_byte(tp, tp->frame + len)) {
+            /* Cut off, the parse error is all that's left of it */
+            if (len > 0)
+                frame_done(tp, len);
+            return 1;
+        }
+        n = tap_frame_len(tp->frame, ++len);
+    } while (n == 0);
+
+    /* Garbage is parsed as far as it's read */
+    return frame_done(tp, (n == (size_t)-1) ? len : n);
 }
 
 /* Get next line of tap, 0 if good, 1 if no more input */
 int
 tap_parser_next(tap_parser *tp)
 {
+    int ret;
+
+    if (tp->binary)
+        return next_frame(tp);
+
     if (get_line(tp) == -1)
         return 1;
 
     if (tp->preparse_callback != NULL)
         tp->preparse_callback(tp);
 
-    return tap_eval(tp);
+    ret = tap_eval(tp);
+    line_done(tp);
+    return ret;
+}
+
+/* Returns like read(2) */
+static ssize_t
+step_read(tap_parser *tp)
+{
+    ssize_t ret;
+
+    do {
+        if (tp->source != NULL)
+            ret = tp->source->ops->read(tp->source, tp->source_buf, SOURCE_READ_LEN);
+        else
+            ret = read(tp->fd, tp->source_buf, SOURCE_READ_LEN);
+    } while (ret == -1 && errno == EINTR);
+
+    return ret;
+}
+
+/* tap_parser_step() after "pragma +binary", copies what's read ahead
+ * into tp->frame until a frame is there */
+static int
+step_frame(tap_parser *tp)
+{
+    size_t n;
+    size_t len;
+
+    if (alloc_frame(tp) == -1)
+        return 1;
+
+    n = tp->source_len - tp->source_pos;
+    if (n > TAP_FRAME_MAX - tp->partial_len)
+        n = TAP_FRAME_MAX - tp->partial_len;
+
+    memcpy(tp->frame + tp->partial_len, tp->source_buf + tp->source_pos, n);
+    len = tap_frame_len(tp->frame, tp->partial_len + n);
+
+    if (len == 0) {
+        tp->source_pos += n;
+        tp->partial_len += n;
+        return TAP_WOULD_BLOCK;
+    }
+
+    /* Garbage, there's no telling where it ends */
+    if (len == (size_t)-1)
+        len = tp->partial_len + n;
+
+    /* What was copied past the frame is read again */
+    tp->source_pos += len - tp->partial_len;
+    return frame_done(tp, len);
+}
+
+int
+tap_parser_step(tap_parser *tp)
+{
+    int ret;
+    char *nl;
+    size_t n;
+    size_t room;
+    ssize_t got;
+
+    if (tp->source_buf == NULL) {
+        tp->source_buf = (char *)malloc(SOURCE_READ_LEN);
+        if (tp->source_buf == NULL)
+            return 1;
+        tp->source_pos = tp->source_len = 0;
+    }
+
+    /* len - 1 to leave room for a null terminator */
+    room = tp->buffer_len - 1;
+
+    for (;;) {
+        if (tp->source_pos == tp->source_len) {
+            got = step_read(tp);
+            if (got == -1 && (errno == EAGAIN || errno == EWOULDBLOCK))
+                return TAP_WOULD_BLOCK;
+
+            if (got <= 0) {
+                /* EOF or error, the last line may not have a newline */
+                if (tp->partial_len == 0)
+                    return 1;
+                if (tp->binary)
+                    return frame_done(tp, tp->partial_len);
+                break;
+            }
+
+            tp->source_pos = 0;
+            tp->source_len = (size_t)got;
+        }
+
+        if (tp->binary) {
+            ret = step_frame(tp);
+            if (ret != TAP_WOULD_BLOCK)
+                return ret;
+            continue;
+        }
+
+        n = tp->source_len - tp->source_pos;
+        if (n > room - tp->partial_len)
+            n = room - tp->partial_len;
+
+        nl = (char *)memchr(tp->source_buf + tp->source_pos, '\n', n);
+        if (nl != NULL)
+            n = nl - (tp->source_buf + tp->source_pos) + 1;
+
+        memcpy(tp->buffer + tp->partial_len, tp->source_buf + tp->source_pos, n);
+        tp->source_pos += n;
+        tp->partial_len += n;
+
+        /* A line, or as much of one as the buffer takes */
+        if (nl != NULL || tp->partial_len == room)
+            break;
+    }
+
+    tp->buffer[tp->partial_len] = '\0';
+    tp->partial_len = 0;
+    stamp_line(tp);
+
+    if (tp->preparse_callback != NULL)
+        tp->preparse_callback(tp);
+
+    ret = tap_eval(tp);
+    line_done(tp);
+    return ret;
+}
+
+size_t
+tap_parser_record_len(const tap_parser *tp, const char *buf, size_t len)
+{
+    size_t n;
+    const char *nl;
+
+    if (tp->binary) {
+        /* Garbage goes a byte at a time, each one a parse error */
+        n = tap_frame_len(buf, len);
+        return (n == (size_t)-1) ? 1 : n;
+    }
+
+    nl = (const char *)memchr(buf, '\n', len);
+    return (nl == NULL) ? 0 : (size_t)(nl - buf) + 1;
+}
+
+/* tap_parser_line() after "pragma +binary", frames cut off at the end
+ * or garbage are parse errors */
+static int
+eval_frames(tap_parser *tp, const char *buf, size_t len)
+{
+    int ret = 0;
+    size_t n;
+
+    while (ret == 0 && len > 0) {
+        /* A "pragma -binary" frame, the rest is text */
+        if (!tp->binary)
+            return tap_parser_line(tp, buf, len);
+
+        n = tap_frame_len(buf, len);
+        if (n == 0 || n == (size_t)-1)
+            n = (n == 0) ? len : 1;
+
+        stamp_line(tp);
+        ret = eval_frame(tp, buf, n);
+        line_done(tp);
+
+        buf += n;
+        len -= n;
+    }
+
+    return ret;
+}
+
+/* Parse a line of tap supplied by the caller, 0 if good */
+int
+tap_parser_line(tap_parser *tp, const char *line, size_t len)
+{
+    int ret;
+    size_t chunk;
+
+    if (tp->binary)
+        return eval_frames(tp, line, len);
+
+    /* len - 1 to leave room for a null terminator */
+    chunk = tp->buffer_len - 1;
+    ret = 0;
+
+    /* Lines longer than the buffer are evaluated
+     * in pieces, just like get_line() reads them */
+    stamp_line(tp);
+
+    do {
+        if (len < chunk)
+            chunk = len;
+
+        memcpy(tp->buffer, line, chunk);
+        tp->buffer[chunk] = '\0';
+        line += chunk;
+        len -= chunk;
+
+        if (tp->preparse_callback != NULL)
+            tp->preparse_callback(tp);
+
+        ret = tap_eval(tp);
+    } while (ret == 0 && len > 0);
+
+    line_done(tp);
+    return ret;
+}
+
+/* Results put in without text, what parse_plan()
+ * and parse_test() do once they've taken a line apart */
+
+static int
+put_plan(tap_parser *tp, long upper, const char *skip)
+{
+    init_results_array(tp, upper);
+    ret_call2(tp, plan_callback, upper, (char *)skip);
+}
+
+static int
+put_test(tap_parser *tp, enum tap_test_type type,
+         const char *reason, const char *directive)
+{
+    tap_test_result ttr;
+
+    memset(&ttr, 0, sizeof(ttr));
+    ttr.type = type;
+    ttr.test_num = tp->test_num + 1;
+    ttr.reason = (char *)reason;
+    ttr.directive = (char *)directive;
+
+    tp->test_num++;
+    tp->tests_run++;
+
+    set_results_array(tp, ttr.test_num, type);
+    ret_call1(tp, test_callback, &ttr);
+}
+
+static int
+put_comment(tap_parser *tp)
+{
+    keep_diag(tp);
+    ret_call0(tp, comment_callback);
+}
+
+/* tap_eval() for a frame: text goes to tap_eval(), a test gets its
+ * description and directive in tp->buffer instead of its line */
+static int
+eval_frame(tap_parser *tp, const char *buf, size_t len)
+{
+    size_t n;
+    size_t room;
+    long test_num;
+    char *directive;
+    tap_frame f;
+
+    if (tap_frame_decode(buf, len, &f) != 0)
+        return invalid(tp, TE_FRAME_PARSE, "Invalid binary frame of %zu bytes", len);
+
+    /* len - 1 to leave room for a null terminator */
+    room = tp->buffer_len - 1;
+    n = (f.text_len < room) ? f.text_len : room;
+    memcpy(tp->buffer, f.text, n);
+    tp->buffer[n] = '\0';
+
+    if (f.status == TAP_FRAME_TEXT)
+        return tap_eval(tp);
+
+    tp->first_line = 0;
+
+    /* What fits of the directive after the description */
+    directive = NULL;
+    if (f.directive_len > 0 && n + 1 < room) {
+        directive = tp->buffer + n + 1;
+        room -= n + 1;
+        n = (f.directive_len < room) ? f.directive_len : room;
+        memcpy(directive, f.directive, n);
+        directive[n] = '\0';
+    }
+
+    if (f.test_num > LONG_MAX)
+        return invalid(tp, TE_TEST_INVAL, "Test number is too large");
+
+    /* Numbers are checked like parse_test() does */
+    test_num = (f.test_num == 0) ? tp->test_num + 1 : (long)f.test_num;
+    if (test_num != tp->test_num + 1) {
+        if (test_num == tp->test_num) {
+            return invalid(tp, TE_TEST_DUP,
+                           "Duplicate test number %ld",
+                           test_num);
+        }
+        invalid(tp, TE_TEST_ORDER,
+                "Tests out of squence.  "
+                "Found (%ld) but expected (%ld)",
+                test_num, tp->test_num + 1);
+    }
+
+    return put_test(tp, (enum tap_test_type)f.status,
+                    (tp->buffer[0] != '\0') ? tp->buffer : NULL, directive);
+}
+
+/* There's no line for the callbacks to look at */
+static inline void
+put_begin(tap_parser *tp)
+{
+    tp->first_line = 0;
+    tp->buffer[0] = '\0';
+    stamp_line(tp);
+}
+
+int
+tap_parser_put_plan(tap_parser *tp, long upper, const char *skip)
+{
+    int ret;
+
+    put_begin(tp);
+    ret = put_plan(tp, upper, skip);
+    line_done(tp);
+    return ret;
+}
+
+int
+tap_parser_put_test(tap_parser *tp, enum tap_test_type type,
+                    const char *reason, const char *directive)
+{
+    int ret;
+
+    put_begin(tp);
+    ret = put_test(tp, type, reason, directive);
+    line_done(tp);
+    return ret;
+}
+
+int
+tap_parser_put_comment(tap_parser *tp, const char *text)
+{
+    int ret;
+
+    put_begin(tp);
+    snprintf(tp->buffer, tp->buffer_len, "# %s", text);
+    ret = put_comment(tp);
+    line_done(tp);
+    return ret;
 }
 
 /* vim: set ts=4 sw=4 sts=4 expandtab: */
@@ -0,0 +1,175 @@
+#include <string.h>
+
+#include "tap_frame.h"
+
+/* Longest varint of an unsigned long */
+#define VARINT_MAX ((sizeof(unsigned long) * 8 + 6) / 7)
+
+/* Highest status byte, TTT_SKIP_FAILED */
+#define STATUS_MAX 6
+
+/* Returns the bytes read, 0 if buf ends first, -1 if it's too long */
+static int
+get_varint(const unsigned char *buf, size_t len, unsigned long *value)
+{
+    size_t i;
+    unsigned long v = 0;
+
+    for (i = 0; i < len; ++i) {
+        if (i == VARINT_MAX)
+            return -1;
+
+        v |= (unsigned long)(buf[i] & 0x7f) << (7 * i);
+        if ((buf[i] & 0x80) == 0) {
+            *value = v;
+            return (int)i + 1;
+        }
+    }
+
+    return (len >= VARINT_MAX) ? -1 : 0;
+}
+
+static size_t
+put_varint(unsigned char *buf, unsigned long value)
+{
+    size_t i = 0;
+
+    while (value >= 0x80) {
+        buf[i++] = (unsigned char)(value | 0x80);
+        value >>= 7;
+    }
+
+    buf[i++] = (unsigned char)value;
+    return i;
+}
+
+/* A varint, then that many bytes.  Returns where it ends like
+ * tap_frame_len(), *start is where the bytes start. */
+static size_t
+string_end(const unsigned char *buf, size_t len, size_t pos, size_t *start)
+{
+    int n;
+    unsigned long slen;
+
+    n = get_varint(buf + pos, len - pos, &slen);
+    if (n == 0)
+        return 0;
+    if (n == -1 || slen > TAP_FRAME_MAX)
+        return (size_t)-1;
+
+    *start = pos + n;
+    if (*start + slen > TAP_FRAME_MAX)
+        return (size_t)-1;
+    if (*start + slen > len)
+        return 0;
+
+    return *start + slen;
+}
+
+size_t
+tap_frame_len(const char *buf, size_t len)
+{
+    int n;
+    size_t pos;
+    size_t start;
+    unsigned long num;
+    const unsigned char *b = (const unsigned char *)buf;
+
+    if (len == 0)
+        return 0;
+
+    if (b[0] > STATUS_MAX)
+        return (size_t)-1;
+
+    if (b[0] == TAP_FRAME_TEXT)
+        return string_end(b, len, 1, &start);
+
+    n = get_varint(b + 1, len - 1, &num);
+    if (n == -1)
+        return (size_t)-1;
+    if (n == 0)
+        return 0;
+
+    /* The description, then the directive */
+    pos = string_end(b, len, 1 + n, &start);
+    if (pos == 0 || pos == (size_t)-1)
+        return pos;
+
+    return string_end(b, len, pos, &start);
+}
+
+int
+tap_frame_decode(const char *buf, size_t len, tap_frame *f)
+{
+    int n;
+    size_t pos;
+    size_t start;
+    const unsigned char *b = (const unsigned char *)buf;
+
+    memset(f, 0, sizeof(*f));
+
+    if (tap_frame_len(buf, len) != len)
+        return -1;
+
+    f->status = b[0];
+
+    pos = 1;
+    if (f->status != TAP_FRAME_TEXT) {
+        n = get_varint(b + pos, len - pos, &f->test_num);
+        pos += n;
+    }
+
+    pos = string_end(b, len, pos, &start);
+    f->text = buf + start;
+    f->text_len = pos - start;
+
+    if (f->status != TAP_FRAME_TEXT) {
+        pos = string_end(b, len, pos, &start);
+        f->directive = buf + start;
+        f->directive_len = pos - start;
+    }
+
+    return 0;
+}
+
+size_t
+tap_frame_encode(char *buf, const tap_frame *f)
+{
+    size_t pos;
+    size_t room;
+    size_t text_len;
+    size_t directive_len;
+    unsigned char *b = (unsigned char *)buf;
+
+    b[0] = (unsigned char)f->status;
+    pos = 1;
+    if (f->status != TAP_FRAME_TEXT)
+        pos += put_varint(b + pos, f->test_num);
+
+    /* Room left with the length varints at their longest */
+    room = TAP_FRAME_MAX - pos - 2 * VARINT_MAX;
+
+    directive_len = (f->status == TAP_FRAME_TEXT) ? 0 : f->directive_len;
+    if (directive_len > room / 2)
+        directive_len = room / 2;
+
+    text_len = f->text_len;
+    if (text_len > room - directive_len)
+        text_len = room - directive_len;
+
+    pos += put_varint(b + pos, text_len);
+    if (text_len > 0)
+        memcpy(b + pos, f->text, text_len);
+    pos += text_len;
+
+    if (f->status != TAP_FRAME_TEXT) {
+        pos += put_varint(b + pos, directive_len);
+        if (directive_len > 0)
+            memcpy(b + pos, f->directive, directive_len);
+        pos += directive_len;
+    }
+
+    return pos;
+}
+
+/* vim: set ts=4 sw=4 sts=4 expandtab: */
@@ -0,0 +1,56 @@
+#ifndef _H_TAP_FRAME
+#define _H_TAP_FRAME
+
+#include <stddef.h>
+
+/* Binary TAP, for tests producing results faster than text is worth
+ * formatting and parsing.  A producer switches to it with
+ *
+ *   TAP version 13
+ *   pragma +binary
+ *
+ * after which the input is frames instead of lines:
+ *
+ *   status byte 1-6   a test, the byte is its enum tap_test_type,
+ *                     then a varint test number (0 for the next one),
+ *                     a varint length and the description, and a
+ *                     varint length and the directive's reason
+ *   status byte 0     a line of text TAP (without its newline) after a
+ *                     varint length: plans, comments, bail outs and
+ *                     "pragma -binary" to go back to lines
+ *
+ * Varints are unsigned LEB128: 7 bits at a time, low bits first, the
+ * high bit set on all bytes but the last.  No frame is longer than
+ * TAP_FRAME_MAX, producers cut descriptions to fit.
+ */
+
+#define TAP_FRAME_MAX 4096
+
+#define TAP_FRAME_TEXT 0
+
+typedef struct {
+    int status;         /* TAP_FRAME_TEXT or an enum tap_test_type */
+    unsigned long test_num;
+
+    /* Text of a TAP_FRAME_TEXT frame, or the description */
+    const char *text;
+    size_t text_len;
+
+    const char *directive;
+    size_t directive_len;
+} tap_frame;
+
+/* Bytes the frame at buf takes, 0 if len doesn't have all of it yet.
+ * Garbage is (size_t)-1, there's no telling where it ends. */
+extern size_t tap_frame_len(const char *buf, size_t len);
+
+/* Take apart the len bytes of a whole frame, 0 if they're a frame */
+extern int tap_frame_decode(const char *buf, size_t len, tap_frame *f);
+
+/* Put f into buf of TAP_FRAME_MAX bytes, returns its length.
+ * The text and directive are cut to make it fit. */
+extern size_t tap_frame_encode(char *buf, const tap_frame *f);
+
+#endif /* _H_TAP_FRAME */
+
+/* vim: set ts=4 sw=4 sts=4 expandtab: */
@@ -0,0 +1,347 @@
+#include <sys/epoll.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "tap_mux.h"
+
+typedef struct _tap_mux_stream {
+    tap_parser *tp;     /* NULL once removed */
+
+    /* The start of a line or frame that hasn't ended yet,
+     * always shorter than carry_size() */
+    char *carry;
+    size_t carry_len;
+
+    struct _tap_mux_stream *prev;
+    struct _tap_mux_stream *next;
+} tap_mux_stream;
+
+/* Room for the carried over start of a record: a line is cut into
+ * pieces of the parser's buffer, a frame never is */
+static inline size_t
+carry_size(const tap_parser *tp)
+{
+    return (tp->buffer_len < TAP_FRAME_MAX) ? TAP_FRAME_MAX : tp->buffer_len;
+}
+
+int
+tap_mux_init(tap_mux *mux, size_t read_len)
+{
+    int ret;
+
+    memset(mux, 0, sizeof(*mux));
+
+    /* when read_len == 0 assume default */
+    if (read_len == 0)
+        mux->buffer_len = TAP_MUX_DEFAULT_READ_LEN;
+    else
+        mux->buffer_len = read_len;
+
+    mux->epfd = epoll_create1(EPOLL_CLOEXEC);
+    if (mux->epfd == -1)
+        return errno;
+
+    mux->buffer = (char *)malloc(mux->buffer_len);
+    mux->events = (struct epoll_event *)malloc(TAP_MUX_EVENTS * sizeof(struct epoll_event));
+    if (mux->buffer == NULL || mux->events == NULL) {
+        ret = errno;
+        tap_mux_fini(mux);
+        return ret;
+    }
+
+    return 0;
+}
+
+static void
+free_list(tap_mux_stream *s)
+{
+    tap_mux_stream *next;
+
+    for (; s != NULL; s = next) {
+        next = s->next;
+        free(s->carry);
+        free(s);
+    }
+}
+
+void
+tap_mux_fini(tap_mux *mux)
+{
+    if (mux->epfd != -1)
+        close(mux->epfd);
+
+    free_list(mux->streams);
+    free_list(mux->dead);
+    free(mux->buffer);
+    free(mux->grown);
+    free(mux->events);
+
+    memset(mux, 0, sizeof(*mux));
+    mux->epfd = -1;
+}
+
+/* Make the read buffer at least len bytes.  During a wait a callback
+ * may be walking the lines of the old one, so it's only swapped for
+ * the new one by take_grown().  Returns errno. */
+static int
+grow_buffer(tap_mux *mux, size_t len)
+{
+    char *buffer;
+
+    if (!mux->waiting) {
+        buffer = (char *)realloc(mux->buffer, len);
+        if (buffer == NULL)
+            return errno;
+
+        mux->buffer = buffer;
+        mux->buffer_len = len;
+        return 0;
+    }
+
+    if (len <= mux->grown_len)
+        return 0;
+
+    /* Nothing reads from a grown buffer before it's taken */
+    buffer = (char *)malloc(len);
+    if (buffer == NULL)
+        return errno;
+
+    free(mux->grown);
+    mux->grown = buffer;
+    mux->grown_len = len;
+    return 0;
+}
+
+/* Switch to a buffer grown during the wait, nothing may be using the
+ * old one */
+static void
+take_grown(tap_mux *mux)
+{
+    if (mux->grown == NULL)
+        return;
+
+    free(mux->buffer);
+    mux->buffer = mux->grown;
+    mux->buffer_len = mux->grown_len;
+    mux->grown = NULL;
+    mux->grown_len = 0;
+}
+
+int
+tap_mux_add(tap_mux *mux, tap_parser *tp)
+{
+    int flags;
+    tap_mux_stream *s;
+    struct epoll_event ev;
+
+    /* A carried over record has to fit in front of a read */
+    if (carry_size(tp) * 2 > mux->buffer_len) {
+        flags = grow_buffer(mux, carry_size(tp) * 2);
+        if (flags != 0)
+            return flags;
+    }
+
+    s = (tap_mux_stream *)calloc(1, sizeof(*s));
+    if (s == NULL)
+        return errno;
+
+    s->tp = tp;
+    s->carry = (char *)malloc(carry_size(tp));
+    if (s->carry == NULL)
+        goto fail;
+
+    flags = fcntl(tp->fd, F_GETFL);
+    if (flags == -1 || fcntl(tp->fd, F_SETFL, flags | O_NONBLOCK) == -1)
+        goto fail;
+
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN;
+    ev.data.ptr = s;
+    if (epoll_ctl(mux->epfd, EPOLL_CTL_ADD, tp->fd, &ev) == -1)
+        goto fail;
+
+    s->next = mux->streams;
+    if (s->next != NULL)
+        s->next->prev = s;
+    mux->streams = s;
+    mux->count++;
+
+    return 0;
+
+fail:
+    flags = errno;
+    free(s->carry);
+    free(s);
+    return flags;
+}
+
+/* Unlink s, during a wait it's only freed once the wait is over since
+ * events for it may still be pending */
+static void
+drop_stream(tap_mux *mux, tap_mux_stream *s)
+{
+    epoll_ctl(mux->epfd, EPOLL_CTL_DEL, s->tp->fd, NULL);
+    s->tp = NULL;
+
+    if (s->prev != NULL)
+        s->prev->next = s->next;
+    else
+        mux->streams = s->next;
+    if (s->next != NULL)
+        s->next->prev = s->prev;
+    mux->count--;
+
+    if (mux->waiting) {
+        s->prev = NULL;
+        s->next = mux->dead;
+        mux->dead = s;
+        return;
+    }
+
+    free(s->carry);
+    free(s);
+}
+
+int
+tap_mux_remove(tap_mux *mux, tap_parser *tp)
+{
+    tap_mux_stream *s;
+
+    for (s = mux->streams; s != NULL; s = s->next) {
+        if (s->tp == tp) {
+            drop_stream(mux, s);
+            return 0;
+        }
+    }
+
+    return ENOENT;
+}
+
+/* Hand every complete line or frame in buf to the parser, the partial
+ * one at the end is carried over to the next read.  Returns what the
+ * parser returned when it asked to stop, 0 otherwise. */
+static int
+feed_lines(tap_mux_stream *s, char *buf, size_t len)
+{
+    int ret;
+    char *end;
+    size_t n;
+    size_t chunk;
+    tap_parser *tp;
+
+    tp = s->tp;
+    end = buf + len;
+
+    while ((n = tap_parser_record_len(tp, buf, end - buf)) != 0) {
+        ret = tap_parser_line(tp, buf, n);
+        /* A callback may have removed the stream */
+        if (ret != 0 || s->tp == NULL)
+            return ret;
+        buf += n;
+    }
+
+    /* Lines longer than the parser's buffer are split into the
+     * same pieces get_line() would read them in */
+    len = end - buf;
+    chunk = tp->buffer_len - 1;
+    if (!tp->binary && len >= chunk) {
+        chunk = len - len % chunk;
+        ret = tap_parser_line(tp, buf, chunk);
+        if (ret != 0 || s->tp == NULL)
+            return ret;
+        buf += chunk;
+        len -= chunk;
+    }
+
+    memcpy(s->carry, buf, len);
+    s->carry_len = len;
+    return 0;
+}
+
+/* The stream is over, tell the user */
+static void
+finish_stream(tap_mux *mux, tap_mux_stream *s, int status)
+{
+    tap_parser *tp = s->tp;
+
+    drop_stream(mux, s);
+    if (mux->done_callback != NULL)
+        mux->done_callback(mux, tp, status);
+}
+
+/* One read from a ready stream */
+static void
+read_stream(tap_mux *mux, tap_mux_stream *s)
+{
+    int ret;
+    ssize_t n;
+
+    /* The last read's lines are done with */
+    take_grown(mux);
+
+    memcpy(mux->buffer, s->carry, s->carry_len);
+
+    n = read(s->tp->fd, mux->buffer + s->carry_len, mux->buffer_len - s->carry_len);
+    if (n == -1) {
+        if (errno == EINTR || errno == EAGAIN || errno == EWOULDBLOCK)
+            return;
+        finish_stream(mux, s, errno);
+        return;
+    }
+
+    if (n == 0) {
+        /* The last line may not have a newline */
+        ret = 0;
+        if (s->carry_len > 0)
+            ret = tap_parser_line(s->tp, s->carry, s->carry_len);
+        if (s->tp != NULL)
+            finish_stream(mux, s, ret);
+        return;
+    }
+
+    ret = feed_lines(s, mux->buffer, s->carry_len + (size_t)n);
+    if (ret != 0 && s->tp != NULL)
+        finish_stream(mux, s, ret);
+}
+
+int
+tap_mux_wait(tap_mux *mux, int timeout)
+{
+    int i;
+    int nev;
+    tap_mux_stream *s;
+
+    if (mux->count == 0)
+        return 0;
+
+    nev = epoll_wait(mux->epfd, mux->events, TAP_MUX_EVENTS, timeout);
+    if (nev == -1) {
+        if (errno == EINTR)
+            return (int)mux->count;
+        return -1;
+    }
+
+    mux->waiting = 1;
+    for (i = 0; i < nev; ++i) {
+        s = (tap_mux_stream *)mux->events[i].data.ptr;
+        if (s->tp == NULL)
+            continue;
+
+        /* Level triggered, anything not read now is there next time */
+        read_stream(mux, s);
+    }
+    mux->waiting = 0;
+
+    take_grown(mux);
+    free_list(mux->dead);
+    mux->dead = NULL;
+
+    return (int)mux->count;
+}
+
+/* vim: set ts=4 sw=4 sts=4 expandtab: */
@@ -0,0 +1,83 @@
+#ifndef _H_TAP_MUX
+#define _H_TAP_MUX
+
+#include <stddef.h>
+
+#include "tap_parser.h"
+
+/* Watch many TAP streams from one thread.
+ *
+ * A tap_mux owns a set of parsers and their fds.  tap_mux_wait()
+ * waits with epoll until some of the fds are readable, reads a chunk
+ * from each and runs the parsers' callbacks over every complete line,
+ * or frame after "pragma +binary".
+ * Each ready fd is read once per wait so a busy stream can't starve
+ * the rest.
+ */
+
+struct _tap_mux;
+typedef struct _tap_mux tap_mux;
+
+/* done callback is called when a stream is finished, after it has been
+ * removed from the mux.  The parser and its fd belong to the caller
+ * again, the fd isn't closed.
+ * Args:
+ *  int status - 0 at end of input, a read errno, or what the parser
+ *               returned when it asked to stop (a bail out)
+ * Streams can be added and removed from here and from the parser
+ * callbacks, but the mux can't be finished.
+ */
+typedef void(*tap_mux_done_callback)(tap_mux*, tap_parser*, int);
+
+struct _tap_mux {
+    tap_mux_done_callback done_callback;
+
+    /* Arbitrary Pointer for external use.
+     * This is here for the user,
+     * we don't reference it. */
+    void *arbitrary;
+
+    /* Mux Storage */
+    int epfd;
+    char *buffer;       /* shared read buffer */
+    size_t buffer_len;
+    char *grown;        /* bigger buffer added during a wait, taken */
+    size_t grown_len;   /* over once no read is using the old one */
+    size_t count;       /* streams being watched */
+    struct _tap_mux_stream *streams;
+    struct _tap_mux_stream *dead;   /* removed during a wait */
+    struct epoll_event *events;
+    int waiting;
+};
+
+/* Default size of the shared read buffer */
+#define TAP_MUX_DEFAULT_READ_LEN (64 * 1024)
+
+/* Most fds handled by one tap_mux_wait() */
+#define TAP_MUX_EVENTS 256
+
+/* Initialize the mux, read_len is the size of the shared read buffer,
+ * 0 for the default.  Returns errno on failure. */
+extern int tap_mux_init(tap_mux *mux, size_t read_len);
+
+/* Stops watching everything, the done callback isn't called */
+extern void tap_mux_fini(tap_mux *mux);
+
+/* Start watching tp->fd, which is made non-blocking.
+ * Returns errno on failure. */
+extern int tap_mux_add(tap_mux *mux, tap_parser *tp);
+
+/* Stop watching tp without calling the done callback,
+ * a partial line read so far is dropped.  Returns errno on failure. */
+extern int tap_mux_remove(tap_mux *mux, tap_parser *tp);
+
+/* Wait up to timeout milliseconds (-1 forever) for input and parse it.
+ * Returns the number of streams still watched, -1 with errno set on
+ * failure.  EINTR isn't a failure. */
+extern int tap_mux_wait(tap_mux *mux, int timeout);
+
+#define tap_mux_set_done_callback(mux, fn) do { (mux)->done_callback = fn; } while(0)
+
+#endif /* _H_TAP_MUX */
+
+/* vim: set ts=4 sw=4 sts=4 expandtab: */
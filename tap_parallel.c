@@ -0,0 +1,586 @@
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "tap_parallel.h"
+
+/* Smaller files aren't worth splitting */
+#define MIN_CHUNK_LEN (1024 * 1024)
+
+/* Several chunks per thread even out chunks that parse slower */
+#define CHUNKS_PER_THREAD 4
+
+typedef struct {
+    int err;
+    char *msg;
+} chunk_diag;
+
+typedef struct {
+    const char *start;
+    const char *end;
+    size_t buffer_len;
+
+    /* The state parsing started from */
+    long base;          /* tests before the chunk, -1 when unknown */
+    long plan;
+    long version;
+    int first_line;
+
+    tap_parser cp;
+    int parsed;
+    int ret;            /* what stopped parsing, 0 at the end of the chunk,
+                         * EPROTONOSUPPORT at "pragma +binary" */
+    int error;          /* errno if parsing failed */
+
+    /* What parsing depended on besides the state above */
+    int saw_plan;       /* the plan callback was called */
+    int unstored;       /* a test below base was set */
+    long max_test;
+
+    chunk_diag *diags;
+    size_t diags_len;
+    size_t diags_size;
+} tap_chunk;
+
+typedef struct {
+    tap_chunk *chunks;
+    size_t nchunks;
+    size_t next;        /* next chunk to parse, taken atomically */
+} chunk_pool;
+
+
+/* Chunk parser callbacks, they count like the defaults */
+
+static int
+chunk_invalid(tap_parser *tp, int err, const char *msg)
+{
+    void *p;
+    size_t size;
+    tap_chunk *c = (tap_chunk *)tp->arbitrary;
+
+    if (c->diags_len == c->diags_size) {
+        size = c->diags_size ? c->diags_size * 2 : 16;
+        p = realloc(c->diags, size * sizeof(chunk_diag));
+        if (p == NULL) {
+            c->error = errno;
+            return 0;
+        }
+
+        c->diags = (chunk_diag *)p;
+        c->diags_size = size;
+    }
+
+    c->diags[c->diags_len].err = err;
+    c->diags[c->diags_len].msg = strdup(msg);
+    if (c->diags[c->diags_len].msg == NULL) {
+        c->error = errno;
+        return 0;
+    }
+    c->diags_len++;
+
+    return 0;
+}
+
+static int
+chunk_plan(tap_parser *tp, long upper, char *skip)
+{
+    tap_chunk *c = (tap_chunk *)tp->arbitrary;
+
+    c->saw_plan = 1;
+    return tap_default_plan_callback(tp, upper, skip);
+}
+
+static int
+chunk_test(tap_parser *tp, tap_test_result *ttr)
+{
+    tap_chunk *c = (tap_chunk *)tp->arbitrary;
+
+    if (ttr->test_num < tp->results_base)
+        c->unstored = 1;
+    if (ttr->test_num > c->max_test)
+        c->max_test = ttr->test_num;
+
+    return tap_default_test_callback(tp, ttr);
+}
+
+/* The test number of the first test line, less one */
+static long
+guess_base(const char *p, const char *end)
+{
+    long num;
+    const char *nl;
+
+    for (; p < end; p = nl + 1) {
+        nl = (const char *)memchr(p, '\n', end - p);
+        if (nl == NULL)
+            nl = end;
+
+        if (nl - p > 4 && strncmp(p, "not ", 4) == 0) {
+            p += 4;
+            while (p < nl && isspace(*p))
+                ++p;
+        }
+
+        if (nl - p < 2 || strncmp(p, "ok", 2) != 0)
+            continue;
+
+        p += 2;
+        while (p < nl && isspace(*p))
+            ++p;
+
+        if (p == nl || !isdigit(*p))
+            continue;
+
+        num = 0;
+        while (p < nl && isdigit(*p) && num < LONG_MAX / 10)
+            num = num * 10 + (*p++ - '0');
+
+        return num - 1;
+    }
+
+    return -1;
+}
+
+static void
+chunk_fini(tap_chunk *c)
+{
+    size_t i;
+
+    if (c->parsed)
+        tap_parser_fini(&c->cp);
+    c->parsed = 0;
+
+    for (i = 0; i < c->diags_len; ++i)
+        free(c->diags[i].msg);
+    free(c->diags);
+
+    c->diags = NULL;
+    c->diags_len = 0;
+    c->diags_size = 0;
+}
+
+/* Parse the chunk from the state in c, results go to tr when it's
+ * given and to a slice starting at c->base otherwise */
+static void
+parse_chunk(tap_chunk *c, tap_results *tr)
+{
+    int ret;
+    size_t len;
+    const char *p;
+    const char *nl;
+
+    c->saw_plan = 0;
+    c->unstored = 0;
+    c->max_test = 0;
+    c->ret = 0;
+    c->error = 0;
+
+    ret = tap_parser_init(&c->cp, c->buffer_len);
+    if (ret != 0) {
+        c->error = ret;
+        return;
+    }
+    c->parsed = 1;
+
+    tap_parser_set_test_callback(&c->cp, chunk_test);
+    tap_parser_set_plan_callback(&c->cp, chunk_plan);
+    tap_parser_set_invalid_callback(&c->cp, chunk_invalid);
+    c->cp.arbitrary = c;
+
+    c->cp.test_num = c->base;
+    c->cp.plan = c->plan;
+    c->cp.version = c->version;
+    c->cp.first_line = c->first_line;
+    /* Tells whether a pragma set it */
+    c->cp.strict = -1;
+
+    if (tr != NULL) {
+        tap_results_fini(c->cp.tr);
+        c->cp.tr = tr;
+    }
+    else {
+        c->cp.results_base = c->base;
+    }
+
+    for (p = c->start; p < c->end; p = nl + 1) {
+        nl = (const char *)memchr(p, '\n', c->end - p);
+        if (nl == NULL) {
+            /* Like get_line(), an unterminated last line
+             * is only parsed in whole buffers */
+            len = c->end - p;
+            len -= len % (c->buffer_len - 1);
+            if (len == 0)
+                break;
+            nl = p + len - 1;
+        }
+
+        ret = tap_parser_line(&c->cp, p, nl - p + 1);
+        if (ret != 0) {
+            c->ret = ret;
+            break;
+        }
+
+        /* Frames don't end at newlines, the rest can't be split */
+        if (c->cp.binary) {
+            c->ret = EPROTONOSUPPORT;
+            break;
+        }
+    }
+}
+
+static void*
+worker_main(void *arg)
+{
+    size_t i;
+    tap_chunk *c;
+    chunk_pool *pool = (chunk_pool *)arg;
+
+    for (;;) {
+        i = __atomic_fetch_add(&pool->next, 1, __ATOMIC_SEQ_CST);
+        if (i >= pool->nchunks)
+            break;
+
+        c = &pool->chunks[i];
+        if (i != 0)
+            c->base = guess_base(c->start, c->end);
+
+        /* No test number to start from, parsed when merging */
+        if (c->base == -1)
+            continue;
+
+        parse_chunk(c, NULL);
+    }
+
+    return NULL;
+}
+
+/* Was c parsed from the state tp is in now? */
+static int
+chunk_fits(const tap_parser *tp, const tap_chunk *c)
+{
+    if (!c->parsed || c->error != 0 || c->unstored)
+        return 0;
+
+    if (c->base != tp->test_num || c->version != tp->version
+            || c->first_line != tp->first_line)
+        return 0;
+
+    if (c->plan == tp->plan)
+        return 1;
+
+    /* Parsed without the plan, fine unless it would have
+     * made a difference */
+    return !c->saw_plan && c->max_test <= tp->plan;
+}
+
+static int
+grow_results(tap_results *tr, size_t len)
+{
+    void *p;
+
+    if (len <= tr->results_len)
+        return 0;
+
+    p = realloc(tr->results, len * sizeof(enum tap_test_type));
+    if (p == NULL)
+        return errno;
+
+    tr->results = (enum tap_test_type *)p;
+    memset(&(tr->results[tr->results_len]), 0,
+           (len - tr->results_len) * sizeof(enum tap_test_type));
+    tr->results_len = len;
+
+    return 0;
+}
+
+/* Fold the results of c into tp, tp is in the state c started from */
+static int
+merge_chunk(tap_parser *tp, tap_chunk *c, int sliced)
+{
+    int ret;
+    size_t i;
+    size_t n;
+    tap_parser *cp = &c->cp;
+    enum tap_test_type *slice;
+
+    if (sliced && cp->tr->results_len > 0) {
+        ret = grow_results(tp->tr, cp->tr->results_len);
+        if (ret != 0)
+            return ret;
+
+        slice = cp->tr->results;
+        n = 0;
+        if (slice != NULL && cp->tr->results_len > (size_t)c->base)
+            n = cp->tr->results_len - c->base;
+
+        /* Later tests win, like when they're parsed in order */
+        for (i = 0; i < n; ++i) {
+            if (slice[i] != TTT_INVALID)
+                tp->tr->results[c->base + i] = slice[i];
+        }
+    }
+
+    tp->first_line = cp->first_line;
+    tp->version = cp->version;
+    tp->test_num = cp->test_num;
+    if (cp->strict != -1)
+        tp->strict = cp->strict;
+
+    if (cp->plan != c->plan)
+        tp->plan = cp->plan;
+
+    if (cp->skip_all) {
+        tp->skip_all = 1;
+        free(tp->skip_all_reason);
+        tp->skip_all_reason = cp->skip_all_reason;
+        cp->skip_all_reason = NULL;
+    }
+
+    if (cp->bailed) {
+        tp->bailed = 1;
+        free(tp->bailed_reason);
+        tp->bailed_reason = cp->bailed_reason;
+        cp->bailed_reason = NULL;
+    }
+
+    tp->tests_run += cp->tests_run;
+    tp->skipped += cp->skipped;
+    tp->passed += cp->passed;
+    tp->todo += cp->todo;
+    tp->failed += cp->failed;
+    tp->todo_passed += cp->todo_passed;
+    tp->skip_failed += cp->skip_failed;
+    tp->parse_errors += cp->parse_errors;
+
+    for (i = 0; i < c->diags_len; ++i) {
+        if (tp->invalid_callback == NULL)
+            tap_default_invalid_callback(tp, c->diags[i].err, c->diags[i].msg);
+        else
+            tp->invalid_callback(tp, c->diags[i].err, c->diags[i].msg);
+    }
+
+    return 0;
+}
+
+/* Guess the version from the first line that isn't blank */
+static long
+guess_version(const tap_parser *tp, const char *p, const char *end)
+{
+    long version;
+    const char *nl;
+    tap_parser scratch;
+
+    if (tap_parser_init(&scratch, tp->buffer_len) != 0)
+        return tp->version;
+
+    scratch.version = tp->version;
+    scratch.first_line = tp->first_line;
+
+    for (; p < end && scratch.first_line; p = nl + 1) {
+        nl = (const char *)memchr(p, '\n', end - p);
+        if (nl == NULL)
+            nl = end - 1;
+
+        if (tap_parser_line(&scratch, p, nl - p + 1) != 0)
+            break;
+    }
+
+    version = scratch.version;
+    tap_parser_fini(&scratch);
+
+    return version;
+}
+
+int
+tap_parser_parse_file(tap_parser *tp, const char *path, int threads)
+{
+    int fd;
+    int ret;
+    size_t i;
+    size_t size;
+    size_t nchunks;
+    size_t started;
+    char *map;
+    const char *p;
+    const char *end;
+    long version;
+    struct stat sb;
+    chunk_pool pool;
+    tap_chunk *c;
+    pthread_t *tids;
+
+    fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd == -1)
+        return errno;
+
+    if (fstat(fd, &sb) == -1) {
+        ret = errno;
+        close(fd);
+        return ret;
+    }
+
+    size = (size_t)sb.st_size;
+    if (size == 0) {
+        close(fd);
+        return 0;
+    }
+
+    map = (char *)mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    ret = errno;
+    close(fd);
+    if (map == MAP_FAILED)
+        return ret;
+
+    madvise(map, size, MADV_SEQUENTIAL);
+
+    if (tp->tr == NULL) {
+        tp->tr = (tap_results *)calloc(1, sizeof(tap_results));
+        if (tp->tr == NULL) {
+            ret = errno;
+            munmap(map, size);
+            return ret;
+        }
+    }
+
+    /* Timings and diagnostics can't be kept alongside merged results,
+     * and a finished file isn't a stream */
+    tp->timing = 0;
+    tp->stream = 0;
+    free(tp->tr->timings);
+    tp->tr->timings = NULL;
+
+    tp->diag_cap = 0;
+    if (tp->tr->diags != NULL) {
+        tap_diags_fini(tp->tr->diags);
+        free(tp->tr->diags);
+        tp->tr->diags = NULL;
+    }
+
+    if (threads <= 0)
+        threads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    if (threads <= 0)
+        threads = 1;
+
+    nchunks = (size_t)threads * CHUNKS_PER_THREAD;
+    if (nchunks > size / MIN_CHUNK_LEN)
+        nchunks = size / MIN_CHUNK_LEN;
+    if (nchunks == 0)
+        nchunks = 1;
+    if ((size_t)threads > nchunks)
+        threads = (int)nchunks;
+
+    pool.chunks = (tap_chunk *)calloc(nchunks, sizeof(tap_chunk));
+    tids = (pthread_t *)calloc(threads, sizeof(pthread_t));
+    if (pool.chunks == NULL || tids == NULL) {
+        ret = errno;
+        free(pool.chunks);
+        free(tids);
+        munmap(map, size);
+        return ret;
+    }
+    pool.nchunks = nchunks;
+    pool.next = 0;
+
+    /* Split after a newline, the first chunk gets the exact state */
+    end = map + size;
+    p = map;
+    for (i = 0; i < nchunks; ++i) {
+        c = &pool.chunks[i];
+        c->start = p;
+        c->buffer_len = tp->buffer_len;
+
+        if (i + 1 == nchunks) {
+            p = end;
+        }
+        else if (p < map + size * (i + 1) / nchunks) {
+            p = (const char *)memchr(map + size * (i + 1) / nchunks, '\n',
+                                     end - (map + size * (i + 1) / nchunks));
+            p = (p == NULL) ? end : p + 1;
+        }
+        c->end = p;
+
+        c->base = tp->test_num;
+        c->plan = tp->plan;
+        c->version = tp->version;
+        c->first_line = tp->first_line;
+    }
+
+    /* Everything after the first line is parsed with its version */
+    version = guess_version(tp, map, pool.chunks[0].end);
+    for (i = 1; i < nchunks; ++i) {
+        pool.chunks[i].plan = -1;
+        pool.chunks[i].version = version;
+        pool.chunks[i].first_line = 0;
+    }
+
+    started = 0;
+    for (i = 1; i < (size_t)threads; ++i) {
+        if (pthread_create(&tids[started], NULL, worker_main, &pool) != 0)
+            break;
+        ++started;
+    }
+    worker_main(&pool);
+
+    for (i = 0; i < started; ++i)
+        pthread_join(tids[i], NULL);
+
+    ret = 0;
+    for (i = 0; i < nchunks; ++i) {
+        c = &pool.chunks[i];
+
+        if (chunk_fits(tp, c)) {
+            ret = merge_chunk(tp, c, 1);
+        }
+        else {
+            /* Guessed wrong, parse it again in order */
+            chunk_fini(c);
+            c->base = tp->test_num;
+            c->plan = tp->plan;
+            c->version = tp->version;
+            c->first_line = tp->first_line;
+
+            parse_chunk(c, tp->tr);
+            if (c->parsed) {
+                /* Realloc may have moved things, tr is still tp's */
+                tp->tr = c->cp.tr;
+                c->cp.tr = NULL;
+            }
+
+            ret = c->error;
+            if (ret == 0)
+                ret = merge_chunk(tp, c, 0);
+        }
+
+        if (ret == 0)
+            ret = c->error;
+        if (ret == 0 && c->ret == EPROTONOSUPPORT && c->cp.binary)
+            ret = EPROTONOSUPPORT;
+
+        /* Progress for tap_parser_stats(), a chunk at a time */
+        if (tp->stats_on)
+            tap_parser_publish_stats(tp);
+
+        if (ret != 0 || c->ret != 0)
+            break;
+    }
+
+    for (i = 0; i < nchunks; ++i)
+        chunk_fini(&pool.chunks[i]);
+
+    free(pool.chunks);
+    free(tids);
+    munmap(map, size);
+
+    return ret;
+}
+
+/* vim: set ts=4 sw=4 sts=4 expandtab: */
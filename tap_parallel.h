@@ -0,0 +1,34 @@
+#ifndef _H_TAP_PARALLEL
+#define _H_TAP_PARALLEL
+
+#include "tap_parser.h"
+
+/* Parse a TAP file that's already complete, an archived log say, on
+ * several threads.
+ *
+ * The file is mmapped and split at line boundaries into chunks.  Each
+ * chunk is parsed on its own, starting from a guess of the parser
+ * state at its start (the test number is taken from its first test
+ * line).  The chunks are then merged in order, a chunk whose guess was
+ * wrong is parsed again from the real state.  tp ends up just like it
+ * would after calling tap_parser_next() until it returned non-zero.
+ *
+ * Everything is counted the way the default callbacks count it, the
+ * only callback of tp that's called is the invalid callback.  It gets
+ * every diagnostic in input order once the chunks are parsed, what it
+ * returns doesn't stop parsing.  Timing is turned off, the times of
+ * reading an old file mean nothing, and so are keeping diagnostics
+ * and streaming.
+ *
+ * Only text can be split like that.  Parsing stops after a
+ * "pragma +binary" line, tp has everything up to it and
+ * EPROTONOSUPPORT is returned.
+ *
+ * threads is how many threads to use, 0 for one per online CPU.
+ * Returns 0 or errno.
+ */
+extern int tap_parser_parse_file(tap_parser *tp, const char *path, int threads);
+
+#endif /* _H_TAP_PARALLEL */
+
+/* vim: set ts=4 sw=4 sts=4 expandtab: */
@@ -2,6 +2,7 @@
 #include <stddef.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 
 #include "tap_parser.h"
 #include "tap_constants.h"
@@ -80,10 +81,24 @@ tap_parser_reset(tap_parser *tp)
     if (tp->bailed_reason != NULL)
         free(tp->bailed_reason);
 
+    if (tp->source_buf != NULL)
+        free(tp->source_buf);
+
+    if (tp->frame != NULL)
+        free(tp->frame);
+
     /* If it's not stolen wipe it out */
     if (tp->tr) {
         if (tp->tr->results)
             free(tp->tr->results);
+        if (tp->tr->timings)
+            free(tp->tr->timings);
+        if (tp->tr->diags) {
+            tap_diags_fini(tp->tr->diags);
+            free(tp->tr->diags);
+        }
+        if (tp->tr->recent)
+            free(tp->tr->recent);
         memset(tp->tr, 0, sizeof(tap_results));
         results = tp->tr;
     }
@@ -127,10 +142,208 @@ tap_parser_fini(tap_parser *tp)
     if (tp->buffer)
         free(tp->buffer);
 
+    if (tp->source_buf)
+        free(tp->source_buf);
+
+    if (tp->frame)
+        free(tp->frame);
+
     if (tp->tr)
         tap_results_fini(tp->tr);
 }
 
+void
+tap_parser_set_source(tap_parser *tp, tap_source *src)
+{
+    tp->source = src;
+    tp->source_pos = 0;
+    tp->source_len = 0;
+}
+
+void
+tap_parser_set_diags(tap_parser *tp, size_t cap, size_t test_cap, int failing_only)
+{
+    tp->diag_cap = cap;
+    tp->diag_test_cap = test_cap;
+    tp->diag_failing = failing_only;
+}
+
+void
+tap_parser_set_stats(tap_parser *tp, int on)
+{
+    tp->stats_on = on;
+    if (on)
+        tap_parser_publish_stats(tp);
+}
+
+/* A seqlock: the sequence is odd while the words change, readers
+ * retry when it was odd or changed while they copied */
+void
+tap_parser_publish_stats(tap_parser *tp)
+{
+    size_t i;
+    unsigned long seq;
+    tap_stats now;
+    long *src = (long *)&now;
+    long *dst = (long *)&tp->stats;
+
+    now.lines = tp->stats_lines;
+    now.version = tp->version;
+    now.plan = tp->plan;
+    now.test_num = tp->test_num;
+    now.tests_run = tp->tests_run;
+    now.skipped = tp->skipped;
+    now.passed = tp->passed;
+    now.todo = tp->todo;
+    now.failed = tp->failed;
+    now.todo_passed = tp->todo_passed;
+    now.skip_failed = tp->skip_failed;
+    now.parse_errors = tp->parse_errors;
+    now.bailed = tp->bailed;
+
+    seq = tp->stats_seq;
+    __atomic_store_n(&tp->stats_seq, seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+
+    for (i = 0; i < sizeof(tap_stats) / sizeof(long); ++i)
+        __atomic_store_n(&dst[i], src[i], __ATOMIC_RELAXED);
+
+    __atomic_store_n(&tp->stats_seq, seq + 2, __ATOMIC_RELEASE);
+}
+
+void
+tap_parser_stats(const tap_parser *tp, tap_stats *stats)
+{
+    size_t i;
+    unsigned long seq;
+    long *dst = (long *)stats;
+    const long *src = (const long *)&tp->stats;
+
+    for (;;) {
+        seq = __atomic_load_n(&tp->stats_seq, __ATOMIC_ACQUIRE);
+        if (seq & 1)
+            continue;
+
+        for (i = 0; i < sizeof(tap_stats) / sizeof(long); ++i)
+            dst[i] = __atomic_load_n(&src[i], __ATOMIC_RELAXED);
+
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if (__atomic_load_n(&tp->stats_seq, __ATOMIC_RELAXED) == seq)
+            return;
+    }
+}
+
+void
+tap_parser_set_stream(tap_parser *tp, int on, size_t window)
+{
+    struct timespec ts;
+
+    tp->stream = on;
+    tp->window = window;
+    if (!on)
+        return;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    memset(tp->rate, 0, sizeof(tp->rate));
+    tp->rate_start = (long)ts.tv_sec;
+}
+
+void
+tap_parser_rates(const tap_parser *tp, tap_rates *rates)
+{
+    int i;
+    long now;
+    long secs;
+    long passed;
+    long failed;
+    struct timespec ts;
+
+    memset(rates, 0, sizeof(*rates));
+    if (!tp->stream)
+        return;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    now = (long)ts.tv_sec;
+
+    passed = failed = 0;
+    for (i = 0; i < TAP_RATE_SECONDS; ++i) {
+        if (now - tp->rate[i].sec >= TAP_RATE_SECONDS)
+            continue;
+        passed += tp->rate[i].passed;
+        failed += tp->rate[i].failed;
+    }
+
+    /* A stream younger than that is averaged over its life */
+    secs = now - tp->rate_start + 1;
+    if (secs > TAP_RATE_SECONDS)
+        secs = TAP_RATE_SECONDS;
+
+    rates->pass_rate = (double)passed / secs;
+    rates->fail_rate = (double)failed / secs;
+
+    if (tp->tr != NULL) {
+        rates->recent = tp->tr->recent_end - 1;
+        if (rates->recent > (long)tp->tr->recent_len)
+            rates->recent = (long)tp->tr->recent_len;
+        if (rates->recent < 0)
+            rates->recent = 0;
+        rates->recent_failed = tp->tr->recent_failed;
+    }
+}
+
+enum tap_test_type
+tap_results_get(const tap_results *tr, long test_num)
+{
+    long first;
+    long end;
+
+    tap_results_range(tr, &first, &end);
+    if (test_num < first || test_num >= end)
+        return TTT_INVALID;
+
+    if (tr->recent != NULL)
+        return tr->recent[test_num % tr->recent_len];
+
+    return tr->results[test_num];
+}
+
+void
+tap_results_range(const tap_results *tr, long *first, long *end)
+{
+    *first = 1;
+    *end = 1;
+
+    if (tr == NULL)
+        return;
+
+    if (tr->recent != NULL) {
+        *end = tr->recent_end;
+        if (*end - (long)tr->recent_len > 1)
+            *first = *end - (long)tr->recent_len;
+    }
+    else if (tr->recent_end > 0) {
+        /* A stream keeping nothing */
+        *first = *end = tr->recent_end;
+    }
+    else if (tr->results != NULL && tr->results_len > 1) {
+        *end = (long)tr->results_len;
+    }
+}
+
+void
+tap_parser_set_timing(tap_parser *tp, int on)
+{
+    struct timespec ts;
+
+    tp->timing = on;
+    if (!on)
+        return;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    tp->line_stamp = (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+    tp->test_stamp = tp->line_stamp;
+}
+
 tap_results*
 tap_parser_steal_results(tap_parser *tp)
 {
@@ -151,6 +364,17 @@ tap_results_fini(tap_results *tr)
     if (tr->results != NULL)
         free(tr->results);
 
+    if (tr->timings != NULL)
+        free(tr->timings);
+
+    if (tr->diags != NULL) {
+        tap_diags_fini(tr->diags);
+        free(tr->diags);
+    }
+
+    if (tr->recent != NULL)
+        free(tr->recent);
+
     free(tr);
 }
 
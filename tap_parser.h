@@ -3,6 +3,14 @@
 
 #include <stddef.h>
 
+#include "tap_diag.h"
+#include "tap_frame.h"
+#include "tap_source.h"
+
+/* tap_parser_step() has no complete line yet, callbacks shouldn't
+ * return this */
+#define TAP_WOULD_BLOCK (-2)
+
 /* Error codes for the invalid callback
  * Starting at 1000 to circumvent conflicting with an errno
  */
@@ -20,6 +28,7 @@ enum tap_error_code {
     TE_TODO_PASS      = 1010, /* Todo unexpectedly passed */
     TE_SKIP_FAIL      = 1011, /* Skip unexpectedly failed */
     TE_UNKNOWN        = 1012, /* Unknown errors... or something */
+    TE_FRAME_PARSE    = 1013, /* Garbage where a binary frame should be */
 };
 
 enum tap_test_type {
@@ -41,13 +50,61 @@ typedef struct {
 } tap_test_result;
 
 
+/* Seconds the rates of a stream are taken over */
+#define TAP_RATE_SECONDS 10
+
 /* The results array from running a test script */
 typedef struct {
     /* List of test results */
     enum tap_test_type *results; /* Results list */
     size_t results_len;          /* Number of currently allocated results */
+
+    /* Seconds between each test line and the test line before it
+     * (or the start of timing for the first), indexed like results.
+     * NULL unless timing was on, see tap_parser_set_timing(). */
+    double *timings;
+
+    /* Comment and unknown lines after each test line,
+     * NULL unless kept, see tap_parser_set_diags(). */
+    tap_diags *diags;
+
+    /* Streaming, see tap_parser_set_stream(): results is NULL and
+     * the last tests are kept in a ring instead, test n is at
+     * recent[n % recent_len] for the recent_len tests before
+     * recent_end.  Use tap_results_range() and tap_results_get()
+     * to look at results either way. */
+    enum tap_test_type *recent;
+    size_t recent_len;
+    long recent_end;    /* highest test number seen + 1 */
+    long recent_failed; /* failures among the ones kept */
 } tap_results;
 
+/* Counters of the parse, copied out by tap_parser_stats().
+ * All longs, they're published a word at a time. */
+typedef struct {
+    long lines;        /* lines given to tap_parser_next/line() */
+    long version;
+    long plan;
+    long test_num;
+    long tests_run;
+    long skipped;
+    long passed;
+    long todo;
+    long failed;
+    long todo_passed;
+    long skip_failed;
+    long parse_errors;
+    long bailed;
+} tap_stats;
+
+/* Rolling numbers of a stream, see tap_parser_rates() */
+typedef struct {
+    double pass_rate;   /* passing tests per second */
+    double fail_rate;   /* failing tests per second */
+    long recent;        /* tests in the window */
+    long recent_failed; /* failures among them */
+} tap_rates;
+
 struct _tap_parser;
 typedef struct _tap_parser tap_parser;
 
@@ -147,10 +204,56 @@ struct _tap_parser {
     char *buffer;
     size_t buffer_len;
 
+    /* tr->results[0] is this test number, 0 unless the parser only
+     * parses a piece of the input, see tap_parallel.h */
+    long results_base;
+
+    /* Read ahead from source, source_pos is where the next line starts */
+    char *source_buf;
+    size_t source_pos;
+    size_t source_len;
+
+    /* Start of a line in buffer, tap_parser_step() waits for the rest */
+    size_t partial_len;
+
+    /* The input is frames, see tap_frame.h.  frame holds one being
+     * read by tap_parser_next() or tap_parser_step(). */
+    int binary;
+    char *frame;
+
     /* Parser Config */
     int strict;
     int fd;
+    tap_source *source; /* read from here instead of fd when set */
     int blocking_time;
+    int timing; /* stamp lines with CLOCK_MONOTONIC */
+
+    /* CLOCK_MONOTONIC seconds when the current line was read,
+     * and when the last test line was, only kept with timing */
+    double line_stamp;
+    double test_stamp;
+
+    /* Keep diagnostics when diag_cap isn't 0, see tap_parser_set_diags() */
+    size_t diag_cap;
+    size_t diag_test_cap;
+    int diag_failing;
+
+    /* Published counters, see tap_parser_set_stats().
+     * stats_seq is odd while stats is being written. */
+    int stats_on;
+    long stats_lines;
+    unsigned long stats_seq;
+    tap_stats stats;
+
+    /* Streaming, see tap_parser_set_stream() */
+    int stream;
+    size_t window;
+    struct {
+        long sec;   /* CLOCK_MONOTONIC second of the counts */
+        long passed;
+        long failed;
+    } rate[TAP_RATE_SECONDS];
+    long rate_start;
 
     /* Arbitrary Pointer for external use.
      * This is here for the user,
@@ -196,9 +299,96 @@ extern tap_results* tap_parser_steal_results(tap_parser *tp);
  * Since tap_results are always pointers, this will free(tr) */
 extern void tap_results_fini(tap_results *tr);
 
-/* Get next line of tap, 0 if good, 1 if no more input */
+/* Turn per line timestamps on or off, off after init and reset.
+ * Turning them on starts the clock for the first test line. */
+extern void tap_parser_set_timing(tap_parser *tp, int on);
+
+/* Keep the comment and unknown lines after each test line in
+ * tp->tr->diags, at most cap bytes of them and test_cap bytes for
+ * any one test (0 for cap).  With failing_only only the lines after
+ * failing tests are kept (not ok, todo passed and skip failed),
+ * the others are dropped as they come.  Lines before the first test
+ * go with test 0.  cap 0 turns it off, off after init and reset. */
+extern void tap_parser_set_diags(tap_parser *tp, size_t cap, size_t test_cap,
+                                 int failing_only);
+
+/* Publish the counters after every line for other threads to read
+ * with tap_parser_stats(), off after init and reset.  Don't reset the
+ * parser or turn this off while someone may be reading. */
+extern void tap_parser_set_stats(tap_parser *tp, int on);
+
+/* Publish the counters now, for callbacks that change them themselves
+ * outside of a line being parsed.  Only the parsing thread may call it. */
+extern void tap_parser_publish_stats(tap_parser *tp);
+
+/* Copy the counters last published into stats, from any thread.
+ * Lock free: the parser never waits for readers, a reader only
+ * retries when it raced with a publish. */
+extern void tap_parser_stats(const tap_parser *tp, tap_stats *stats);
+
+/* Streaming, for output that may never end (soak tests, no plan).
+ * Instead of the results of every test only the last window tests
+ * are kept (none for 0, see tap_results), memory stays the same
+ * however long the stream runs.  The counters are kept as always,
+ * tap_parser_rates() has rolling rates on top.  Timings aren't kept.
+ * Off after init and reset. */
+extern void tap_parser_set_stream(tap_parser *tp, int on, size_t window);
+
+/* Pass and fail rates over the last TAP_RATE_SECONDS seconds, and
+ * failures in the window of a stream */
+extern void tap_parser_rates(const tap_parser *tp, tap_rates *rates);
+
+/* Result of test_num, TTT_INVALID when it's missing or isn't kept */
+extern enum tap_test_type tap_results_get(const tap_results *tr, long test_num);
+
+/* Test numbers with results kept are first up to, not including, end */
+extern void tap_results_range(const tap_results *tr, long *first, long *end);
+
+/* Read input from src instead of tp->fd, NULL goes back to tp->fd.
+ * Whatever was read ahead from the old source is dropped. */
+extern void tap_parser_set_source(tap_parser *tp, tap_source *src);
+
+/* Get next line of tap, 0 if good, 1 if no more input.
+ *
+ * After "pragma +binary" the input is frames (see tap_frame.h), each
+ * one parsed like a line by this and the calls below.  A test frame
+ * goes to the test callback like a test line, tp->buffer holds its
+ * description then. */
 extern int tap_parser_next(tap_parser *tp);
 
+/* Non-blocking tap_parser_next() for event loops: parses the next
+ * line if it's all there.  Reads source or fd (which should be
+ * O_NONBLOCK, it's read(2) as it is) in big pieces, never sleeps and
+ * keeps what it has of a line in the parser until the rest arrives.
+ * Returns TAP_WOULD_BLOCK when it needs more input, call it again once
+ * the fd is readable (or the source's wait() says so), otherwise like
+ * tap_parser_next().  Don't mix it with other ways of feeding the
+ * parser on the same input, it reads ahead. */
+extern int tap_parser_step(tap_parser *tp);
+
+/* Results from a producer in the same process (see tap_producer.h),
+ * handled as if their line was parsed: the same counters, results and
+ * callbacks, without the text.  Tests are numbered in order.  For a
+ * test or plan the callbacks see an empty tp->buffer, for a comment
+ * "# text" (cut to the buffer).  Return like tap_parser_next(). */
+extern int tap_parser_put_plan(tap_parser *tp, long upper, const char *skip);
+extern int tap_parser_put_test(tap_parser *tp, enum tap_test_type type,
+                               const char *reason, const char *directive);
+extern int tap_parser_put_comment(tap_parser *tp, const char *text);
+
+/* For callers cutting the input into lines for tap_parser_line():
+ * the bytes of the next line in buf, with the newline, or of the
+ * next frame after "pragma +binary".  0 if it isn't all there yet.
+ * Depends on what was parsed, so cut and parse one at a time. */
+extern size_t tap_parser_record_len(const tap_parser *tp, const char *buf, size_t len);
+
+/* Parse a line of tap the caller already read, instead of reading
+ * from tp->fd.  line doesn't need to be nul terminated and should
+ * include the newline if there is one, after "pragma +binary" it's
+ * frames.  Returns like tap_parser_next()
+ * minus the end of input case. */
+extern int tap_parser_line(tap_parser *tp, const char *line, size_t len);
+
 /* default callbacks */
 extern int tap_default_invalid_callback(tap_parser *tp, int, const char *msg);
 extern int tap_default_unknown_callback(tap_parser *tp);
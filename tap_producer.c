@@ -0,0 +1,341 @@
+#include <errno.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "tap_producer.h"
+
+void
+tap_producer_init(tap_producer *p, tap_parser *tp, FILE *out)
+{
+    memset(p, 0, sizeof(*p));
+    p->tp = tp;
+    p->out = (tp == NULL) ? out : NULL;
+    p->plan = -1;
+    p->ring.fd = p->ring.data_fd = p->ring.space_fd = -1;
+}
+
+void
+tap_producer_init_env(tap_producer *p)
+{
+    const char *spec;
+
+    tap_producer_init(p, NULL, stdout);
+
+    spec = getenv(TAP_RING_ENV);
+    if (spec == NULL)
+        return;
+
+    /* One writer per ring, not whatever this runs too */
+    if (tap_ring_attach(&p->ring, spec) == 0)
+        p->out = NULL;
+    unsetenv(TAP_RING_ENV);
+}
+
+void
+tap_producer_fini(tap_producer *p)
+{
+    if (p->ring.data != NULL) {
+        tap_ring_finish(&p->ring);
+        tap_ring_close(&p->ring);
+    }
+}
+
+/* Returns 0 or errno */
+static int
+put_bytes(tap_producer *p, const char *buf, size_t len)
+{
+    int ret = 0;
+
+    if (p->ring.data != NULL)
+        ret = tap_ring_write(&p->ring, buf, len);
+    else if (fwrite(buf, 1, len, p->out) != len)
+        ret = (errno != 0) ? errno : EIO;
+
+    if (ret != 0 && p->error == 0)
+        p->error = ret;
+    return ret;
+}
+
+/* A line of text, framed when binary.  Returns 0 or errno. */
+static int
+put_text(tap_producer *p, const char *fmt, ...)
+{
+    int ret;
+    size_t len;
+    va_list ap;
+    tap_frame f;
+    char line[2 * TAP_PRODUCER_LINE_LEN];
+    char frame[TAP_FRAME_MAX];
+
+    va_start(ap, fmt);
+    ret = vsnprintf(line, sizeof(line), fmt, ap);
+    va_end(ap);
+
+    /* Cut, but still a line */
+    len = (size_t)ret;
+    if (len >= sizeof(line)) {
+        len = sizeof(line) - 1;
+        line[len - 1] = '\n';
+    }
+
+    if (!p->binary)
+        return put_bytes(p, line, len);
+
+    memset(&f, 0, sizeof(f));
+    f.status = TAP_FRAME_TEXT;
+    f.text = line;
+    f.text_len = len - 1;
+    return put_bytes(p, frame, tap_frame_encode(frame, &f));
+}
+
+int
+tap_producer_set_binary(tap_producer *p)
+{
+    int ret;
+
+    if (p->tp != NULL)
+        return 0;
+
+    if (p->test_num != 0 || p->plan != -1)
+        return EINVAL;
+
+    /* Pragmas need TAP 13, and the version has to come first */
+    ret = put_text(p, "TAP version 13\npragma +binary\n");
+    if (ret == 0)
+        p->binary = 1;
+
+    return ret;
+}
+
+/* A description can't end the line early or start a directive */
+static void
+escape(char *dst, size_t len, const char *src)
+{
+    size_t i = 0;
+
+    for (; *src != '\0' && i + 2 < len; ++src) {
+        if (*src == '#')
+            dst[i++] = '\\';
+        dst[i++] = (*src == '\n') ? ' ' : *src;
+    }
+
+    dst[i] = '\0';
+}
+
+static int
+plan(tap_producer *p, long tests, const char *skip)
+{
+    if (p->plan != -1) {
+        p->error = EINVAL;
+        return EINVAL;
+    }
+
+    p->plan = tests;
+
+    if (p->tp != NULL)
+        return tap_parser_put_plan(p->tp, tests, skip);
+
+    if (skip != NULL)
+        return put_text(p, "1..0 # skip %s\n", skip);
+    if (tests == 0)
+        return put_text(p, "1..0 # skip\n");
+    return put_text(p, "1..%ld\n", tests);
+}
+
+int
+tap_plan(tap_producer *p, long tests)
+{
+    return plan(p, tests, NULL);
+}
+
+int
+tap_skip_all(tap_producer *p, const char *reason)
+{
+    return plan(p, 0, reason);
+}
+
+/* Each line of text as a comment */
+static int
+comment(tap_producer *p, char *text)
+{
+    int ret = 0;
+    char *nl;
+
+    do {
+        nl = strchr(text, '\n');
+        if (nl != NULL)
+            *nl = '\0';
+
+        if (p->tp != NULL)
+            ret = tap_parser_put_comment(p->tp, text);
+        else
+            ret = put_text(p, "# %s\n", text);
+
+        text = nl + 1;
+    } while (ret == 0 && nl != NULL && *text != '\0');
+
+    return ret;
+}
+
+int
+tap_comment(tap_producer *p, const char *fmt, ...)
+{
+    va_list ap;
+    char text[TAP_PRODUCER_LINE_LEN];
+
+    va_start(ap, fmt);
+    vsnprintf(text, sizeof(text), fmt, ap);
+    va_end(ap);
+
+    return comment(p, text);
+}
+
+/* Test number p->test_num + 1, skip is NULL unless it was skipped */
+static int
+result(tap_producer *p, int pass, const char *desc, const char *skip)
+{
+    enum tap_test_type type;
+    const char *directive;
+    tap_frame f;
+    char escaped[TAP_PRODUCER_LINE_LEN];
+    char frame[TAP_FRAME_MAX];
+
+    p->test_num++;
+
+    if (skip != NULL) {
+        type = TTT_SKIP;
+        directive = skip;
+    }
+    else if (p->todo != NULL) {
+        type = pass ? TTT_TODO_PASSED : TTT_TODO;
+        directive = p->todo;
+    }
+    else {
+        type = pass ? TTT_OK : TTT_NOT_OK;
+        directive = NULL;
+    }
+
+    if (type == TTT_NOT_OK)
+        p->failed++;
+
+    if (p->tp != NULL) {
+        if (desc != NULL && desc[0] == '\0')
+            desc = NULL;
+        if (directive != NULL && directive[0] == '\0')
+            directive = NULL;
+        return tap_parser_put_test(p->tp, type, desc, directive);
+    }
+
+    if (p->binary) {
+        f.status = type;
+        f.test_num = (unsigned long)p->test_num;
+        f.text = desc;
+        f.text_len = (desc != NULL) ? strlen(desc) : 0;
+        f.directive = directive;
+        f.directive_len = (directive != NULL) ? strlen(directive) : 0;
+        return put_bytes(p, frame, tap_frame_encode(frame, &f));
+    }
+
+    escape(escaped, sizeof(escaped), (desc != NULL) ? desc : "");
+
+    return put_text(p, "%sok %ld%s%s%s%s%s\n",
+                    pass ? "" : "not ",
+                    p->test_num,
+                    (escaped[0] != '\0') ? " - " : "", escaped,
+                    (skip != NULL) ? " # skip" : (p->todo != NULL) ? " # TODO" : "",
+                    (directive != NULL && directive[0] != '\0') ? " " : "",
+                    (directive != NULL) ? directive : "");
+}
+
+int
+tap_ok(tap_producer *p, int pass, const char *fmt, ...)
+{
+    va_list ap;
+    char desc[TAP_PRODUCER_LINE_LEN];
+
+    va_start(ap, fmt);
+    vsnprintf(desc, sizeof(desc), fmt, ap);
+    va_end(ap);
+
+    return result(p, pass, desc, NULL);
+}
+
+int
+tap_is(tap_producer *p, long got, long expected, const char *fmt, ...)
+{
+    int ret;
+    va_list ap;
+    char desc[TAP_PRODUCER_LINE_LEN];
+
+    va_start(ap, fmt);
+    vsnprintf(desc, sizeof(desc), fmt, ap);
+    va_end(ap);
+
+    ret = result(p, got == expected, desc, NULL);
+    if (ret != 0 || got == expected)
+        return ret;
+
+    return tap_comment(p, "     got: %ld\n"
+                          "expected: %ld", got, expected);
+}
+
+int
+tap_is_str(tap_producer *p, const char *got, const char *expected,
+           const char *fmt, ...)
+{
+    int ret;
+    int same;
+    va_list ap;
+    char desc[TAP_PRODUCER_LINE_LEN];
+
+    va_start(ap, fmt);
+    vsnprintf(desc, sizeof(desc), fmt, ap);
+    va_end(ap);
+
+    if (got == NULL || expected == NULL)
+        same = (got == expected);
+    else
+        same = (strcmp(got, expected) == 0);
+
+    ret = result(p, same, desc, NULL);
+    if (ret != 0 || same)
+        return ret;
+
+    /* Quoted, so trailing whitespace shows */
+    return tap_comment(p, "     got: %s%s%s\n"
+                          "expected: %s%s%s",
+                       (got != NULL) ? "'" : "", (got != NULL) ? got : "NULL",
+                       (got != NULL) ? "'" : "",
+                       (expected != NULL) ? "'" : "",
+                       (expected != NULL) ? expected : "NULL",
+                       (expected != NULL) ? "'" : "");
+}
+
+int
+tap_skip(tap_producer *p, const char *reason)
+{
+    return result(p, 1, NULL, (reason != NULL) ? reason : "");
+}
+
+int
+tap_done(tap_producer *p)
+{
+    if (p->plan == -1)
+        plan(p, p->test_num, NULL);
+    else if (p->plan != p->test_num)
+        p->error = EINVAL;
+
+    if (p->out != NULL && fflush(p->out) == EOF && p->error == 0)
+        p->error = errno;
+    if (p->ring.data != NULL)
+        tap_ring_flush(&p->ring);
+
+    if (p->error != 0)
+        return 255;
+
+    return (p->failed > 254) ? 254 : (int)p->failed;
+}
+
+/* vim: set ts=4 sw=4 sts=4 expandtab: */
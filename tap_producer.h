@@ -0,0 +1,89 @@
+#ifndef _H_TAP_PRODUCER
+#define _H_TAP_PRODUCER
+
+#include <stdio.h>
+
+#include "tap_parser.h"
+#include "tap_ring.h"
+
+/* Writing TAP: plan, ok, is and comment (a diagnostic) like Test::More.
+ *
+ * A producer given a parser puts its results straight into it, see
+ * tap_parser_put_test(), so a test running in the harness's process
+ * costs neither a pipe nor formatting and parsing the lines.  Without
+ * one it writes the TAP text to a FILE, stdout for a test program, or
+ * to the ring the harness passed in the environment, see tap_ring.h.
+ *
+ * Descriptions and comments are printf formats, cut to
+ * TAP_PRODUCER_LINE_LEN.  When written, a description goes after "- "
+ * with any # escaped, when put into a parser it's the test's reason as
+ * is.  Functions return 0 or errno when writing, and what the parser
+ * returned when putting.
+ */
+
+#define TAP_PRODUCER_LINE_LEN 1024
+
+typedef struct {
+    tap_parser *tp;   /* results go into it if not NULL */
+    FILE *out;        /* or are written here */
+    tap_ring ring;    /* or here, if ring.data isn't NULL */
+    int binary;       /* written as frames, see tap_frame.h */
+
+    long test_num;    /* tests so far */
+    long failed;      /* of which failed */
+    long plan;        /* -1 until there's one */
+    int error;        /* first errno writing, EINVAL for a bad plan */
+
+    /* Tests are TODO while set, the reason */
+    const char *todo;
+} tap_producer;
+
+/* One of tp or out, tp wins if both are given */
+extern void tap_producer_init(tap_producer *p, tap_parser *tp, FILE *out);
+
+/* For a test program: the harness's ring if it passed one,
+ * stdout otherwise */
+extern void tap_producer_init_env(tap_producer *p);
+
+/* Write frames instead of text lines from now on, before anything
+ * else is written.  Nothing changes when putting into a parser.
+ * Returns errno, EINVAL if it's too late. */
+extern int tap_producer_set_binary(tap_producer *p);
+
+/* Tell the reader the ring is finished and release it, after tap_done() */
+extern void tap_producer_fini(tap_producer *p);
+
+/* 1..tests, before the first test or after the last one */
+extern int tap_plan(tap_producer *p, long tests);
+
+/* 1..0 # skip reason, reason may be NULL */
+extern int tap_skip_all(tap_producer *p, const char *reason);
+
+/* A test that passed if pass is true */
+extern int tap_ok(tap_producer *p, int pass, const char *fmt, ...)
+    __attribute__((format(printf, 3, 4)));
+
+/* A test that got == expected, failures say what it got */
+extern int tap_is(tap_producer *p, long got, long expected, const char *fmt, ...)
+    __attribute__((format(printf, 4, 5)));
+
+/* tap_is() for strings, NULL is fine */
+extern int tap_is_str(tap_producer *p, const char *got, const char *expected,
+                      const char *fmt, ...)
+    __attribute__((format(printf, 4, 5)));
+
+/* A test skipped, reason may be NULL */
+extern int tap_skip(tap_producer *p, const char *reason);
+
+/* A comment line, "# " is added */
+extern int tap_comment(tap_producer *p, const char *fmt, ...)
+    __attribute__((format(printf, 2, 3)));
+
+/* The plan if there was none yet, then flush the output.  Returns an
+ * exit code like Test::More's: the failed tests, at most 254, or 255
+ * if the plan wasn't followed or writing failed. */
+extern int tap_done(tap_producer *p);
+
+#endif /* _H_TAP_PRODUCER */
+
+/* vim: set ts=4 sw=4 sts=4 expandtab: */
@@ -0,0 +1,339 @@
+/* memfd_create() */
+#define _GNU_SOURCE
+
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "tap_ring.h"
+
+#define RING_MAGIC "TAPRING1"
+
+static size_t
+page_size(void)
+{
+    long ret = sysconf(_SC_PAGESIZE);
+    return (ret > 0) ? (size_t)ret : 4096;
+}
+
+/* The header takes the first page of the memfd */
+static size_t
+header_len(void)
+{
+    size_t page = page_size();
+    return (sizeof(tap_ring_shared) + page - 1) / page * page;
+}
+
+/* Map the memfd of r->size data bytes, returns errno */
+static int
+map_ring(tap_ring *r)
+{
+    char *data;
+    void *shared;
+
+    shared = mmap(NULL, header_len(), PROT_READ | PROT_WRITE, MAP_SHARED, r->fd, 0);
+    if (shared == MAP_FAILED)
+        return errno;
+
+    /* Room for both mappings, then the data twice into it */
+    data = (char *)mmap(NULL, 2 * r->size, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (data == MAP_FAILED)
+        goto fail;
+
+    if (mmap(data, r->size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED,
+             r->fd, (off_t)header_len()) == MAP_FAILED
+            || mmap(data + r->size, r->size, PROT_READ | PROT_WRITE,
+                    MAP_SHARED | MAP_FIXED, r->fd, (off_t)header_len()) == MAP_FAILED) {
+        munmap(data, 2 * r->size);
+        goto fail;
+    }
+
+    r->shared = (tap_ring_shared *)shared;
+    r->data = data;
+    return 0;
+
+fail:
+    munmap(shared, header_len());
+    return errno;
+}
+
+static void
+init_ring(tap_ring *r)
+{
+    memset(r, 0, sizeof(*r));
+    r->fd = -1;
+    r->data_fd = -1;
+    r->space_fd = -1;
+}
+
+int
+tap_ring_create(tap_ring *r, size_t size)
+{
+    int ret;
+    size_t page;
+
+    init_ring(r);
+
+    page = page_size();
+    r->size = (size + page - 1) / page * page;
+    if (r->size == 0)
+        r->size = page;
+
+    r->fd = memfd_create("tap_ring", 0);
+    if (r->fd == -1)
+        goto fail;
+
+    if (ftruncate(r->fd, (off_t)(header_len() + r->size)) == -1)
+        goto fail;
+
+    /* Only the reader reads data_fd and only the writer space_fd,
+     * the reader polls it and the writer blocks on it */
+    r->data_fd = eventfd(0, EFD_NONBLOCK);
+    if (r->data_fd == -1)
+        goto fail;
+
+    r->space_fd = eventfd(0, 0);
+    if (r->space_fd == -1)
+        goto fail;
+
+    ret = map_ring(r);
+    if (ret != 0) {
+        errno = ret;
+        goto fail;
+    }
+
+    memcpy(r->shared->magic, RING_MAGIC, sizeof(r->shared->magic));
+    r->shared->size = r->size;
+    return 0;
+
+fail:
+    ret = errno;
+    tap_ring_close(r);
+    return ret;
+}
+
+void
+tap_ring_env(const tap_ring *r, char *buf, size_t len)
+{
+    snprintf(buf, len, "%d,%d,%d", r->fd, r->data_fd, r->space_fd);
+}
+
+int
+tap_ring_attach(tap_ring *r, const char *spec)
+{
+    int ret;
+    tap_ring_shared *shared;
+
+    init_ring(r);
+
+    if (sscanf(spec, "%d,%d,%d", &r->fd, &r->data_fd, &r->space_fd) != 3) {
+        init_ring(r);
+        return EINVAL;
+    }
+
+    shared = (tap_ring_shared *)mmap(NULL, header_len(), PROT_READ,
+                                     MAP_SHARED, r->fd, 0);
+    if (shared == MAP_FAILED) {
+        ret = errno;
+        init_ring(r);
+        return ret;
+    }
+
+    if (memcmp(shared->magic, RING_MAGIC, sizeof(shared->magic)) != 0
+            || shared->size == 0 || shared->size % page_size() != 0) {
+        munmap(shared, header_len());
+        init_ring(r);
+        return EINVAL;
+    }
+
+    r->size = shared->size;
+    r->head = shared->head;
+    munmap(shared, header_len());
+
+    ret = map_ring(r);
+    if (ret != 0) {
+        init_ring(r);
+        return ret;
+    }
+
+    return 0;
+}
+
+void
+tap_ring_close(tap_ring *r)
+{
+    if (r->shared != NULL)
+        munmap(r->shared, header_len());
+    if (r->data != NULL)
+        munmap(r->data, 2 * r->size);
+
+    if (r->fd != -1)
+        close(r->fd);
+    if (r->data_fd != -1)
+        close(r->data_fd);
+    if (r->space_fd != -1)
+        close(r->space_fd);
+
+    init_ring(r);
+}
+
+void
+tap_ring_reset(tap_ring *r)
+{
+    uint64_t n;
+
+    r->shared->head = 0;
+    r->shared->tail = 0;
+    r->head = 0;
+    r->shared->reader_sleeping = 0;
+    r->shared->writer_sleeping = 0;
+    r->shared->finished = 0;
+    r->broken = 0;
+
+    /* Wakeups left over */
+    while (read(r->data_fd, &n, sizeof(n)) > 0)
+        ;
+}
+
+static void
+wake(int fd)
+{
+    ssize_t ret;
+    uint64_t one = 1;
+
+    do {
+        ret = write(fd, &one, sizeof(one));
+    } while (ret == -1 && errno == EINTR);
+}
+
+void
+tap_ring_flush(tap_ring *r)
+{
+    tap_ring_shared *s = r->shared;
+
+    if (r->head == s->head)
+        return;
+
+    __atomic_store_n(&s->head, r->head, __ATOMIC_SEQ_CST);
+
+    if (__atomic_exchange_n(&s->reader_sleeping, 0, __ATOMIC_SEQ_CST))
+        wake(r->data_fd);
+}
+
+void
+tap_ring_finish(tap_ring *r)
+{
+    tap_ring_flush(r);
+    __atomic_store_n(&r->shared->finished, 1, __ATOMIC_SEQ_CST);
+
+    if (__atomic_exchange_n(&r->shared->reader_sleeping, 0, __ATOMIC_SEQ_CST))
+        wake(r->data_fd);
+}
+
+int
+tap_ring_finished(tap_ring *r)
+{
+    return r->broken || __atomic_load_n(&r->shared->finished, __ATOMIC_SEQ_CST);
+}
+
+int
+tap_ring_write(tap_ring *r, const char *buf, size_t len)
+{
+    size_t n;
+    ssize_t ret;
+    uint64_t count;
+    unsigned long tail;
+    tap_ring_shared *s = r->shared;
+
+    while (len > 0) {
+        tail = __atomic_load_n(&s->tail, __ATOMIC_SEQ_CST);
+
+        n = r->size - (r->head - tail);
+        if (n == 0) {
+            /* Full, sleep unless the reader made room meanwhile */
+            tap_ring_flush(r);
+            __atomic_store_n(&s->writer_sleeping, 1, __ATOMIC_SEQ_CST);
+            if (__atomic_load_n(&s->tail, __ATOMIC_SEQ_CST) == tail) {
+                ret = read(r->space_fd, &count, sizeof(count));
+                if (ret == -1 && errno != EINTR) {
+                    __atomic_store_n(&s->writer_sleeping, 0, __ATOMIC_SEQ_CST);
+                    return errno;
+                }
+            }
+            __atomic_store_n(&s->writer_sleeping, 0, __ATOMIC_SEQ_CST);
+            continue;
+        }
+
+        if (n > len)
+            n = len;
+
+        /* The second mapping takes care of wrapping around */
+        memcpy(r->data + r->head % r->size, buf, n);
+        r->head += n;
+        buf += n;
+        len -= n;
+    }
+
+    if (r->head - s->head >= TAP_RING_BATCH)
+        tap_ring_flush(r);
+
+    return 0;
+}
+
+size_t
+tap_ring_peek(tap_ring *r, const char **buf)
+{
+    unsigned long head;
+    unsigned long tail = r->shared->tail;
+
+    *buf = r->data + tail % r->size;
+    head = __atomic_load_n(&r->shared->head, __ATOMIC_SEQ_CST);
+    if (r->broken || head - tail > r->size) {
+        r->broken = 1;
+        return 0;
+    }
+
+    return head - tail;
+}
+
+void
+tap_ring_consume(tap_ring *r, size_t len)
+{
+    tap_ring_shared *s = r->shared;
+
+    __atomic_store_n(&s->tail, s->tail + len, __ATOMIC_SEQ_CST);
+
+    if (__atomic_exchange_n(&s->writer_sleeping, 0, __ATOMIC_SEQ_CST))
+        wake(r->space_fd);
+}
+
+int
+tap_ring_sleep(tap_ring *r)
+{
+    tap_ring_shared *s = r->shared;
+
+    __atomic_store_n(&s->reader_sleeping, 1, __ATOMIC_SEQ_CST);
+    if (r->broken || __atomic_load_n(&s->head, __ATOMIC_SEQ_CST) == s->tail)
+        return 0;
+
+    __atomic_store_n(&s->reader_sleeping, 0, __ATOMIC_SEQ_CST);
+    return 1;
+}
+
+void
+tap_ring_wake(tap_ring *r)
+{
+    uint64_t n;
+
+    __atomic_store_n(&r->shared->reader_sleeping, 0, __ATOMIC_SEQ_CST);
+    while (read(r->data_fd, &n, sizeof(n)) > 0)
+        ;
+}
+
+/* vim: set ts=4 sw=4 sts=4 expandtab: */
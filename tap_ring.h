@@ -0,0 +1,104 @@
+#ifndef _H_TAP_RING
+#define _H_TAP_RING
+
+#include <stddef.h>
+
+/* TAP text from a test process to the harness through shared memory,
+ * instead of a write(2) and read(2) of the pipe for every line.
+ *
+ * The harness creates the ring (a memfd) and two eventfds, the test
+ * finds them in the TAP_RING environment variable and attaches.  One
+ * producer and one consumer: the test writes, the harness reads.  The
+ * eventfds are only written to when the other side said it's going to
+ * sleep, a busy ring costs no syscalls at all.  The data is mapped
+ * twice in a row, so whatever is readable is one piece of memory and
+ * lines go to the parser straight out of the ring.
+ */
+
+#define TAP_RING_ENV "TAP_RING"
+
+/* Bytes the writer holds back before the reader sees them,
+ * like a FILE's buffer */
+#define TAP_RING_BATCH 4096
+
+/* In the memfd, the data follows it */
+typedef struct {
+    char magic[8];
+    unsigned long size;
+
+    /* Only grow, taken modulo size.  Bytes between tail and head
+     * haven't been read yet.  Apart so they don't share a cache line. */
+    unsigned long head __attribute__((aligned(64)));
+    int reader_sleeping;
+    int finished;       /* the writer is done, see tap_ring_finish() */
+    unsigned long tail __attribute__((aligned(64)));
+    int writer_sleeping;
+} tap_ring_shared;
+
+typedef struct {
+    tap_ring_shared *shared;
+    char *data;     /* size bytes, mapped twice in a row */
+    size_t size;
+
+    int fd;         /* the memfd */
+    int data_fd;    /* eventfd, the writer wakes the reader */
+    int space_fd;   /* eventfd, the reader wakes the writer */
+
+    /* The writer's head, ahead of the shared one until flushed */
+    unsigned long head;
+
+    /* The reader saw more than size bytes to read, see tap_ring_peek() */
+    int broken;
+} tap_ring;
+
+/* Make a ring of at least size bytes, for the reader.  The fds are
+ * inherited by children, who should see tap_ring_env().
+ * Returns errno. */
+extern int tap_ring_create(tap_ring *r, size_t size);
+
+/* The TAP_RING value for attaching to r */
+extern void tap_ring_env(const tap_ring *r, char *buf, size_t len);
+
+/* Attach to the ring of the TAP_RING value spec, for the writer.
+ * Returns errno, EINVAL for a bad spec. */
+extern int tap_ring_attach(tap_ring *r, const char *spec);
+
+/* Unmap and close everything */
+extern void tap_ring_close(tap_ring *r);
+
+/* Empty the ring, only when no one is writing to it */
+extern void tap_ring_reset(tap_ring *r);
+
+/* Write all of buf, waiting for room when the ring is full.  What's
+ * written goes to the reader TAP_RING_BATCH bytes at a time.
+ * Returns errno. */
+extern int tap_ring_write(tap_ring *r, const char *buf, size_t len);
+
+/* Let the reader see everything written */
+extern void tap_ring_flush(tap_ring *r);
+
+/* The writer is done: flush and tell the reader, before closing */
+extern void tap_ring_finish(tap_ring *r);
+
+/* 1 once the writer called tap_ring_finish(), everything it wrote can
+ * be read then.  Also 1 for a broken ring. */
+extern int tap_ring_finished(tap_ring *r);
+
+/* What can be read, *buf points at it in the ring.  Never more than
+ * the size: the shared head is the writer's to scribble over, if it's
+ * further than that the ring is broken and nothing more is read. */
+extern size_t tap_ring_peek(tap_ring *r, const char **buf);
+
+/* Done with len bytes of what tap_ring_peek() returned */
+extern void tap_ring_consume(tap_ring *r, size_t len);
+
+/* The reader is about to wait for data_fd to be readable.
+ * Returns 1 if there's something to read, don't wait then. */
+extern int tap_ring_sleep(tap_ring *r);
+
+/* data_fd was readable, or the wait is over for another reason */
+extern void tap_ring_wake(tap_ring *r);
+
+#endif /* _H_TAP_RING */
+
+/* vim: set ts=4 sw=4 sts=4 expandtab: */
@@ -0,0 +1,217 @@
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "tap_source.h"
+
+static int
+poll_fd(int fd, int timeout)
+{
+    int ret;
+    struct pollfd pfd;
+
+    pfd.fd = fd;
+    pfd.events = POLLIN;
+
+    do {
+        ret = poll(&pfd, 1, timeout);
+    } while (ret == -1 && errno == EINTR);
+
+    return ret;
+}
+
+/* File descriptors */
+
+static ssize_t
+fd_read(tap_source *src, char *buf, size_t len)
+{
+    ssize_t ret;
+
+    do {
+        ret = read(src->fd, buf, len);
+    } while (ret == -1 && errno == EINTR);
+
+    return ret;
+}
+
+static int
+fd_wait(tap_source *src, int timeout)
+{
+    return poll_fd(src->fd, timeout);
+}
+
+static void
+fd_close(tap_source *src)
+{
+    if (src->fd != -1)
+        close(src->fd);
+    src->fd = -1;
+}
+
+static const tap_source_ops fd_ops = { fd_read, fd_wait, fd_close };
+
+void
+tap_source_init_fd(tap_source *src, int fd)
+{
+    memset(src, 0, sizeof(*src));
+    src->ops = &fd_ops;
+    src->fd = fd;
+}
+
+/* stdio */
+
+static ssize_t
+file_read(tap_source *src, char *buf, size_t len)
+{
+    int c;
+    size_t n;
+
+    /* Stop at a newline, fread() would wait for all of len */
+    for (n = 0; n < len; ) {
+        c = getc_unlocked(src->file);
+        if (c == EOF) {
+            if (!ferror(src->file))
+                break;
+
+            /* Nothing more buffered, errno is read(2)'s */
+            clearerr(src->file);
+            if (n > 0)
+                break;
+            return -1;
+        }
+
+        buf[n++] = (char)c;
+        if (c == '\n')
+            break;
+    }
+
+    return (ssize_t)n;
+}
+
+static int
+file_wait(tap_source *src, int timeout)
+{
+    /* Only asked after a read found the stdio buffer empty */
+    return poll_fd(fileno(src->file), timeout);
+}
+
+static void
+file_close(tap_source *src)
+{
+    if (src->file != NULL)
+        fclose(src->file);
+    src->file = NULL;
+}
+
+static const tap_source_ops file_ops = { file_read, file_wait, file_close };
+
+void
+tap_source_init_file(tap_source *src, FILE *file)
+{
+    memset(src, 0, sizeof(*src));
+    src->ops = &file_ops;
+    src->fd = -1;
+    src->file = file;
+}
+
+/* Memory, mmap is memory that's unmapped at close */
+
+static ssize_t
+mem_read(tap_source *src, char *buf, size_t len)
+{
+    if (len > src->data_len - src->pos)
+        len = src->data_len - src->pos;
+
+    memcpy(buf, src->data + src->pos, len);
+    src->pos += len;
+
+    return (ssize_t)len;
+}
+
+static int
+mem_wait(tap_source *src, int timeout)
+{
+    (void)src;
+    (void)timeout;
+
+    /* Never short of input */
+    return 1;
+}
+
+static void
+mmap_close(tap_source *src)
+{
+    if (src->data != NULL && src->data_len > 0)
+        munmap((void *)src->data, src->data_len);
+    src->data = NULL;
+    src->data_len = 0;
+    src->pos = 0;
+}
+
+static const tap_source_ops mem_ops = { mem_read, mem_wait, NULL };
+static const tap_source_ops mmap_ops = { mem_read, mem_wait, mmap_close };
+
+void
+tap_source_init_mem(tap_source *src, const char *data, size_t len)
+{
+    memset(src, 0, sizeof(*src));
+    src->ops = &mem_ops;
+    src->fd = -1;
+    src->data = data;
+    src->data_len = len;
+}
+
+int
+tap_source_init_mmap(tap_source *src, const char *path)
+{
+    int fd;
+    int ret;
+    void *map;
+    struct stat sb;
+
+    fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd == -1)
+        return errno;
+
+    if (fstat(fd, &sb) == -1) {
+        ret = errno;
+        close(fd);
+        return ret;
+    }
+
+    /* mmap() refuses empty files */
+    map = NULL;
+    if (sb.st_size > 0) {
+        map = mmap(NULL, (size_t)sb.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (map == MAP_FAILED) {
+            ret = errno;
+            close(fd);
+            return ret;
+        }
+
+        madvise(map, (size_t)sb.st_size, MADV_SEQUENTIAL);
+    }
+
+    close(fd);
+
+    tap_source_init_mem(src, (const char *)map, (size_t)sb.st_size);
+    src->ops = &mmap_ops;
+
+    return 0;
+}
+
+void
+tap_source_close(tap_source *src)
+{
+    if (src->ops->close != NULL)
+        src->ops->close(src);
+}
+
+/* vim: set ts=4 sw=4 sts=4 expandtab: */
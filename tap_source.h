@@ -0,0 +1,77 @@
+#ifndef _H_TAP_SOURCE
+#define _H_TAP_SOURCE
+
+#include <stddef.h>
+#include <stdio.h>
+#include <sys/types.h>
+
+/* Where tap_parser_next() reads input from when tp->source is set,
+ * instead of read(2)ing tp->fd a byte at a time.
+ *
+ * Any input can be fed to the parser by filling in ops, the built in
+ * sources below cover fds, FILE*s, memory and mmapped files.
+ */
+
+struct _tap_source;
+typedef struct _tap_source tap_source;
+
+typedef struct {
+    /* Read up to len bytes into buf, like read(2):
+     * > 0 - bytes read
+     *   0 - end of input
+     *  -1 - errno set, EAGAIN when nothing is there yet */
+    ssize_t(*read)(tap_source*, char *buf, size_t len);
+
+    /* Wait up to timeout milliseconds for something to read.
+     * 1 - readable, 0 - timed out, -1 - errno set */
+    int(*wait)(tap_source*, int timeout);
+
+    /* Release whatever the source holds, may be NULL */
+    void(*close)(tap_source*);
+} tap_source_ops;
+
+struct _tap_source {
+    const tap_source_ops *ops;
+
+    /* Arbitrary Pointer for external use.
+     * This is here for sources made outside the library,
+     * the built in ones don't reference it. */
+    void *arbitrary;
+
+    /* Built in Source Storage */
+    int fd;
+    FILE *file;
+    const char *data;
+    size_t data_len;
+    size_t pos;
+    tap_source *inner;  /* what a stacked source reads from */
+    void *state;
+};
+
+/* Read from fd, close() closes it */
+extern void tap_source_init_fd(tap_source *src, int fd);
+
+/* Read from file, close() fcloses it */
+extern void tap_source_init_file(tap_source *src, FILE *file);
+
+/* Read len bytes at data, which has to outlive the source */
+extern void tap_source_init_mem(tap_source *src, const char *data, size_t len);
+
+/* mmap the file at path and read that, close() unmaps it.
+ * Returns errno on failure. */
+extern int tap_source_init_mmap(tap_source *src, const char *path);
+
+/* Decompress what inner reads, gzip or zstd picked by the magic bytes
+ * and anything else passed through as is.  Memory use is bounded by
+ * the decompressor's window, output goes straight into the reader's
+ * buffer.  Formats left out of the build (see the Makefile) fail the
+ * first read with EPROTONOSUPPORT.  close() closes inner too.
+ * Returns errno on failure. */
+extern int tap_source_init_decompress(tap_source *src, tap_source *inner);
+
+/* Close the source */
+extern void tap_source_close(tap_source *src);
+
+#endif /* _H_TAP_SOURCE */
+
+/* vim: set ts=4 sw=4 sts=4 expandtab: */
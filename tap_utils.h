@@ -3,10 +3,13 @@
 
 #include <ctype.h>
 #include <errno.h>
+#include <stdlib.h>
 #include <string.h>
+#include <time.h>
 #include <unistd.h>
 
 #include "tap_parser.h"
+#include "tap_constants.h"
 
 static inline char*
 strip(char *p)
@@ -43,6 +46,93 @@ trim(char *str)
     return chomp(strip(str));
 }
 
+/* Remember when the current line was read, if anyone cares */
+static inline void
+stamp_line(tap_parser *tp)
+{
+    struct timespec ts;
+
+    if (!tp->timing)
+        return;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    tp->line_stamp = (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+/* get_line() for tp->source, lines are cut out of what's read ahead */
+static int
+get_source_line(tap_parser *tp)
+{
+    char *nl;
+    size_t n;
+    size_t count;
+    ssize_t ret;
+
+    /* from *tp */
+    char *buffer;
+    size_t buffer_len;
+    tap_source *src;
+
+    buffer = tp->buffer;
+    /* len - 1 to leave room for a null terminator */
+    buffer_len = tp->buffer_len - 1;
+    src = tp->source;
+
+    if (tp->source_buf == NULL) {
+        tp->source_buf = (char *)malloc(SOURCE_READ_LEN);
+        if (tp->source_buf == NULL) {
+            buffer[0] = '\0';
+            return -1;
+        }
+        tp->source_pos = tp->source_len = 0;
+    }
+
+    count = 0;
+    while (count < buffer_len) {
+        if (tp->source_pos == tp->source_len) {
+            ret = src->ops->read(src, tp->source_buf, SOURCE_READ_LEN);
+            if (ret == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+                ret = src->ops->wait(src, tp->blocking_time * 1000);
+                if (ret == 1)
+                    continue;
+
+                /* Blocking too long is 0, like for an fd */
+                buffer[count] = '\0';
+                return (ret == 0) ? 0 : -1;
+            }
+
+            if (ret <= 0) {
+                /* EOF or error */
+                buffer[count] = '\0';
+                return -1;
+            }
+
+            tp->source_pos = 0;
+            tp->source_len = (size_t)ret;
+        }
+
+        n = tp->source_len - tp->source_pos;
+        if (n > buffer_len - count)
+            n = buffer_len - count;
+
+        nl = (char *)memchr(tp->source_buf + tp->source_pos, '\n', n);
+        if (nl != NULL)
+            n = nl - (tp->source_buf + tp->source_pos) + 1;
+
+        memcpy(buffer + count, tp->source_buf + tp->source_pos, n);
+        tp->source_pos += n;
+        count += n;
+
+        if (nl != NULL)
+            break;
+    }
+
+    buffer[count] = '\0';
+    stamp_line(tp);
+
+    return 1;
+}
+
 /* Returns:
  *  0 - pipe closes/end of read, or blocking too long
  * -1 - error
@@ -60,6 +150,9 @@ get_line(tap_parser *tp)
     char *buffer;
     size_t buffer_len;
 
+    if (tp->source != NULL)
+        return get_source_line(tp);
+
     iter = 0;
     count = 0;
     line_done = 0;
@@ -100,6 +193,7 @@ get_line(tap_parser *tp)
         buffer[count++] = cbuf[0];
         if (cbuf[0] == '\n') {
             buffer[count] = '\0';
+            stamp_line(tp);
             return 1;
         }
 
@@ -108,6 +202,7 @@ get_line(tap_parser *tp)
     }
 
     buffer[count] = '\0';
+    stamp_line(tp);
 
     return 1;
 }
@@ -0,0 +1,472 @@
+/* Checks of the library that need more than a script printing TAP,
+ * run by the harness like any other test, see the t/check_*.t scripts.
+ *
+ * usage: check name
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "tap_mux.h"
+#include "tap_parallel.h"
+#include "tap_parser.h"
+#include "tap_producer.h"
+#include "tap_source.h"
+
+static tap_producer out;
+
+/* A parser reading the read end of a pipe holding len bytes of buf */
+static void
+pipe_parser_buf(tap_parser *tp, size_t buffer_len, const char *buf, size_t len)
+{
+    int fds[2];
+
+    if (tap_parser_init(tp, buffer_len) != 0 || pipe(fds) == -1)
+        exit(255);
+    if (write(fds[1], buf, len) != (ssize_t)len)
+        exit(255);
+    close(fds[1]);
+
+    tp->fd = fds[0];
+}
+
+/* A parser reading the read end of a pipe holding text */
+static void
+pipe_parser(tap_parser *tp, size_t buffer_len, const char *text)
+{
+    pipe_parser_buf(tp, buffer_len, text, strlen(text));
+}
+
+/* mux: a stream added from a test callback makes the mux grow its read
+ * buffer while the lines of the old one are still being parsed */
+
+static tap_parser mux_big;
+static int mux_add_ret = -1;
+static char *mux_scribble;
+
+static int
+mux_test_cb(tap_parser *tp, tap_test_result *ttr)
+{
+    if (ttr->test_num == 1) {
+        mux_add_ret = tap_mux_add((tap_mux *)tp->arbitrary, &mux_big);
+
+        /* Whatever the mux let go of gets written over */
+        mux_scribble = (char *)malloc(TAP_MUX_DEFAULT_READ_LEN);
+        if (mux_scribble != NULL)
+            memset(mux_scribble, 'x', TAP_MUX_DEFAULT_READ_LEN);
+    }
+
+    return tap_default_test_callback(tp, ttr);
+}
+
+static void
+check_mux(void)
+{
+    tap_mux mux;
+    tap_parser small;
+
+    if (tap_mux_init(&mux, 0) != 0)
+        exit(255);
+
+    pipe_parser(&small, 256, "1..3\nok 1\nok 2\nok 3\n");
+    tap_parser_set_test_callback(&small, mux_test_cb);
+    small.arbitrary = &mux;
+
+    /* Twice the default read buffer is needed for it */
+    pipe_parser(&mux_big, TAP_MUX_DEFAULT_READ_LEN, "1..1\nok 1\n");
+
+    tap_plan(&out, 5);
+
+    if (tap_mux_add(&mux, &small) != 0)
+        exit(255);
+    while (tap_mux_wait(&mux, 1000) > 0)
+        ;
+
+    tap_is(&out, mux_add_ret, 0, "add from a test callback");
+    tap_is(&out, small.tests_run, 3, "tests after the add");
+    tap_is(&out, small.parse_errors, 0, "no parse errors after the add");
+    tap_is(&out, mux_big.tests_run, 1, "tests of the added stream");
+    tap_ok(&out, mux.buffer_len >= 2 * TAP_MUX_DEFAULT_READ_LEN,
+           "read buffer grown after the wait");
+
+    tap_mux_fini(&mux);
+    tap_parser_fini(&small);
+    tap_parser_fini(&mux_big);
+    free(mux_scribble);
+}
+
+/* mux_frames: frames with no newline in them and longer than the
+ * parser's buffer, read by the mux */
+
+#define FRAMES_HEAD "TAP version 13\n1..2\npragma +binary\n"
+
+static void
+check_mux_frames(void)
+{
+    size_t i;
+    size_t len;
+    tap_mux mux;
+    tap_frame f;
+    tap_parser tp;
+    char desc[1000];
+    char text[2 * TAP_FRAME_MAX];
+
+    memset(desc, 'x', sizeof(desc));
+    len = sizeof(FRAMES_HEAD) - 1;
+    memcpy(text, FRAMES_HEAD, len);
+    for (i = 1; i <= 2; ++i) {
+        memset(&f, 0, sizeof(f));
+        f.status = TTT_OK;
+        f.test_num = i;
+        f.text = desc;
+        f.text_len = sizeof(desc);
+        len += tap_frame_encode(text + len, &f);
+    }
+
+    if (tap_mux_init(&mux, 0) != 0)
+        exit(255);
+    pipe_parser_buf(&tp, 256, text, len);
+
+    tap_plan(&out, 2);
+
+    if (tap_mux_add(&mux, &tp) != 0)
+        exit(255);
+    while (tap_mux_wait(&mux, 1000) > 0)
+        ;
+
+    tap_is(&out, tp.tests_run, 2, "tests of the frames");
+    tap_is(&out, tp.parse_errors, 0, "no parse errors");
+
+    tap_mux_fini(&mux);
+    tap_parser_fini(&tp);
+}
+
+/* parallel_binary: a file switching to frames isn't split */
+static void
+check_parallel_binary(void)
+{
+    int fd;
+    tap_parser tp;
+    char path[] = "/tmp/check_parallel.XXXXXX";
+    static const char text[] = "TAP version 13\n1..3\nok 1\npragma +binary\n"
+                               "ok 2\nok 3\n";
+
+    fd = mkstemp(path);
+    if (fd == -1 || write(fd, text, sizeof(text) - 1) != sizeof(text) - 1)
+        exit(255);
+    close(fd);
+
+    tap_plan(&out, 2);
+
+    if (tap_parser_init(&tp, 0) != 0)
+        exit(255);
+    tap_is(&out, tap_parser_parse_file(&tp, path, 0), EPROTONOSUPPORT,
+           "pragma +binary refused");
+    tap_is(&out, tp.tests_run, 1, "tests up to the pragma");
+    tap_parser_fini(&tp);
+
+    unlink(path);
+}
+
+/* decompress: stdin is gzip members, some of them empty, of a whole
+ * TAP stream.  They're read from memory, then again cut off. */
+
+/* Parse all of data through a decompressing source, returns the read
+ * errno or 0 at the end of input */
+static int
+parse_compressed(tap_parser *tp, const char *data, size_t len)
+{
+    int err;
+    char *nl;
+    char *line;
+    char text[4096];
+    size_t text_len;
+    ssize_t ret;
+    tap_source msrc;
+    tap_source dsrc;
+
+    tap_source_init_mem(&msrc, data, len);
+    if (tap_source_init_decompress(&dsrc, &msrc) != 0)
+        exit(255);
+
+    /* Read here rather than by the parser, which only tells EOF */
+    text_len = 0;
+    while ((ret = dsrc.ops->read(&dsrc, text + text_len,
+                                 sizeof(text) - text_len)) > 0) {
+        text_len += (size_t)ret;
+        if (text_len == sizeof(text))
+            exit(255);
+    }
+    err = (ret == -1) ? errno : 0;
+    tap_source_close(&dsrc);
+
+    for (line = text; (nl = (char *)memchr(line, '\n', text + text_len - line)) != NULL;
+            line = nl + 1) {
+        tap_parser_line(tp, line, nl - line + 1);
+    }
+
+    return err;
+}
+
+static void
+check_decompress(void)
+{
+    char *data;
+    size_t len;
+    size_t room;
+    ssize_t ret;
+    tap_parser tp;
+
+    len = 0;
+    room = 64 * 1024;
+    data = (char *)malloc(room);
+    while (data != NULL && (ret = read(STDIN_FILENO, data + len, room - len)) > 0) {
+        len += (size_t)ret;
+        if (len == room)
+            data = (char *)realloc(data, room *= 2);
+    }
+    if (data == NULL || len < 8)
+        exit(255);
+
+    tap_plan(&out, 4);
+
+    if (tap_parser_init(&tp, 0) != 0)
+        exit(255);
+    tap_is(&out, parse_compressed(&tp, data, len), 0, "empty members read to the end");
+    tap_is(&out, tp.tests_run, tp.plan, "every test of the members");
+    tap_parser_fini(&tp);
+
+    /* Without the size in the last trailer */
+    if (tap_parser_init(&tp, 0) != 0)
+        exit(255);
+    tap_is(&out, parse_compressed(&tp, data, len - 4), EIO, "cut off");
+    tap_ok(&out, tp.plan > 0, "read up to the cut");
+    tap_parser_fini(&tp);
+
+    free(data);
+}
+
+/* stream: a huge plan doesn't make a stream allocate results for it */
+static void
+check_stream(void)
+{
+    tap_parser tp;
+    tap_parser put;
+    long first;
+    long end;
+
+    tap_plan(&out, 7);
+
+    if (tap_parser_init(&tp, 0) != 0 || tap_parser_init(&put, 0) != 0)
+        exit(255);
+    tap_parser_set_stream(&tp, 1, 100);
+    tap_parser_set_stream(&put, 1, 100);
+
+    tap_parser_line(&tp, "1..200000000\n", sizeof("1..200000000\n") - 1);
+    tap_parser_put_plan(&put, 200000000, NULL);
+    tap_ok(&out, tp.tr == NULL || tp.tr->results == NULL, "no results for a parsed plan");
+    tap_ok(&out, put.tr == NULL || put.tr->results == NULL, "no results for a put plan");
+
+    tap_parser_line(&tp, "ok 1\n", sizeof("ok 1\n") - 1);
+    tap_parser_line(&tp, "not ok 2\n", sizeof("not ok 2\n") - 1);
+    tap_ok(&out, tp.tr != NULL && tp.tr->results == NULL, "no results after tests");
+    tap_is(&out, tp.plan, 200000000, "the plan is kept");
+
+    tap_results_range(tp.tr, &first, &end);
+    tap_is(&out, end, 3, "window ends after the last test");
+    tap_is(&out, tap_results_get(tp.tr, 2), TTT_NOT_OK, "test in the window");
+    tap_is(&out, tp.tr->recent_failed, 1, "failures in the window");
+
+    tap_parser_fini(&tp);
+    tap_parser_fini(&put);
+}
+
+/* ring: stdout is closed halfway, the rest only goes to the ring.
+ * Without a ring it's all written to stdout. */
+static void
+check_ring(void)
+{
+    int fd;
+
+    tap_plan(&out, 3);
+    tap_ok(&out, 1, "before closing stdout");
+
+    if (out.ring.data != NULL) {
+        fd = open("/dev/null", O_WRONLY);
+        if (fd == -1 || dup2(fd, STDOUT_FILENO) == -1)
+            exit(255);
+        close(fd);
+
+        /* Long enough for the harness to see stdout end */
+        usleep(200000);
+    }
+
+    tap_ok(&out, 1, "after closing stdout");
+    tap_ok(&out, 1, "last one");
+}
+
+/* broken_ring: the test writes a head further than the ring is long,
+ * the harness should stop reading it and abort the test */
+static void
+check_broken_ring(void)
+{
+    if (out.ring.data == NULL) {
+        tap_skip_all(&out, "no ring");
+        return;
+    }
+
+    tap_plan(&out, 2);
+    tap_ok(&out, 1, "before breaking the ring");
+    tap_ok(&out, 1, "last one");
+
+    tap_ring_flush(&out.ring);
+    out.ring.head = out.ring.shared->tail + 2 * out.ring.size;
+    tap_ring_flush(&out.ring);
+}
+
+/* binary, text: the same results as frames and as text lines, with a
+ * record split across writes, garbage and "pragma -binary" halfway.
+ * The harness should see the same for both, over the pipe or the ring. */
+
+/* Write buf as is and make sure the reader sees it right away */
+static void
+put_raw(const char *buf, size_t len)
+{
+    if (out.ring.data != NULL) {
+        if (tap_ring_write(&out.ring, buf, len) != 0)
+            exit(255);
+        tap_ring_flush(&out.ring);
+        return;
+    }
+
+    if (fwrite(buf, 1, len, out.out) != len || fflush(out.out) == EOF)
+        exit(255);
+}
+
+/* A frame of text, or the line itself */
+static void
+put_line(const char *line)
+{
+    tap_frame f;
+    char frame[TAP_FRAME_MAX];
+
+    if (!out.binary) {
+        put_raw(line, strlen(line));
+        return;
+    }
+
+    memset(&f, 0, sizeof(f));
+    f.status = TAP_FRAME_TEXT;
+    f.text = line;
+    f.text_len = strlen(line) - 1;
+    put_raw(frame, tap_frame_encode(frame, &f));
+}
+
+static void
+check_frames(int binary)
+{
+    size_t len;
+    tap_frame f;
+    char frame[TAP_FRAME_MAX];
+    static const char split[] = "ok 2 - split across writes\n";
+    static const char garbage[] = { '\xff', '\x80', 'x', '\n' };
+
+    if (binary && tap_producer_set_binary(&out) != 0)
+        exit(255);
+
+    tap_plan(&out, 6);
+    tap_ok(&out, 1, "first, with # in it");
+
+    /* The reader has to wait for the rest of it */
+    memset(&f, 0, sizeof(f));
+    f.status = TTT_OK;
+    f.test_num = 2;
+    f.text = "split across writes";
+    f.text_len = strlen(f.text);
+    len = binary ? tap_frame_encode(frame, &f) : sizeof(split) - 1;
+    put_raw(binary ? frame : split, 4);
+    usleep(50000);
+    put_raw((binary ? frame : split) + 4, len - 4);
+    out.test_num++;
+
+    tap_skip(&out, "nothing to do");
+    out.todo = "not yet";
+    tap_ok(&out, 0, "todo");
+    out.todo = NULL;
+
+    /* A byte at a time is skipped over, or an unknown line */
+    put_raw(garbage, sizeof(garbage));
+    tap_comment(&out, "after the garbage");
+
+    if (binary) {
+        put_line("pragma -binary\n");
+        out.binary = 0;
+    }
+
+    tap_ok(&out, 1, "back to text");
+    tap_is(&out, 1, 1, "last");
+}
+
+static void
+check_binary(void)
+{
+    check_frames(1);
+}
+
+static void
+check_text(void)
+{
+    check_frames(0);
+}
+
+static const struct {
+    const char *name;
+    void (*check)(void);
+} checks[] = {
+    { "mux", check_mux },
+    { "mux_frames", check_mux_frames },
+    { "parallel_binary", check_parallel_binary },
+    { "decompress", check_decompress },
+    { "stream", check_stream },
+    { "ring", check_ring },
+    { "broken_ring", check_broken_ring },
+    { "binary", check_binary },
+    { "text", check_text },
+};
+#define checks_len (sizeof(checks)/sizeof(checks[0]))
+
+int
+main(int argc, char **argv)
+{
+    int ret;
+    size_t i;
+
+    if (argc != 2) {
+        fprintf(stderr, "usage: %s name\n", argv[0]);
+        return 255;
+    }
+
+    tap_producer_init_env(&out);
+
+    for (i = 0; i < checks_len; ++i) {
+        if (strcmp(argv[1], checks[i].name) == 0)
+            break;
+    }
+
+    if (i == checks_len) {
+        fprintf(stderr, "%s: no check %s\n", argv[0], argv[1]);
+        return 255;
+    }
+
+    checks[i].check();
+
+    ret = tap_done(&out);
+    tap_producer_fini(&out);
+    return ret;
+}
+
+/* vim: set ts=4 sw=4 sws=4 expandtab: */
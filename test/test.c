@@ -1,9 +1,16 @@
+/* tee(2) and splice(2) */
+#define _GNU_SOURCE
+
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/timerfd.h>
 #include <sys/wait.h>
 
 #include <errno.h>
 #include <fcntl.h>
+#include <getopt.h>
+#include <poll.h>
 #include <signal.h>
 #include <stdarg.h>
 #include <stdio.h>
@@ -12,14 +19,42 @@
 #include <unistd.h>
 
 #include "tap_parser.h"
+#include "tap_ring.h"
 
 #include "test_log.h"
+#include "test_index.h"
 #include "test_utils.h"
 #include "test_results.h"
+#include "test_discovery.h"
+#include "test_store.h"
+#include "test_strbuf.h"
+#include "test_shard.h"
+#include "test_report.h"
+#include "test_console.h"
+#include "test_stderr.h"
 #include "test_callbacks.h"
 
 #define TP_BUFFER_SZ 512
 
+/* Size of the buffer test output is read into */
+#define TEST_IO_SZ (64 * 1024)
+
+/* Size of the --ring tests write their output into */
+#define TEST_RING_SZ (1024 * 1024)
+
+/* Most assertions --slowest shows per test */
+#define SLOWEST_MAX 64
+
+/* Largest --window */
+#define WINDOW_MAX (1024 * 1024)
+
+/* Diagnostics --diags keeps per test run, and per failing assertion */
+#define DIAGS_CAP (64 * 1024)
+#define DIAGS_TEST_CAP (4 * 1024)
+
+/* Adaptive timeouts are never shorter than this, in seconds */
+#define TIMEOUT_MIN 1.0
+
 /* Types */
 
 enum analyze_ret {
@@ -37,11 +72,89 @@ int verbosity = 0;
 int running_list = 0;
 
 static int child_exited = 0;
+static volatile sig_atomic_t child_reaped = 0;
 static int child_status = 0;
+static int child_timed_out = 0;
+static double child_start = 0.0;
 static pid_t current_child = -1;
 
+/* Timeouts in seconds, 0 for none */
+static double default_timeout = 0.0;
+static double timeout_factor = 0.0;
+static int timer_fd = -1;
+
+/* --ring, tests may write their TAP here instead of to stdout */
+static int use_ring = 0;
+static tap_ring ring;
+
+/* The running test was offered the ring, by --ring or its list entry */
+static int test_ring = 0;
+
+/* pidfd of a test with the ring, readable once it's gone */
+static int child_fd = -1;
+
+/* Once stdout is closed, how often to look for the test being gone
+ * while only the ring is left, when there's no pidfd */
+#define RING_REAP_POLL_MS 100
+
+static char io_buffer[TEST_IO_SZ];
+
+/* Where io_buffer[0] is in the log, for the index.  Ring output is
+ * logged between reads, so the bytes of the last read start at
+ * io_read_offset instead of right after the ones before them. */
+static unsigned long long io_offset = 0;
+static size_t io_read_start = 0;
+static unsigned long long io_read_offset = 0;
+
+/* With -e, the read end of the test's stderr and what it said */
+static int err_fd = -1;
+static test_stderr *child_stderr = NULL;
+
+/* Test output for the log goes through here, see read_output() */
+static int tee_pipe[2] = { -1, -1 };
+
 static const char *build = "";
 static const char *source = "";
+static const char *discovery_cache = NULL;
+
+/* Result store, see test_store.h */
+static const char *store_file = NULL;
+static int incremental = 0;
+static int dirty = 0;
+
+/* Stop the list at the first failure or bail out */
+static int fail_fast = 0;
+static int stop_on_bail = 0;
+static volatile sig_atomic_t interrupted = 0;
+
+/* --slowest N, how many of the slowest assertions to show per test */
+static long slowest = 0;
+
+/* --diags, show the comments after failing assertions */
+static int show_diags = 0;
+
+/* --window n, stream with only the last n results kept, -1 when not */
+static long window = -1;
+
+/* --shard i/N, shard_count is 0 when not sharding */
+static int shard_index = 0;
+static int shard_count = 0;
+
+/* Long only options */
+enum {
+    OPT_SHARD = 256,
+    OPT_MERGE,
+    OPT_TIMEOUT,
+    OPT_TIMEOUT_FACTOR,
+    OPT_JUNIT,
+    OPT_JSONL,
+    OPT_LOG_DIRECT,
+    OPT_SLOWEST,
+    OPT_LOOKUP,
+    OPT_DIAGS,
+    OPT_WINDOW,
+    OPT_RING
+};
 
 /* Helpers */
 #if 0
@@ -52,46 +165,120 @@ static int analyze_results(const tap_parser *tp);
 static pid_t exec_test(tap_parser *tp, const char *path);
 static void unset_envars(void);
 static void handle_sigchld(int sig);
+static void handle_interrupt(int sig);
 static inline int init_parser(tap_parser *tp);
-static inline char* find_test(const char *base);
 static int run_list(tap_parser *tp, const char *list);
-static int run_single(tap_parser *tp, const char *test);
-static inline void print_test_results(ttr_node *node, enum tap_test_type ttt);
-static inline void cook_test_results(test_results *tsr, ttr_node *node, tap_parser *tp);
+static int run_single(tap_parser *tp, const char *test, double timeout, int with_ring);
+static int run_merge(int count, char **files);
+static int run_lookup(const char *logname, const char *what);
+static inline void print_test_results(strbuf *out, ttr_node *node, enum tap_test_type ttt,
+                                      long upto);
+static inline void cook_test_results(strbuf *out, test_results *tsr, ttr_node *node, tap_parser *tp);
 
 static void
 usage(FILE *file, const char *name)
 {
     fprintf(file, "usage: %s [options] filename\n", name);
     fprintf(file, "       %s [options] -l filename\n", name);
+    fprintf(file, "       %s [-R file] --merge results...\n", name);
     fprintf(file, " -h            display this message\n");
     fprintf(file, " -v            increase verbose output\n");
     fprintf(file, " -d            debug information, implies -vv\n");
     fprintf(file, " -L file       log the test output to a file\n");
     fprintf(file, " -a            open the log with append\n");
+    fprintf(file, " --log-direct  write the log with O_DIRECT if possible\n");
+    fprintf(file, " --lookup test[:n]  print the output of assertion n (all of\n");
+    fprintf(file, "               test without it) from the -L log, which is\n");
+    fprintf(file, "               indexed in file.idx as it's written\n");
     fprintf(file, " -l            filename is a list of tests to run\n");
     fprintf(file, " -s src_dir    test source directory\n");
     fprintf(file, " -b build_dir  test build directory\n");
-    fprintf(file, " -e            capture test stderr\n");
+    fprintf(file, " -e            capture test stderr, shown for failing tests\n");
+    fprintf(file, " -C file       cache test discovery for -l in file\n");
+    fprintf(file, " -R file       record test results for -l in file\n");
+    fprintf(file, " -i            report unchanged passing tests from -R\n");
+    fprintf(file, " -D            dirty, run every test even with -i\n");
+    fprintf(file, " -F, --fail-fast     stop at the first failing test\n");
+    fprintf(file, " -B, --stop-on-bail  stop when a test bails out\n");
+    fprintf(file, " --shard i/N   only run the i-th of N shards of the list\n");
+    fprintf(file, " --merge       report on results files from -R runs,\n");
+    fprintf(file, "               -R writes the combined results\n");
+    fprintf(file, " --timeout secs        abort tests running longer than secs,\n");
+    fprintf(file, "                       \"name timeout=secs\" in a list overrides it\n");
+    fprintf(file, " --timeout-factor n    time out after n times the 95th percentile\n");
+    fprintf(file, "                       of the durations recorded in -R\n");
+    fprintf(file, " --junit file  write a JUnit XML report of -l to file\n");
+    fprintf(file, " --jsonl file  write a JSON Lines report of -l to file\n");
+    fprintf(file, " --slowest n   show the n slowest assertions of each test in -l\n");
+    fprintf(file, " --diags       show the comments after failing assertions in -l\n");
+    fprintf(file, " --window n    only keep the results of the last n assertions\n");
+    fprintf(file, "               of a test, for tests that never end\n");
+    fprintf(file, " --ring        offer tests a shared memory ring for their TAP\n");
+    fprintf(file, "               (see tap_ring.h), stdout works as well\n");
+    fprintf(file, "               \"name ring\" in a list offers it to one test\n");
     fflush(file);
 }
 
+static double
+parse_seconds(const char *str, const char *name)
+{
+    char *end;
+    double ret;
+
+    errno = 0;
+    ret = strtod(str, &end);
+    if (errno != 0 || end == str || *end != '\0' || ret < 0.0) {
+        fprintf(stderr, "Invalid number: %s\n", str);
+        usage(stderr, name);
+        exit(EXIT_FAILURE);
+    }
+
+    return ret;
+}
+
 int
 main(int argc, char *argv[])
 {
     int ret;
     int opt;
     int list = 0;
-    int append = 0;
+    int merge = 0;
+    int log_flags = 0;
     tap_parser tp;
 
     const char *name;
     const char *logname = NULL;
+    char *end;
     const char *filename = NULL;
+    const char *junit_file = NULL;
+    const char *jsonl_file = NULL;
+    const char *lookup = NULL;
+
+    static const struct option long_opts[] = {
+        { "fail-fast",    no_argument, NULL, 'F' },
+        { "stop-on-bail", no_argument, NULL, 'B' },
+        { "shard",        required_argument, NULL, OPT_SHARD },
+        { "merge",        no_argument, NULL, OPT_MERGE },
+        { "timeout",      required_argument, NULL, OPT_TIMEOUT },
+        { "timeout-factor", required_argument, NULL, OPT_TIMEOUT_FACTOR },
+        { "junit",        required_argument, NULL, OPT_JUNIT },
+        { "jsonl",        required_argument, NULL, OPT_JSONL },
+        { "log-direct",   no_argument, NULL, OPT_LOG_DIRECT },
+        { "slowest",      required_argument, NULL, OPT_SLOWEST },
+        { "lookup",       required_argument, NULL, OPT_LOOKUP },
+        { "diags",        no_argument, NULL, OPT_DIAGS },
+        { "window",       required_argument, NULL, OPT_WINDOW },
+        { "ring",         no_argument, NULL, OPT_RING },
+        { "help",         no_argument, NULL, 'h' },
+        { NULL, 0, NULL, 0 }
+    };
 
     name = argv[0];
 
-    while ((opt = getopt(argc, argv, "vhdaL:ls:b:e")) != EOF) {
+    console_init();
+
+    while ((opt = getopt_long(argc, argv, "vhdaL:ls:b:eC:R:iDFB",
+                              long_opts, NULL)) != EOF) {
         switch (opt) {
         case 'v':
             verbosity++;
@@ -102,11 +289,43 @@ main(int argc, char *argv[])
                 verbosity = 2;
             break;
         case 'a':
-            append = 1;
+            log_flags |= LOG_APPEND;
+            break;
+        case OPT_LOG_DIRECT:
+            log_flags |= LOG_DIRECT;
+            break;
+        case OPT_SLOWEST:
+            errno = 0;
+            slowest = strtol(optarg, &end, 10);
+            if (errno != 0 || end == optarg || *end != '\0'
+                    || slowest < 1 || slowest > SLOWEST_MAX) {
+                fprintf(stderr, "Invalid count: %s\n", optarg);
+                usage(stderr, name);
+                exit(EXIT_FAILURE);
+            }
             break;
         case 'L':
             logname = optarg;
             break;
+        case OPT_LOOKUP:
+            lookup = optarg;
+            break;
+        case OPT_DIAGS:
+            show_diags = 1;
+            break;
+        case OPT_WINDOW:
+            errno = 0;
+            window = strtol(optarg, &end, 10);
+            if (errno != 0 || end == optarg || *end != '\0'
+                    || window < 0 || window > WINDOW_MAX) {
+                fprintf(stderr, "Invalid count: %s\n", optarg);
+                usage(stderr, name);
+                exit(EXIT_FAILURE);
+            }
+            break;
+        case OPT_RING:
+            use_ring = 1;
+            break;
         case 'l':
             list = 1;
             break;
@@ -119,6 +338,46 @@ main(int argc, char *argv[])
         case 'e':
             capture_stderr = 1;
             break;
+        case 'C':
+            discovery_cache = optarg;
+            break;
+        case 'R':
+            store_file = optarg;
+            break;
+        case 'i':
+            incremental = 1;
+            break;
+        case 'D':
+            dirty = 1;
+            break;
+        case 'F':
+            fail_fast = 1;
+            break;
+        case 'B':
+            stop_on_bail = 1;
+            break;
+        case OPT_SHARD:
+            if (shard_parse(optarg, &shard_index, &shard_count) != 0) {
+                fprintf(stderr, "Invalid shard: %s\n", optarg);
+                usage(stderr, name);
+                exit(EXIT_FAILURE);
+            }
+            break;
+        case OPT_MERGE:
+            merge = 1;
+            break;
+        case OPT_TIMEOUT:
+            default_timeout = parse_seconds(optarg, name);
+            break;
+        case OPT_TIMEOUT_FACTOR:
+            timeout_factor = parse_seconds(optarg, name);
+            break;
+        case OPT_JUNIT:
+            junit_file = optarg;
+            break;
+        case OPT_JSONL:
+            jsonl_file = optarg;
+            break;
         case 'h':
             usage(stdout, name);
             exit(EXIT_SUCCESS);
@@ -132,6 +391,24 @@ main(int argc, char *argv[])
     argv += optind;
     argc -= optind;
 
+    if (merge) {
+        if (argc < 1) {
+            fprintf(stderr, "Missing results files!\n");
+            usage(stderr, name);
+            exit(EXIT_FAILURE);
+        }
+        return run_merge(argc, argv);
+    }
+
+    if (lookup != NULL) {
+        if (logname == NULL) {
+            fprintf(stderr, "--lookup requires a log (-L)\n");
+            usage(stderr, name);
+            exit(EXIT_FAILURE);
+        }
+        return run_lookup(logname, lookup);
+    }
+
     if (argc != 1) {
         fprintf(stderr, "Missing filename!\n");
         usage(stderr, name);
@@ -141,8 +418,11 @@ main(int argc, char *argv[])
     filename = argv[0];
 
     if (logname != NULL) {
-        if (log_open(logname, append))
+        if (log_open(logname, log_flags))
             die(errno, "Failed to open %s", logname);
+
+        if (strcmp(logname, "stdout") != 0 && strcmp(logname, "stderr") != 0)
+            index_open(logname, log_offset(), log_flags & LOG_APPEND);
     }
 
     /* The parser has to be initialized before a
@@ -154,6 +434,10 @@ main(int argc, char *argv[])
     /* Handle SIGCHLD */
     signal(SIGCHLD, &handle_sigchld);
 
+    /* Take the running test down with us */
+    signal(SIGINT, &handle_interrupt);
+    signal(SIGTERM, &handle_interrupt);
+
     /* Cleanup the environment at exit */
     atexit(unset_envars);
 
@@ -179,12 +463,34 @@ main(int argc, char *argv[])
             die(errno, "setenv(TAP_BUILD)");
     }
 
+    if ((incremental || timeout_factor > 0.0) && store_file == NULL) {
+        fprintf(stderr, "-i and --timeout-factor require a result store (-R)\n");
+        usage(stderr, name);
+        exit(EXIT_FAILURE);
+    }
+
+    if ((junit_file != NULL || jsonl_file != NULL || slowest || show_diags) && !list) {
+        fprintf(stderr, "--junit, --jsonl, --slowest and --diags require a list (-l)\n");
+        usage(stderr, name);
+        exit(EXIT_FAILURE);
+    }
+
+    /* Opened up front so a bad path fails before any test runs */
+    if (junit_file != NULL)
+        report_add(report_junit_new(junit_file));
+    if (jsonl_file != NULL)
+        report_add(report_jsonl_new(jsonl_file));
+
     if (list)
         ret = run_list(&tp, filename);
-    else
-        ret = run_single(&tp, filename);
+    else {
+        index_test_begin(filename, log_offset());
+        ret = run_single(&tp, filename, default_timeout, use_ring);
+        index_test_end(log_offset());
+    }
 
     tap_parser_fini(&tp);
+    index_close();
 
     return ret;
 #if 0
@@ -525,14 +831,33 @@ dump_results_array(const tap_results *tr)
 static pid_t
 exec_test(tap_parser *tp, const char *path)
 {
+    int ret;
     pid_t child;
     int pipes[2];
+    int err_pipes[2];
+    char spec[64];
+
+    if (test_ring) {
+        if (ring.data == NULL) {
+            ret = tap_ring_create(&ring, TEST_RING_SZ);
+            if (ret != 0)
+                die(ret, "tap_ring_create()");
+        }
+
+        /* The last test may have been stopped halfway */
+        tap_ring_reset(&ring);
+        tap_ring_env(&ring, spec, sizeof(spec));
+    }
 
 #define READ_PIPE  0
 #define WRITE_PIPE 1
     if (pipe(pipes) == -1)
         die(errno, "pipe()");
 
+    /* stderr gets a pipe of its own, it's no business of the parser */
+    if (capture_stderr && pipe(err_pipes) == -1)
+        die(errno, "pipe()");
+
     child = fork();
     if (child == (pid_t)-1)
         die(errno, "fork()");
@@ -540,9 +865,15 @@ exec_test(tap_parser *tp, const char *path)
     if (child == 0) {
         /* child proc */
 
+        /* Own process group so anything the test spawns
+         * can be killed along with it */
+        setpgid(0, 0);
+
         if (capture_stderr) {
-            if (dup2(pipes[WRITE_PIPE], STDERR_FILENO) == -1)
+            if (dup2(err_pipes[WRITE_PIPE], STDERR_FILENO) == -1)
                 exit(EXIT_FAILURE);
+            close(err_pipes[READ_PIPE]);
+            close(err_pipes[WRITE_PIPE]);
         }
         else {
             int fd = open("/dev/null", O_WRONLY);
@@ -562,12 +893,28 @@ exec_test(tap_parser *tp, const char *path)
         /* log gets cloned for the child, close it */
         log_close();
 
+        if (test_ring && setenv(TAP_RING_ENV, spec, 1) == -1)
+            exit(EXIT_FAILURE);
+
         if (execl(path, path, (char *)NULL) == -1)
             exit(EXIT_FAILURE);
     }
     else {
         /* parent, close write end */
         close(pipes[WRITE_PIPE]);
+
+        if (capture_stderr) {
+            close(err_pipes[WRITE_PIPE]);
+            err_fd = err_pipes[READ_PIPE];
+            fcntl(err_fd, F_SETFL, fcntl(err_fd, F_GETFL) | O_NONBLOCK);
+        }
+
+        /* Also set it here, whoever runs first wins the race */
+        setpgid(child, child);
+
+        /* Fails if it's already gone and reaped, child_reaped says so */
+        if (test_ring)
+            child_fd = (int)syscall(SYS_pidfd_open, child, 0);
     }
 
     tp->fd = pipes[READ_PIPE];
@@ -586,10 +933,69 @@ handle_sigchld(int sig)
     (void)sig;
 
     child = waitpid(current_child, &child_status, WNOHANG);
+    if (child > 0)
+        child_reaped = 1;
     if (child > 0 && WIFEXITED(child_status))
         child_exited = 1;
 }
 
+static void
+handle_interrupt(int sig)
+{
+    interrupted = 1;
+
+    /* Closes the pipe so the parser sees EOF */
+    if (current_child > 0)
+        kill(-current_child, SIGKILL);
+
+    /* A second signal isn't caught */
+    signal(sig, SIG_DFL);
+}
+
+/* Wait for the current child, the SIGCHLD handler may have already */
+static void
+reap_child(void)
+{
+    int status;
+    pid_t ret;
+
+    if (current_child <= 0)
+        return;
+
+    do {
+        ret = waitpid(current_child, &status, 0);
+    } while (ret == -1 && errno == EINTR);
+
+    if (ret == current_child)
+        child_status = status;
+}
+
+/* Terminate the current child and everything in its process group.
+ * SIGTERM first, SIGKILL if it's still around after a grace period. */
+static void
+stop_child(void)
+{
+    int i;
+
+    if (current_child <= 0)
+        return;
+
+    kill(-current_child, SIGTERM);
+    for (i = 0; i < 100 && !child_reaped; ++i) {
+        if (waitpid(current_child, &child_status, WNOHANG) == current_child)
+            child_reaped = 1;
+        else
+            usleep(1000);
+    }
+
+    /* Gone on its own, its status is kept and its pid may be reused */
+    if (child_reaped)
+        return;
+
+    kill(-current_child, SIGKILL);
+    reap_child();
+}
+
 /* registered atexit to cleanup the environment */
 static void
 unset_envars(void)
@@ -620,91 +1026,40 @@ init_parser(tap_parser *tp)
     tap_parser_set_version_callback(tp, version_cb);
     tap_parser_set_unknown_callback(tp, unknown_cb);
     tap_parser_set_invalid_callback(tp, invalid_cb);
-    tap_parser_set_preparse_callback(tp, preparse_cb);
 
     return 0;
 }
 
-static inline char*
-find_test(const char *base)
+/* Options following a test name in a list, 0 on success:
+ *  timeout=secs - time limit for the test, 0 for none
+ *  ring         - offer the test the ring, like --ring */
+static int
+parse_list_options(char *opts, double *timeout, int *ring)
 {
-    char *ret;
-
-    const char **dptr;
-    const char *dirs[4];
-
-    size_t pos;
-    size_t len;
-    size_t dir_len;
-    size_t base_len;
-
-    struct stat sb;
-
-    dirs[0] = ".";
-    dirs[1] = build;
-    dirs[2] = source;
-    dirs[3] = NULL;
-
-    ret = NULL;
-    dir_len = 0;
-    base_len = strlen(base);
-
-    for (dptr = &dirs[0]; *dptr != NULL; ++dptr) {
-        if (*dptr == '\0')
+    char *opt;
+    char *end;
+    char *save;
+
+    for (opt = strtok_r(opts, " \t", &save); opt != NULL;
+            opt = strtok_r(NULL, " \t", &save)) {
+        if (strncmp(opt, "timeout=", sizeof("timeout=") - 1) == 0) {
+            opt += sizeof("timeout=") - 1;
+            errno = 0;
+            *timeout = strtod(opt, &end);
+            if (errno != 0 || end == opt || *end != '\0' || *timeout < 0.0)
+                return -1;
             continue;
-
-        len = strlen(*dptr);
-
-        if (ret != NULL) {
-            if (dir_len < len) {
-                char *n;
-                n = (char *)realloc(ret, len + base_len + 4);
-                if (n == NULL) {
-                    free(ret);
-                    die(errno, "realloc()");
-                }
-
-                ret = n;
-            }
-
-            dir_len = len;
-        }
-        else {
-            ret = (char *)malloc(len + base_len + 4);
-            if (ret == NULL)
-                die(errno, "malloc()");
         }
 
-        dir_len = len;
-
-        strncpy(ret, *dptr, dir_len);
-        ret[dir_len] = '/';
-        pos = dir_len + 1;
-
-        strncpy(&ret[pos], base, base_len);
-        pos += base_len;
-        ret[pos + 1] = 't';
-        ret[pos + 2] = '\0';
-
-        /* First try -t */
-        ret[pos] = '-';
-        if (stat(ret, &sb) != -1) {
-            if (!S_ISREG(sb.st_mode))
-                die(0, "%s is not a regular file!\n", ret);
-            return ret;
+        if (strcmp(opt, "ring") == 0) {
+            *ring = 1;
+            continue;
         }
 
-        /* Next is .t */
-        ret[pos] = '.';
-        if (stat(ret, &sb) != -1) {
-            if (!S_ISREG(sb.st_mode))
-                die(0, "%s is not a regular file!\n");
-            return ret;
-        }
+        return -1;
     }
 
-    free(ret);
-    return NULL;
+    return 0;
 }
 
 static inline void
@@ -716,14 +1071,20 @@ make_test_list(test_results *tsr, const char *list)
     size_t length;
 
     char *test;
+    char *opts;
     char buffer[TP_BUFFER_SZ];
 
-    ttr_node *node;
+    size_t idx;
+    int ring;
+    double timeout;
+    test_discovery dc;
 
     file = fopen(list, "r");
     if (file == NULL)
         die(errno, "Cannot open list %s", list);
 
+    discovery_init(&dc, discovery_cache, list, build, source);
+
     line = 0;
     while (fgets(buffer, TP_BUFFER_SZ-1, file)) {
         ++line;
@@ -740,64 +1101,334 @@ make_test_list(test_results *tsr, const char *list)
 
         buffer[length] = '\0';
 
-        test = find_test(buffer);
+        /* Anything after the name are options for the test */
+        timeout = -1.0;
+        ring = 0;
+        opts = strpbrk(buffer, " \t");
+        if (opts != NULL) {
+            *opts++ = '\0';
+            if (parse_list_options(opts, &timeout, &ring) != 0) {
+                die(0, "%s: %lu: invalid test options: %s\n",
+                    list, (unsigned long)line, opts);
+            }
+        }
+
+        test = discovery_find(&dc, buffer);
         if (test == NULL)
             die(0, "Failed to find test: %s\n", buffer);
 
         /* Set up the new node */
-        node = ttr_node_new();
-        node->path = test;
-        node->file = strdup(buffer);
-        if (node->file == NULL)
-            die(errno, "strdup(test_name)");
-
-        test_results_push(tsr, node);
+        idx = test_results_add(tsr, buffer, test);
+        tsr->nodes[idx].timeout = timeout;
+        tsr->nodes[idx].ring = ring;
+        free(test);
     }
 
+    discovery_fini(&dc);
     fclose(file);
 }
 
+static inline void
+print_test_name(const ttr_node *node, size_t longest)
+{
+    size_t length;
+
+    console_printf("%s ...", node->file);
+    length = longest - strlen(node->file);
+    while (length--)
+        console_putc('.');
+}
+
+/* Report a test from a previous run instead of running it.
+ * Returns 1 if the test was reported. */
+static int
+report_cached(test_results *tsr, test_store *st, ttr_node *node,
+              const store_identity *id, size_t longest)
+{
+    store_record *rec;
+
+    if (!incremental || dirty)
+        return 0;
+
+    rec = store_lookup(st, node->path);
+    if (rec == NULL || !store_passed(rec) || !store_unchanged(rec, id))
+        return 0;
+
+    node->cached = 1;
+    node->status = rec->status;
+    node->duration = rec->duration;
+
+    tsr->total_tests_run += rec->tests_run;
+    tsr->total_failed += rec->failed;
+    tsr->total_skipped += rec->skipped;
+    tsr->total_todo += rec->todo;
+    tsr->total_parse_errors += rec->parse_errors;
+
+    print_test_name(node, longest);
+    console_printf("%s (cached)\n", rec->summary);
+
+    if (report_enabled()) {
+        report_test rt;
+
+        rt.node = node;
+        rt.verdict = rec->summary;
+        rt.plan = rec->plan;
+        rt.tests_run = rec->tests_run;
+        rt.failed = rec->failed;
+        rt.skipped = rec->skipped;
+        rt.todo = rec->todo;
+
+        report_begin_test(node);
+        report_end_test(&rt);
+    }
+
+    return 1;
+}
+
+static void
+report_result(const ttr_node *node, const tap_parser *tp, const strbuf *verdict)
+{
+    report_test rt;
+
+    rt.node = node;
+    rt.verdict = verdict->str;
+    rt.plan = tp->plan;
+    rt.tests_run = tp->tests_run;
+    rt.failed = tp->failed;
+    rt.skipped = tp->skipped;
+    rt.todo = tp->todo;
+
+    report_end_test(&rt);
+}
+
+/* verdict is without the trailing newline */
+static void
+record_result(test_store *st, ttr_node *node, const store_identity *id,
+              const tap_parser *tp, const strbuf *verdict)
+{
+    store_record rec;
+
+    if (!id->valid)
+        return;
+
+    memset(&rec, 0, sizeof(rec));
+    rec.name = (char *)node->file; /* copied by store_update */
+    rec.status = node->status;
+    rec.aborted = node->aborted;
+    rec.plan = tp->plan;
+    rec.tests_run = tp->tests_run;
+    rec.failed = tp->failed;
+    rec.skipped = tp->skipped;
+    rec.todo = tp->todo;
+    rec.parse_errors = tp->parse_errors;
+    rec.duration = node->duration;
+    rec.summary = verdict->str;
+
+    store_update(st, node->path, id, &rec);
+}
+
+/* The list, then the history, then the command line decide */
+static double
+test_timeout(const ttr_node *node, const test_store *st)
+{
+    double p95;
+    store_record *rec;
+
+    if (node->timeout >= 0.0)
+        return node->timeout;
+
+    if (timeout_factor > 0.0 && st != NULL) {
+        rec = store_lookup(st, node->path);
+        if (rec != NULL && rec->history_len > 0) {
+            p95 = store_p95(rec) * timeout_factor;
+            return (p95 < TIMEOUT_MIN) ? TIMEOUT_MIN : p95;
+        }
+    }
+
+    return default_timeout;
+}
+
+/* Anything but ok or skipped */
+static inline int
+test_failed(const ttr_node *node, const tap_parser *tp)
+{
+    if (node->status != 0 || node->aborted)
+        return 1;
+
+    return tp->tests_run < tp->plan;
+}
+
+/* The --slowest assertions of a test, by the time since the one before */
+static void
+print_slowest(strbuf *out, const tap_results *tr)
+{
+    long i, j, n;
+    long top[SLOWEST_MAX];
+
+    n = 0;
+
+    /* Insertion into a short sorted list, slowest first */
+    for (i = 1; i < (long)tr->results_len; ++i) {
+        if (tr->results[i] == TTT_INVALID)
+            continue;
+
+        if (n == slowest && tr->timings[i] <= tr->timings[top[n - 1]])
+            continue;
+
+        j = (n < slowest) ? n++ : n - 1;
+        while (j > 0 && tr->timings[top[j - 1]] < tr->timings[i]) {
+            top[j] = top[j - 1];
+            --j;
+        }
+        top[j] = i;
+    }
+
+    if (n == 0)
+        return;
+
+    strbuf_printf(out, "  slowest:");
+    for (i = 0; i < n; ++i) {
+        strbuf_printf(out, "%s %ld (%.3fs)", (i == 0) ? "" : ",",
+                      top[i], tr->timings[top[i]]);
+    }
+    strbuf_putc(out, '\n');
+}
+
+/* The --diags of the failing assertions of a test */
+static void
+print_diags(strbuf *out, const tap_results *tr)
+{
+    long i;
+    long first;
+    long end;
+    char *p;
+    char *nl;
+    const tap_diag *diag;
+    static char text[DIAGS_TEST_CAP + 1];
+
+    tap_results_range(tr, &first, &end);
+    for (i = first; i < end; ++i) {
+        diag = tap_diags_find(tr->diags, i);
+        if (diag == NULL)
+            continue;
+
+        /* Lines are newline terminated */
+        tap_diags_copy(tr->diags, diag, text, sizeof(text));
+        strbuf_printf(out, "  %ld:\n", i);
+        for (p = text; (nl = strchr(p, '\n')) != NULL; p = nl + 1) {
+            strbuf_append(out, "    ", 4);
+            strbuf_append(out, p, nl - p + 1);
+        }
+
+        if (diag->truncated)
+            strbuf_printf(out, "    ...\n");
+    }
+
+    if (tr->diags->evicted > 0)
+        strbuf_printf(out, "  (diagnostics of %ld more dropped)\n", tr->diags->evicted);
+}
+
+/* Called when the list stops early */
+static void
+print_partial_summary(const test_results *tsr, const char *why,
+                      size_t not_run, size_t total)
+{
+    console_printf("\nStopped (%s): %lu of %lu tests not run\n", why,
+                   (unsigned long)not_run, (unsigned long)total);
+    console_printf("Ran %lu tests: %ld assertions, %ld failed, %ld aborted, "
+                   "%ld skipped, %ld todo\n",
+                   (unsigned long)(total - not_run), tsr->total_tests_run,
+                   tsr->total_failed, tsr->total_aborted, tsr->total_skipped,
+                   tsr->total_todo);
+    console_flush();
+}
+
 static int
 run_list(tap_parser *tp, const char *list)
 {
+    int ret;
+    size_t ran;
+    size_t total;
     size_t length;
     size_t longest;
+    double start;
+    const char *stopped;
 
     ttr_node *node;
     test_results tsr;
+    test_store st;
+    store_identity id;
+    strbuf verdict;
+    strbuf err;
 
     /* Initialize the test results */
     test_results_init(&tsr);
+    strbuf_init(&verdict);
+    strbuf_init(&err);
 
     /* Grap the test list */
     make_test_list(&tsr, list);
 
+    if (store_file != NULL)
+        store_open(&st, store_file);
+
+    if (shard_count > 0)
+        shard_select(&tsr, (store_file != NULL) ? &st : NULL,
+                     shard_index, shard_count);
+
     running_list = 1;
 
     /* Find the longest test name */
+    total = tsr.len;
     longest = 0;
-    node = tsr.root;
-    while (node != NULL) {
-        length = strlen(node->file);
+    for (ran = 0; ran < total; ++ran) {
+        length = strlen(tsr.nodes[ran].file);
         if (length > longest)
             longest = length;
-        node = node->next;
     }
 
     /* Run the tests */
-    node = tsr.root;
-    while (node != NULL) {
-        printf("%s ...", node->file);
-        length = longest - strlen(node->file);
-        while (length--)
-            putchar('.');
+    ret = 0;
+    stopped = NULL;
+    for (ran = 0; ran < total; ) {
+        if (interrupted) {
+            stopped = "interrupted";
+            ret = AR_ABORTED;
+            break;
+        }
+
+        node = &tsr.nodes[ran++];
+
+        /* Identify the test before it runs so a change made
+         * while it's running isn't recorded as tested */
+        if (store_file != NULL) {
+            store_identify(node->path, &id);
+            if (report_cached(&tsr, &st, node, &id, longest))
+                continue;
+        }
+
         /* We print two lines if verbose
-         * This is to constrain the test output */
+         * This is to constrain the test output.
+         * On a terminal the progress line stands in for the name. */
+        if (verbosity || !console_live())
+            print_test_name(node, longest);
         if (verbosity)
-            putchar('\n');
+            console_putc('\n');
+
+        report_begin_test(node);
+        console_test_begin(node->file, ran - 1, total);
 
         /* Run the test */
-        node->status = run_single(tp, node->path);
+        start = monotonic_now();
+        index_test_begin(node->file, log_offset());
+        node->status = run_single(tp, node->path,
+                                  test_timeout(node, (store_file != NULL) ? &st : NULL),
+                                  use_ring || node->ring);
+        index_test_end(log_offset());
+        node->duration = monotonic_now() - start;
+        node->timed_out = child_timed_out;
+        node->err = child_stderr;
+        child_stderr = NULL;
 
         /* Detatch and store off the test results */
         node->tr = tap_parser_steal_results(tp);
@@ -805,46 +1436,679 @@ run_list(tap_parser *tp, const char *list)
 
         /* If verbose we print two lines to
          * constrain test output */
-        if (verbosity) {
-            printf("%s ...", node->file);
-            length = longest - strlen(node->file);
-            while (length--)
-                putchar('.');
+        if (verbosity || console_live())
+            print_test_name(node, longest);
+
+        strbuf_reset(&verdict);
+        cook_test_results(&verdict, &tsr, node, tp);
+        console_write(verdict.str, verdict.len);
+
+        /* stderr is only of interest when something went wrong */
+        if (node->err != NULL) {
+            if (test_failed(node, tp)) {
+                strbuf_reset(&err);
+                strbuf_printf(&err, "  stderr:\n");
+                stderr_dump(node->err, &err, "    ");
+                console_write(err.str, err.len);
+            }
+            else {
+                stderr_free(node->err);
+                node->err = NULL;
+            }
         }
 
-        cook_test_results(&tsr, node, tp);
-        fflush(stdout);
+        if (show_diags && node->tr != NULL && node->tr->diags != NULL) {
+            strbuf_reset(&err);
+            print_diags(&err, node->tr);
+            console_write(err.str, err.len);
+        }
 
-        node = node->next;
+        if (slowest && node->tr != NULL && node->tr->timings != NULL) {
+            strbuf_reset(&err);
+            print_slowest(&err, node->tr);
+            console_write(err.str, err.len);
+        }
+
+        console_test_end();
+
+        /* Drop the trailing newline for the store and reporters */
+        if (verdict.len && verdict.str[verdict.len - 1] == '\n')
+            verdict.str[--verdict.len] = '\0';
+
+        report_result(node, tp, &verdict);
+
+        if (store_file != NULL)
+            record_result(&st, node, &id, tp, &verdict);
+
+        if (stop_on_bail && tp->bailed) {
+            stopped = "bailed out";
+            ret = AR_ABORTED;
+            break;
+        }
+
+        if (fail_fast && test_failed(node, tp)) {
+            stopped = "fail fast";
+            ret = AR_FAILED;
+            break;
+        }
     }
 
+    if (stopped != NULL)
+        print_partial_summary(&tsr, stopped, total - ran, total);
+
+    report_finish(&tsr);
+
+    if (store_file != NULL)
+        store_close(&st);
+
     /* Cleanup test results */
+    strbuf_fini(&verdict);
+    strbuf_fini(&err);
     test_results_fini(&tsr);
 
+    return ret;
+}
+
+struct merge_list {
+    size_t len;
+    const store_record **records;
+};
+
+static void
+collect_record(const char *path, store_record *rec, void *arg)
+{
+    struct merge_list *ml = (struct merge_list *)arg;
+
+    (void)path;
+    ml->records[ml->len++] = rec;
+}
+
+static int
+cmp_record(const void *a, const void *b)
+{
+    const store_record *x = *(const store_record * const *)a;
+    const store_record *y = *(const store_record * const *)b;
+
+    return strcmp(x->name, y->name);
+}
+
+/* Combine the results files of several (sharded) runs into one report */
+static int
+run_merge(int count, char **files)
+{
+    int i;
+    int ret;
+    size_t j;
+    size_t length;
+    size_t longest;
+    long failed, aborted, tests_run, skipped, todo;
+    test_store in;
+    test_store merged;
+    struct merge_list ml;
+    const store_record *rec;
+
+    /* In memory until everything is merged */
+    store_open(&merged, NULL);
+
+    for (i = 0; i < count; ++i) {
+        if (access(files[i], R_OK) != 0)
+            die(errno, "Cannot read results %s", files[i]);
+
+        store_open(&in, files[i]);
+        store_merge(&merged, &in);
+        store_close(&in);
+    }
+
+    ml.len = 0;
+    ml.records = (const store_record **)calloc(merged.records.count + 1,
+                                               sizeof(store_record *));
+    if (ml.records == NULL)
+        die(errno, "calloc(records)");
+
+    store_each(&merged, collect_record, &ml);
+    qsort(ml.records, ml.len, sizeof(store_record *), cmp_record);
+
+    longest = 0;
+    for (j = 0; j < ml.len; ++j) {
+        length = strlen(ml.records[j]->name);
+        if (length > longest)
+            longest = length;
+    }
+
+    ret = AR_SUCCESS;
+    failed = aborted = tests_run = skipped = todo = 0;
+    for (j = 0; j < ml.len; ++j) {
+        rec = ml.records[j];
+
+        console_printf("%s ...", rec->name);
+        length = longest - strlen(rec->name);
+        while (length--)
+            console_putc('.');
+        console_printf("%s\n", rec->summary);
+
+        tests_run += rec->tests_run;
+        failed += rec->failed;
+        skipped += rec->skipped;
+        todo += rec->todo;
+        aborted += rec->aborted;
+
+        if (rec->aborted)
+            ret = AR_ABORTED;
+        else if (!store_passed(rec) && ret == AR_SUCCESS)
+            ret = AR_FAILED;
+    }
+
+    console_printf("\nMerged %lu tests from %d results files: %ld assertions, "
+                   "%ld failed, %ld aborted, %ld skipped, %ld todo\n",
+                   (unsigned long)ml.len, count, tests_run, failed, aborted,
+                   skipped, todo);
+    console_flush();
+
+    free(ml.records);
+
+    /* Now that it's complete, write the combined results out */
+    merged.file = store_file;
+    store_close(&merged);
+
+    return ret;
+}
+
+/* Print the output of what ("test" or "test:n") from the log */
+static int
+run_lookup(const char *logname, const char *what)
+{
+    int fd;
+    int ret;
+    long num;
+    char *end;
+    char *test;
+    char *colon;
+    ssize_t n;
+    char buf[64 * 1024];
+    unsigned long long offset;
+    unsigned long long len;
+
+    test = strdup(what);
+    if (test == NULL)
+        die(errno, "strdup()");
+
+    /* Test names can have colons, only a number after the last counts */
+    num = 0;
+    colon = strrchr(test, ':');
+    if (colon != NULL && colon[1] != '\0') {
+        errno = 0;
+        num = strtol(colon + 1, &end, 10);
+        if (errno == 0 && *end == '\0' && num >= 0)
+            *colon = '\0';
+        else
+            num = 0;
+    }
+
+    ret = index_lookup(logname, test, num, &offset, &len);
+    if (ret != 0) {
+        if (ret == ENOENT)
+            fprintf(stderr, "%s isn't in the index of %s\n", what, logname);
+        else
+            fprintf(stderr, "Failed to read the index of %s: %s\n",
+                    logname, strerror(ret));
+        free(test);
+        return EXIT_FAILURE;
+    }
+    free(test);
+
+    fd = open(logname, O_RDONLY | O_CLOEXEC);
+    if (fd == -1)
+        die(errno, "Failed to open %s", logname);
+
+    while (len > 0) {
+        n = pread(fd, buf, (len < sizeof(buf)) ? (size_t)len : sizeof(buf),
+                  (off_t)offset);
+        if (n == -1 && errno == EINTR)
+            continue;
+        if (n == -1)
+            die(errno, "Failed to read %s", logname);
+        if (n == 0)
+            die(0, "%s is shorter than its index\n", logname);
+
+        fwrite(buf, 1, (size_t)n, stdout);
+        offset += (unsigned long long)n;
+        len -= (unsigned long long)n;
+    }
+
+    close(fd);
+    return (fflush(stdout) == EOF) ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+/* Where the byte at p of io_buffer is in the log.  Only the start of
+ * the partial line kept from before the last read can come before it. */
+static unsigned long long
+io_log_offset(const char *p)
+{
+    if (p < io_buffer + io_read_start)
+        return io_offset + (p - io_buffer);
+    return io_read_offset + (p - (io_buffer + io_read_start));
+}
+
+/* Hand every complete line (or binary frame) in io_buffer to the
+ * parser, the partial one at the end is kept.  Returns 1 when parsing
+ * should stop. */
+static int
+feed_lines(tap_parser *tp, size_t *len)
+{
+    char *start;
+    char *end;
+    size_t n;
+    size_t rest;
+    size_t chunk;
+
+    start = io_buffer;
+    end = io_buffer + *len;
+
+    while ((n = tap_parser_record_len(tp, start, end - start)) != 0) {
+        index_line(io_log_offset(start));
+        if (tap_parser_line(tp, start, n) != 0)
+            return 1;
+        start += n;
+
+        /* No point in waiting for the rest of a failing test */
+        if (fail_fast && tp->failed)
+            return 1;
+    }
+
+    rest = end - start;
+    if (rest == TEST_IO_SZ) {
+        /* A line longer than the whole buffer, hand over the
+         * pieces the parser would split it into anyway */
+        chunk = tp->buffer_len - 1;
+        chunk = rest - rest % chunk;
+        index_line(io_log_offset(start));
+        if (tap_parser_line(tp, start, chunk) != 0)
+            return 1;
+        start += chunk;
+        rest -= chunk;
+    }
+
+    io_offset = io_log_offset(start);
+    memmove(io_buffer, start, rest);
+    *len = rest;
     return 0;
 }
 
+/* feed_lines() for the ring, lines are parsed where they are in shared
+ * memory.  At the end of the output the last line may not have a
+ * newline.  Returns 1 when parsing should stop. */
+static int
+feed_ring(tap_parser *tp, int end_of_output)
+{
+    int ret;
+    size_t n;
+    size_t len;
+    size_t rest;
+    const char *buf;
+    const char *start;
+    const char *end;
+    unsigned long long base;
+
+    len = tap_ring_peek(&ring, &buf);
+    if (len == 0) {
+        /* The test wrote over the ring, nothing in it can be trusted */
+        if (ring.broken && !tp->bailed) {
+            char reason[] = "Broken ring";
+            bailout_cb(tp, reason);
+            return 1;
+        }
+        return 0;
+    }
+
+    start = buf;
+    end = buf + len;
+    base = log_offset();
+
+    ret = 0;
+    while ((n = tap_parser_record_len(tp, start, end - start)) != 0) {
+        index_line(base + (start - buf));
+        ret = tap_parser_line(tp, start, n);
+        start += n;
+
+        /* No point in waiting for the rest of a failing test */
+        if (ret != 0 || (fail_fast && tp->failed)) {
+            ret = 1;
+            break;
+        }
+    }
+
+    /* The last line, or pieces of one longer than the ring */
+    rest = end - start;
+    if (ret == 0 && rest > 0 && (end_of_output || rest == ring.size)) {
+        if (!end_of_output)
+            rest -= rest % (tp->buffer_len - 1);
+        index_line(base + (start - buf));
+        if (tap_parser_line(tp, start, rest) != 0)
+            ret = 1;
+        start += rest;
+    }
+
+    log_put(buf, start - buf);
+    tap_ring_consume(&ring, start - buf);
+    return ret;
+}
+
+/* Copy n bytes teed into tee_pipe to the log */
+static void
+log_teed(int logfd, char *scratch, size_t size, ssize_t n)
+{
+    ssize_t ret;
+
+    while (n > 0) {
+        ret = splice(tee_pipe[0], NULL, logfd, NULL, n, SPLICE_F_MOVE);
+        if (ret == -1 && errno == EINTR)
+            continue;
+        if (ret <= 0)
+            break;
+        log_spliced((size_t)ret);
+        n -= ret;
+    }
+
+    if (n == 0)
+        return;
+
+    /* The log doesn't take splices, copy what's left */
+    log_splice_failed();
+    while (n > 0) {
+        ret = read(tee_pipe[0], scratch, ((size_t)n < size) ? (size_t)n : size);
+        if (ret == -1 && errno == EINTR)
+            continue;
+        if (ret <= 0)
+            break;
+        log_put(scratch, (size_t)ret);
+        n -= ret;
+    }
+}
+
+/* read(2) test output into buf and log it.  When the log allows it the
+ * output is duplicated into the log inside the kernel with tee(2) and
+ * splice(2) before it's read, without a copy through user space. */
+static ssize_t
+read_output(int fd, char *buf, size_t size)
+{
+    int logfd;
+    ssize_t n;
+    ssize_t ret;
+    size_t got;
+
+    logfd = log_splice_fd();
+    if (logfd != -1 && tee_pipe[0] == -1) {
+        if (pipe2(tee_pipe, O_CLOEXEC) == -1) {
+            log_splice_failed();
+            logfd = -1;
+        }
+    }
+
+    if (logfd == -1)
+        goto copy;
+
+    n = tee(fd, tee_pipe[1], size, SPLICE_F_NONBLOCK);
+    if (n == -1 && errno == EINVAL) {
+        log_splice_failed();
+        goto copy;
+    }
+    if (n <= 0)
+        return n;
+
+    log_teed(logfd, buf, size, n);
+
+    /* Exactly what was teed is waiting in the pipe */
+    for (got = 0; got < (size_t)n; got += ret) {
+        ret = read(fd, buf + got, n - got);
+        if (ret == -1 && errno == EINTR)
+            ret = 0;
+        else if (ret <= 0)
+            return got;
+    }
+
+    return n;
+
+copy:
+    ret = read(fd, buf, size);
+    if (ret > 0)
+        log_put(buf, (size_t)ret);
+    return ret;
+}
+
+/* Read whatever the test has written to stderr so far.
+ * Returns 0 once stderr is closed. */
+static int
+read_stderr(void)
+{
+    ssize_t ret;
+    char buf[4096];
+
+    for (;;) {
+        ret = read(err_fd, buf, sizeof(buf));
+        if (ret == -1 && errno == EINTR)
+            continue;
+        if (ret == -1)
+            return errno == EAGAIN;
+        if (ret == 0)
+            return 0;
+
+        if (child_stderr == NULL)
+            child_stderr = stderr_new(child_start);
+        stderr_append(child_stderr, buf, (size_t)ret, monotonic_now());
+    }
+}
+
+enum parse_ret {
+    PR_EOF,     /* output closed */
+    PR_STOPPED, /* the parser or fail fast said stop */
+    PR_TIMEOUT  /* ran out of time */
+};
+
+/* pollfds of the event loop */
+enum {
+    PFD_OUT,
+    PFD_ERR,
+    PFD_TIMER,
+    PFD_RING,
+    PFD_CHILD,
+    PFD_COUNT
+};
+
+/* Nothing more will come through the ring: the writer said so, or
+ * the test is gone */
+static inline int
+ring_finished(void)
+{
+    return tap_ring_finished(&ring) || child_reaped;
+}
+
+/* The event loop for a running test: test output, stderr and the timer */
+static enum parse_ret
+parse_output(tap_parser *tp, double timeout)
+{
+    int wait;
+    int out_closed;
+    size_t len;
+    ssize_t ret;
+    struct pollfd pfd[PFD_COUNT];
+    struct itimerspec its;
+
+    /* poll skips negative fds */
+    memset(pfd, 0, sizeof(pfd));
+    pfd[PFD_OUT].fd = tp->fd;
+    pfd[PFD_OUT].events = POLLIN;
+    pfd[PFD_ERR].fd = err_fd;
+    pfd[PFD_ERR].events = POLLIN;
+    pfd[PFD_TIMER].fd = -1;
+    pfd[PFD_TIMER].events = POLLIN;
+    pfd[PFD_RING].fd = test_ring ? ring.data_fd : -1;
+    pfd[PFD_RING].events = POLLIN;
+    pfd[PFD_CHILD].fd = -1;
+    pfd[PFD_CHILD].events = POLLIN;
+
+    if (timeout > 0.0) {
+        if (timer_fd == -1) {
+            timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC | TFD_NONBLOCK);
+            if (timer_fd == -1)
+                die(errno, "timerfd_create()");
+        }
+
+        memset(&its, 0, sizeof(its));
+        its.it_value.tv_sec = (time_t)timeout;
+        its.it_value.tv_nsec = (long)((timeout - (double)its.it_value.tv_sec) * 1e9);
+        if (timerfd_settime(timer_fd, 0, &its, NULL) == -1)
+            die(errno, "timerfd_settime()");
+
+        pfd[PFD_TIMER].fd = timer_fd;
+    }
+
+    len = 0;
+    out_closed = 0;
+    for (;;) {
+        /* Wakes up for console output that's due too, right away
+         * when the ring has something */
+        wait = console_timeout();
+        if (test_ring && tap_ring_sleep(&ring))
+            wait = 0;
+        else if (out_closed && child_fd == -1
+                 && (wait < 0 || wait > RING_REAP_POLL_MS)) {
+            /* SIGCHLD may come in just before poll() */
+            wait = RING_REAP_POLL_MS;
+        }
+
+        if (poll(pfd, PFD_COUNT, wait) == -1) {
+            if (errno == EINTR)
+                continue;
+            die(errno, "poll()");
+        }
+
+        console_tick();
+
+        if (test_ring) {
+            tap_ring_wake(&ring);
+            if (feed_ring(tp, 0))
+                return PR_STOPPED;
+        }
+
+        if (pfd[PFD_TIMER].revents & POLLIN)
+            return PR_TIMEOUT;
+
+        if (pfd[PFD_ERR].revents != 0 && !read_stderr())
+            pfd[PFD_ERR].fd = -1;
+
+        if (out_closed) {
+            if (!(pfd[PFD_CHILD].revents & POLLIN) && !ring_finished())
+                continue;
+
+            /* Everything is in, the last line may not have a newline */
+            if (feed_ring(tp, 1))
+                return PR_STOPPED;
+            return PR_EOF;
+        }
+
+        if (pfd[PFD_OUT].revents == 0)
+            continue;
+
+        io_read_start = len;
+        io_read_offset = log_offset();
+        ret = read_output(tp->fd, io_buffer + len, TEST_IO_SZ - len);
+        if (ret == -1 && (errno == EINTR || errno == EAGAIN))
+            continue;
+
+        if (ret <= 0) {
+            /* Pick up what was written to stderr last */
+            if (pfd[PFD_ERR].fd != -1)
+                read_stderr();
+
+            /* The last line may not have a newline */
+            index_line(io_offset);
+            if (len > 0 && tap_parser_line(tp, io_buffer, len) != 0)
+                return PR_STOPPED;
+
+            if (!test_ring)
+                return PR_EOF;
+
+            /* A test may close stdout and go on writing the ring,
+             * it's done when it says so or is gone */
+            pfd[PFD_OUT].fd = -1;
+            pfd[PFD_CHILD].fd = child_fd;
+            out_closed = 1;
+            if (!ring_finished())
+                continue;
+
+            if (feed_ring(tp, 1))
+                return PR_STOPPED;
+            return PR_EOF;
+        }
+
+        len += (size_t)ret;
+        if (feed_lines(tp, &len))
+            return PR_STOPPED;
+    }
+}
+
+static void
+disarm_timer(void)
+{
+    struct itimerspec its;
+
+    if (timer_fd == -1)
+        return;
+
+    memset(&its, 0, sizeof(its));
+    timerfd_settime(timer_fd, 0, &its, NULL);
+}
+
 static int
-run_single(tap_parser *tp, const char *test)
+run_single(tap_parser *tp, const char *test, double timeout, int with_ring)
 {
     int ret;
+    int stopped;
 
     ret = init_parser(tp);
     if (ret != 0)
         die(ret, "tap_parser_reset()");
 
+    if (show_diags)
+        tap_parser_set_diags(tp, DIAGS_CAP, DIAGS_TEST_CAP, 1);
+
+    if (window >= 0)
+        tap_parser_set_stream(tp, 1, (size_t)window);
+
+    /* Starts the clock for the first assertion too */
+    if (slowest)
+        tap_parser_set_timing(tp, 1);
+
     child_exited = 0;
+    child_reaped = 0;
     child_status = 0;
+    child_timed_out = 0;
+    child_start = monotonic_now();
     current_child = -1;
+    test_ring = with_ring;
 
     /* Kick off the test */
     current_child = exec_test(tp, test);
 
     /* Loop over all output */
-    while (tap_parser_next(tp) == 0)
-        ;
-
-    if (!child_exited) {
+    io_offset = log_offset();
+    child_timed_out = (parse_output(tp, timeout) == PR_TIMEOUT);
+    disarm_timer();
+
+    stopped = child_timed_out || (fail_fast && tp->failed);
+    if (stop_on_bail && tp->bailed)
+        stopped = 1;
+
+    if (stopped) {
+        /* Stopping the run, don't leave anything behind */
+        if (verbosity >= 2) {
+            fprintf(stderr, "Stopping child (%lu)\n",
+                    (unsigned long)current_child);
+            fflush(stderr);
+        }
+        stop_child();
+    }
+    else if (!child_exited) {
         /* Give the child some time, then kill it! */
         usleep(10);
         if (!child_exited) {
@@ -853,8 +2117,9 @@ run_single(tap_parser *tp, const char *test)
                         (unsigned long)current_child);
                 fflush(stderr);
             }
-            kill(current_child, SIGKILL);
+            kill(-current_child, SIGKILL);
         }
+        reap_child();
     }
 
     if (WIFEXITED(child_status))
@@ -864,6 +2129,28 @@ run_single(tap_parser *tp, const char *test)
 
     /* Close the fd */
     close(tp->fd);
+    current_child = -1;
+
+    if (child_fd != -1) {
+        close(child_fd);
+        child_fd = -1;
+    }
+
+    if (err_fd != -1) {
+        close(err_fd);
+        err_fd = -1;
+    }
+
+    /* Only a list has somewhere to keep it */
+    if (!running_list && child_stderr != NULL) {
+        stderr_free(child_stderr);
+        child_stderr = NULL;
+    }
+
+    /* We killed it, that's not the test's fault,
+     * unless it ran out of time */
+    if (stopped && !child_timed_out && ret < 0)
+        ret = 0;
 
     if (ret != 0)
         return ret;
@@ -872,7 +2159,7 @@ run_single(tap_parser *tp, const char *test)
 }
 
 static inline void
-cook_test_results(test_results *tsr, ttr_node *node, tap_parser *tp)
+cook_test_results(strbuf *out, test_results *tsr, ttr_node *node, tap_parser *tp)
 {
     int reported = 0;
 
@@ -883,98 +2170,116 @@ cook_test_results(test_results *tsr, ttr_node *node, tap_parser *tp)
     tsr->total_parse_errors += tp->parse_errors;
 
     /* XXX: This function needs to dump test results each pass */
-    if (tp->bailed) {
+    if (node->timed_out) {
+        strbuf_printf(out, "ABORTED (Timeout)\n");
+        reported = 1;
+        node->aborted = 1;
+    }
+    else if (tp->bailed) {
         if (tp->bailed_reason == NULL) {
-            printf("ABORTED");
+            strbuf_printf(out, "ABORTED");
             if (tp->plan != -1)
-                printf(" (passed %ld/%ld)", tp->passed, tp->plan);
-            putchar('\n');
+                strbuf_printf(out, " (passed %ld/%ld)", tp->passed, tp->plan);
+            strbuf_putc(out, '\n');
         }
         else
-            printf("ABORTED (%s)\n", tp->bailed_reason);
+            strbuf_printf(out, "ABORTED (%s)\n", tp->bailed_reason);
         reported = 1;
         node->aborted = 1;
     }
     else if (tp->plan == -1) {
-        printf("ABORTED (No Plan)\n");
+        strbuf_printf(out, "ABORTED (No Plan)\n");
         reported = 1;
         node->aborted = 1;
     }
     else if (tp->tests_run > tp->plan) {
-        printf("ABORTED (Extra Tests)\n");
+        strbuf_printf(out, "ABORTED (Extra Tests)\n");
         reported = 1;
         node->aborted = 1;
     }
     else if (node->status < 0) {
-        printf("ABORTED (Killed by signal %d)\n", node->status);
+        strbuf_printf(out, "ABORTED (Killed by signal %d)\n", node->status);
         reported = 1;
         node->aborted = 1;
     }
 
     tsr->total_aborted += node->aborted;
 
-    if (reported) {
-        fflush(stdout);
+    if (reported)
         return;
-    }
 
     if (tp->skip_all) {
         if (tp->skip_all_reason == NULL)
-            printf("skipped\n");
+            strbuf_printf(out, "skipped\n");
         else
-            printf("skipped (%s)\n", tp->skip_all_reason);
-            fflush(stdout);
+            strbuf_printf(out, "skipped (%s)\n", tp->skip_all_reason);
         return;
     }
 
     if (tp->tests_run < tp->plan) {
-        printf("MISSED ");
-        print_test_results(node, TTT_INVALID);
+        strbuf_printf(out, "MISSED ");
+        print_test_results(out, node, TTT_INVALID, tp->stream ? tp->plan : 0);
         if (tp->failed)
-            printf("; ");
+            strbuf_printf(out, "; ");
         else {
-            putchar('\n');
+            strbuf_putc(out, '\n');
             return;
         }
     }
 
     if (tp->failed) {
-        printf("FAILED ");
-        print_test_results(node, TTT_NOT_OK);
-        putchar('\n');
+        strbuf_printf(out, "FAILED ");
+        print_test_results(out, node, TTT_NOT_OK, 0);
+        strbuf_putc(out, '\n');
         return;
     }
 
-    printf("ok");
+    strbuf_printf(out, "ok");
     if (tp->skipped)
-        printf(" (skipped %ld tests)", tp->skipped);
-    putchar('\n');
-
-    fflush(stdout);
+        strbuf_printf(out, " (skipped %ld tests)", tp->skipped);
+    strbuf_putc(out, '\n');
 }
 
+/* Tests after the known ones up to upto are listed as a range,
+ * a stream only keeps what it has seen */
 static inline void
-print_test_results(ttr_node *node, enum tap_test_type ttt)
+print_test_results(strbuf *out, ttr_node *node, enum tap_test_type ttt,
+                   long upto)
 {
-    size_t i, first;
+    long i, lo, hi;
+    int first;
 
-    if (node->tr == NULL || node->tr->results_len == 0) {
-        printf("???");
+    tap_results_range(node->tr, &lo, &hi);
+    if (lo == hi && upto < hi) {
+        strbuf_printf(out, "???");
         return;
     }
 
+    /* A --window only knows the last ones */
+    if (lo > 1)
+        strbuf_printf(out, "... ");
+
     first = 1;
-    for (i = 1; i < node->tr->results_len; ++i) {
+    for (i = lo; i < hi; ++i) {
         /* Skip anything we don't care about */
-        if (node->tr->results[i] != ttt)
+        if (tap_results_get(node->tr, i) != ttt)
             continue;
 
         if (!first)
-            printf(", ");
+            strbuf_printf(out, ", ");
         else
             first = 0;
 
-        printf("%ld", (unsigned long)i);
+        strbuf_printf(out, "%ld", i);
+    }
+
+    if (upto >= hi) {
+        if (!first)
+            strbuf_printf(out, ", ");
+        if (upto == hi)
+            strbuf_printf(out, "%ld", hi);
+        else
+            strbuf_printf(out, "%ld-%ld", hi, upto);
     }
 }
 
@@ -5,7 +5,9 @@
 #include <string.h>
 
 #include "tap_parser.h"
-#include "test_log.h"
+#include "test_report.h"
+#include "test_console.h"
+#include "test_index.h"
 
 /* From test.c */
 extern int verbosity;
@@ -14,10 +16,8 @@ extern int running_list;
 static int
 invalid_cb(tap_parser *tp, int err, const char *msg)
 {
-    if (verbosity >= 3) {
-        printf("Error: [%d] %s\n", err, msg);
-        fflush(stdout);
-    }
+    if (verbosity >= 3)
+        console_printf("Error: [%d] %s\n", err, msg);
 
     return tap_default_invalid_callback(tp, err, msg);
 }
@@ -40,8 +40,7 @@ unknown_cb(tap_parser *tp)
     if (tp->buffer[len - 1] == '\n')
         tp->buffer[len - 1] = '\0';
 
-    printf("Unknown: %s\n", tp->buffer);
-    fflush(stdout);
+    console_printf("Unknown: %s\n", tp->buffer);
 
     return tap_default_unknown_callback(tp);
 #endif
@@ -50,10 +49,8 @@ unknown_cb(tap_parser *tp)
 static int
 version_cb(tap_parser *tp, long tap_version)
 {
-    if (verbosity >= 3) {
-        printf("Version: %ld\n", tap_version);
-        fflush(stdout);
-    }
+    if (verbosity >= 3)
+        console_printf("Version: %ld\n", tap_version);
 
     return tap_default_version_callback(tp, tap_version);
 }
@@ -76,8 +73,7 @@ comment_cb(tap_parser *tp)
     if (tp->buffer[len - 1] == '\n')
         tp->buffer[len - 1] = '\0';
 
-    printf("Comment: %s\n", tp->buffer);
-    fflush(stdout);
+    console_printf("Comment: %s\n", tp->buffer);
 
     return tap_default_comment_callback(tp);
 #endif
@@ -89,13 +85,11 @@ bailout_cb(tap_parser *tp, char *msg)
     if (verbosity < 3)
         return tap_default_bailout_callback(tp, msg);
 
-    printf("Bail out!");
+    console_printf("Bail out!");
     if (msg)
-        printf(" %s\n", msg);
+        console_printf(" %s\n", msg);
     else
-        putchar('\n');
-
-    fflush(stdout);
+        console_putc('\n');
 
     return tap_default_bailout_callback(tp, msg);
 }
@@ -105,10 +99,8 @@ pragma_cb(tap_parser *tp, int state, char *pragma)
 {
     static int test_pragma;
 
-    if (verbosity >= 3) {
-        printf("Pragma: %c%s\n", (state) ? '+' : '-', pragma);
-        fflush(stdout);
-    }
+    if (verbosity >= 3)
+        console_printf("Pragma: %c%s\n", (state) ? '+' : '-', pragma);
 
     /* test pragma */
     if (!strcmp(pragma, "test")) {
@@ -120,8 +112,7 @@ pragma_cb(tap_parser *tp, int state, char *pragma)
         if (!state)
             return 0;
 
-        printf("test_pragma: %d\n", test_pragma);
-        fflush(stdout);
+        console_printf("test_pragma: %d\n", test_pragma);
         return 0;
     }
 
@@ -129,8 +120,7 @@ pragma_cb(tap_parser *tp, int state, char *pragma)
         if (!state)
             return 0;
 
-        printf("strict: %d\n", tp->strict);
-        fflush(stdout);
+        console_printf("strict: %d\n", tp->strict);
         return 0;
     }
 
@@ -138,8 +128,7 @@ pragma_cb(tap_parser *tp, int state, char *pragma)
         if (!state)
             return 0;
 
-        printf("parse_errors: %ld\n", tp->parse_errors);
-        fflush(stdout);
+        console_printf("parse_errors: %ld\n", tp->parse_errors);
         return 0;
     }
 
@@ -152,13 +141,11 @@ plan_cb(tap_parser *tp, long upper, char *skip)
     if (verbosity < 3)
             return tap_default_plan_callback(tp, upper, skip);
 
-    printf("Plan: 1..%ld", upper);
+    console_printf("Plan: 1..%ld", upper);
     if (skip)
-        printf(" # skip %s\n", skip);
+        console_printf(" # skip %s\n", skip);
     else
-        putchar('\n');
-
-    fflush(stdout);
+        console_putc('\n');
 
     return tap_default_plan_callback(tp, upper, skip);
 }
@@ -167,81 +154,79 @@ static int
 test_cb(tap_parser *tp, tap_test_result *ttr)
 {
     if (running_list && verbosity) {
-        printf("  %ld ", ttr->test_num);
+        console_printf("  %ld ", ttr->test_num);
         if (ttr->reason)
-            printf("%s: ", ttr->reason);
+            console_printf("%s: ", ttr->reason);
 
         switch (ttr->type) {
         case TTT_OK:
-            printf("PASS");
+            console_printf("PASS");
             break;
         case TTT_TODO_PASSED:
         case TTT_SKIP_FAILED:
         case TTT_NOT_OK:
-            printf("FAIL");
+            console_printf("FAIL");
             break;
         case TTT_TODO:
-            printf("TODO");
+            console_printf("TODO");
             break;
         case TTT_SKIP:
-            printf("SKIP");
+            console_printf("SKIP");
             break;
         case TTT_INVALID:
-            printf("MISSING");
+            console_printf("MISSING");
             break;
         }
 
         if (ttr->directive)
-            printf(" (%s)\n", ttr->directive);
+            console_printf(" (%s)\n", ttr->directive);
         else
-            putchar('\n');
+            console_putc('\n');
     }
     else if (verbosity >= 3) {
-        printf("Test: %ld ", ttr->test_num);
+        console_printf("Test: %ld ", ttr->test_num);
         switch (ttr->type) {
         case TTT_OK:
-            printf("ok");
+            console_printf("ok");
             break;
         case TTT_NOT_OK:
-            printf("not ok");
+            console_printf("not ok");
             break;
         case TTT_TODO:
-            printf("todo");
+            console_printf("todo");
             break;
         case TTT_TODO_PASSED:
-            printf("ok todo");
+            console_printf("ok todo");
             break;
         case TTT_SKIP:
-            printf("skip");
+            console_printf("skip");
             break;
         case TTT_SKIP_FAILED:
-            printf("not ok skip");
+            console_printf("not ok skip");
             break;
         case TTT_INVALID:
-            printf("missing?");
+            console_printf("missing?");
             break;
         }
 
         if (ttr->reason) {
            if (ttr->directive)
-                printf(": %s (%s)\n", ttr->reason, ttr->directive);
+                console_printf(": %s (%s)\n", ttr->reason, ttr->directive);
             else
-                printf(": %s\n", ttr->reason);
+                console_printf(": %s\n", ttr->reason);
         }
         else if (ttr->directive)
-            printf(" (%s)\n", ttr->directive);
+            console_printf(" (%s)\n", ttr->directive);
         else
-            putchar('\n');
+            console_putc('\n');
     }
 
-    fflush(stdout);
-    return tap_default_test_callback(tp, ttr);
-}
+    if (running_list)
+        console_assertion();
 
-static void
-preparse_cb(tap_parser *tp)
-{
-    log_write("%s", tp->buffer);
+    report_assertion(ttr);
+    index_assertion(ttr->test_num);
+    return tap_default_test_callback(tp, ttr);
 }
 
 #endif /* _H_TEST_CALLBACKS */
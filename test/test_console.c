@@ -0,0 +1,302 @@
+#include <sys/ioctl.h>
+#include <sys/types.h>
+
+#include <errno.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "test_utils.h"
+#include "test_console.h"
+
+/* Output is written once this much is buffered */
+#define CONSOLE_BUFFER_SZ (64 * 1024)
+
+/* or once the oldest of it is this old, in seconds */
+#define CONSOLE_HOLD 0.25
+
+#define ERASE_LINE "\r\033[K"
+
+static char buffer[CONSOLE_BUFFER_SZ];
+static size_t buffer_len = 0;
+static double held_since = 0.0;
+
+/* Only the process that set things up writes, not forked children */
+static pid_t owner = -1;
+
+static int live = 0;
+static int at_bol = 1;         /* output ends with a newline */
+static int progress_shown = 0; /* the progress line is on screen */
+static double last_draw = 0.0;
+
+/* The running test */
+static const char *test_name = NULL;
+static size_t test_index = 0;
+static size_t test_total = 0;
+static long test_assertions = 0;
+static double test_start = 0.0;
+
+static void
+write_all(const char *str, size_t len)
+{
+    ssize_t ret;
+
+    while (len > 0) {
+        ret = write(STDOUT_FILENO, str, len);
+        if (ret == -1) {
+            if (errno == EINTR || errno == EAGAIN)
+                continue;
+            /* Nowhere to put it */
+            return;
+        }
+
+        str += ret;
+        len -= (size_t)ret;
+    }
+}
+
+void
+console_flush(void)
+{
+    if (buffer_len == 0)
+        return;
+
+    write_all(buffer, buffer_len);
+    buffer_len = 0;
+}
+
+static void
+append(const char *str, size_t len)
+{
+    if (buffer_len + len > CONSOLE_BUFFER_SZ)
+        console_flush();
+
+    if (len > CONSOLE_BUFFER_SZ) {
+        write_all(str, len);
+        return;
+    }
+
+    if (buffer_len == 0)
+        held_since = monotonic_now();
+
+    memcpy(buffer + buffer_len, str, len);
+    buffer_len += len;
+}
+
+static inline void
+erase_progress(void)
+{
+    if (!progress_shown)
+        return;
+
+    progress_shown = 0;
+    append(ERASE_LINE, sizeof(ERASE_LINE) - 1);
+}
+
+static void
+console_exit(void)
+{
+    if (getpid() == owner)
+        console_fini();
+}
+
+void
+console_init(void)
+{
+    const char *term;
+
+    owner = getpid();
+
+    term = getenv("TERM");
+    live = isatty(STDOUT_FILENO)
+        && (term == NULL || strcmp(term, "dumb") != 0);
+
+    /* Anything printed with stdio goes first */
+    fflush(stdout);
+
+    atexit(console_exit);
+}
+
+void
+console_fini(void)
+{
+    erase_progress();
+    console_flush();
+    test_name = NULL;
+}
+
+int
+console_live(void)
+{
+    return live;
+}
+
+void
+console_write(const char *str, size_t len)
+{
+    if (len == 0)
+        return;
+
+    erase_progress();
+    append(str, len);
+    at_bol = (str[len - 1] == '\n');
+
+    if (monotonic_now() - held_since >= CONSOLE_HOLD)
+        console_flush();
+}
+
+void
+console_putc(char c)
+{
+    console_write(&c, 1);
+}
+
+void
+console_printf(const char *fmt, ...)
+{
+    int len;
+    char small[256];
+    char *str;
+    va_list ap;
+
+    va_start(ap, fmt);
+    len = vsnprintf(small, sizeof(small), fmt, ap);
+    va_end(ap);
+
+    if (len < 0)
+        return;
+
+    if ((size_t)len < sizeof(small)) {
+        console_write(small, (size_t)len);
+        return;
+    }
+
+    str = (char *)malloc((size_t)len + 1);
+    if (str == NULL)
+        die(errno, "malloc()");
+
+    va_start(ap, fmt);
+    vsnprintf(str, (size_t)len + 1, fmt, ap);
+    va_end(ap);
+
+    console_write(str, (size_t)len);
+    free(str);
+}
+
+static void
+draw_progress(void)
+{
+    int len;
+    int width;
+    char line[512];
+    struct winsize ws;
+
+    width = 80;
+    if (ioctl(STDOUT_FILENO, TIOCGWINSZ, &ws) == 0 && ws.ws_col > 0)
+        width = ws.ws_col;
+
+    len = snprintf(line, sizeof(line), "[%lu/%lu] %s: %ld assertions, %.1fs",
+                   (unsigned long)(test_index + 1), (unsigned long)test_total,
+                   test_name, test_assertions, monotonic_now() - test_start);
+    if (len < 0)
+        return;
+
+    /* Wrapping would leave a copy behind on every redraw */
+    if (len >= (int)sizeof(line))
+        len = sizeof(line) - 1;
+    if (len >= width)
+        len = width - 1;
+
+    append(line, (size_t)len);
+    progress_shown = 1;
+}
+
+void
+console_tick(void)
+{
+    double now;
+
+    now = monotonic_now();
+
+    if (live && test_name != NULL && now - last_draw >= 1.0 / CONSOLE_RATE) {
+        last_draw = now;
+
+        /* Only between lines of output */
+        if (at_bol) {
+            erase_progress();
+            draw_progress();
+            console_flush();
+            return;
+        }
+    }
+
+    if (buffer_len > 0 && now - held_since >= CONSOLE_HOLD)
+        console_flush();
+}
+
+int
+console_timeout(void)
+{
+    int due;
+    double now;
+    double wait;
+    double draw;
+
+    now = monotonic_now();
+    due = 0;
+    wait = 0.0;
+
+    if (buffer_len > 0) {
+        wait = held_since + CONSOLE_HOLD - now;
+        due = 1;
+    }
+
+    if (live && test_name != NULL) {
+        draw = last_draw + 1.0 / CONSOLE_RATE - now;
+        if (!due || draw < wait)
+            wait = draw;
+        due = 1;
+    }
+
+    if (!due)
+        return -1;
+
+    if (wait <= 0.0)
+        return 0;
+
+    /* Round up, waking early would just spin */
+    return (int)(wait * 1000.0) + 1;
+}
+
+void
+console_test_begin(const char *name, size_t index, size_t total)
+{
+    test_name = name;
+    test_index = index;
+    test_total = total;
+    test_assertions = 0;
+    test_start = monotonic_now();
+
+    console_tick();
+}
+
+void
+console_assertion(void)
+{
+    test_assertions++;
+    console_tick();
+}
+
+void
+console_test_end(void)
+{
+    test_name = NULL;
+
+    /* Tests are where output is expected to show up */
+    erase_progress();
+    console_flush();
+}
+
+/* vim: set ts=4 sw=4 sws=4 expandtab: */
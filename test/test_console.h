@@ -0,0 +1,45 @@
+#ifndef _H_TEST_CONSOLE
+#define _H_TEST_CONSOLE
+
+/* Output to stdout goes through here.
+ *
+ * Output is collected in a large buffer and written when it fills,
+ * when it has been held for a while, or at the end of each test, so
+ * a console that's slow to drain doesn't slow the tests down.
+ *
+ * On a terminal a live progress line is kept below the output while
+ * a list runs, it's redrawn at most CONSOLE_RATE times a second.
+ */
+
+/* Progress line redraws per second */
+#define CONSOLE_RATE 10
+
+extern void console_init(void);
+
+/* Flushes and removes the progress line, also run at exit */
+extern void console_fini(void);
+
+/* Is the progress line in use? */
+extern int console_live(void);
+
+extern void console_printf(const char *fmt, ...)
+    __attribute__((format(printf, 1, 2)));
+extern void console_write(const char *str, size_t len);
+extern void console_putc(char c);
+
+/* Write out everything buffered */
+extern void console_flush(void);
+
+/* Progress of a list, the test at index (from 0) of total started */
+extern void console_test_begin(const char *name, size_t index, size_t total);
+extern void console_assertion(void);
+extern void console_test_end(void);
+
+/* Flush and redraw the progress line if they are due */
+extern void console_tick(void);
+
+/* Milliseconds until console_tick() has something to do, -1 for never */
+extern int console_timeout(void);
+
+#endif /* _H_TEST_CONSOLE */
+/* vim: set ts=4 sw=4 sws=4 expandtab: */
@@ -0,0 +1,459 @@
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "test_utils.h"
+#include "test_hash.h"
+#include "test_discovery.h"
+
+#define DISCOVERY_MAGIC "tap-discovery 1"
+
+/* mtime of a directory, sec is -1 if it doesn't exist */
+struct dir_state {
+    int recorded;  /* rec_* was loaded from the cache file */
+    int stated;    /* cur_* has been filled in this run */
+    long long rec_sec;
+    long rec_nsec;
+    long long cur_sec;
+    long cur_nsec;
+};
+
+static struct dir_state*
+dir_state_get(test_discovery *dc, const char *dir)
+{
+    struct dir_state *ds;
+
+    ds = (struct dir_state *)strmap_get(&dc->dirs, dir);
+    if (ds != NULL)
+        return ds;
+
+    ds = (struct dir_state *)calloc(1, sizeof(*ds));
+    if (ds == NULL)
+        die(errno, "calloc(dir_state)");
+
+    strmap_put(&dc->dirs, dir, ds);
+    return ds;
+}
+
+/* stat a directory at most once per run */
+static struct dir_state*
+dir_state_current(test_discovery *dc, const char *dir)
+{
+    struct stat sb;
+    struct dir_state *ds;
+
+    ds = dir_state_get(dc, dir);
+    if (ds->stated)
+        return ds;
+
+    ds->stated = 1;
+    if (stat(dir, &sb) == -1) {
+        ds->cur_sec = -1;
+        ds->cur_nsec = 0;
+        return ds;
+    }
+
+    ds->cur_sec = (long long)sb.st_mtim.tv_sec;
+    ds->cur_nsec = (long)sb.st_mtim.tv_nsec;
+    return ds;
+}
+
+/* Fill dirs with the search directories, returns the count */
+static inline int
+search_dirs(const test_discovery *dc, const char *dirs[3])
+{
+    int count = 0;
+
+    dirs[count++] = ".";
+    if (dc->build != NULL && *dc->build != '\0')
+        dirs[count++] = dc->build;
+    if (dc->source != NULL && *dc->source != '\0')
+        dirs[count++] = dc->source;
+
+    return count;
+}
+
+/* Build "dir/dirname(base)" into a malloc'd string */
+static char*
+candidate_dir(const char *dir, const char *base)
+{
+    char *ret;
+    const char *slash;
+    size_t len;
+    size_t dir_len;
+
+    slash = strrchr(base, '/');
+    len = (slash == NULL) ? 0 : (size_t)(slash - base);
+    dir_len = strlen(dir);
+
+    ret = (char *)malloc(dir_len + len + 2);
+    if (ret == NULL)
+        die(errno, "malloc()");
+
+    memcpy(ret, dir, dir_len);
+    if (len != 0) {
+        ret[dir_len] = '/';
+        memcpy(&ret[dir_len + 1], base, len);
+        ret[dir_len + len + 1] = '\0';
+    }
+    else
+        ret[dir_len] = '\0';
+
+    return ret;
+}
+
+/* Check (and stat) every directory that could hold base.
+ * Returns 1 if all of them match what the cache recorded. */
+static int
+candidates_unchanged(test_discovery *dc, const char *base)
+{
+    int i, count;
+    int unchanged;
+    char *dir;
+    const char *dirs[3];
+    struct dir_state *ds;
+
+    unchanged = 1;
+    count = search_dirs(dc, dirs);
+
+    for (i = 0; i < count; ++i) {
+        dir = candidate_dir(dirs[i], base);
+        ds = dir_state_current(dc, dir);
+        free(dir);
+
+        if (!ds->recorded || ds->rec_sec != ds->cur_sec
+                || ds->rec_nsec != ds->cur_nsec) {
+            unchanged = 0;
+        }
+    }
+
+    return unchanged;
+}
+
+/* The uncached search */
+static char*
+find_test(const test_discovery *dc, const char *base)
+{
+    char *ret;
+
+    int i, count;
+    const char *dirs[3];
+
+    size_t pos;
+    size_t len;
+    size_t dir_len;
+    size_t base_len;
+
+    struct stat sb;
+
+    count = search_dirs(dc, dirs);
+
+    ret = NULL;
+    dir_len = 0;
+    base_len = strlen(base);
+
+    for (i = 0; i < count; ++i) {
+        len = strlen(dirs[i]);
+
+        if (ret != NULL) {
+            if (dir_len < len) {
+                char *n;
+                n = (char *)realloc(ret, len + base_len + 4);
+                if (n == NULL) {
+                    free(ret);
+                    die(errno, "realloc()");
+                }
+
+                ret = n;
+            }
+        }
+        else {
+            ret = (char *)malloc(len + base_len + 4);
+            if (ret == NULL)
+                die(errno, "malloc()");
+        }
+
+        dir_len = len;
+
+        memcpy(ret, dirs[i], dir_len);
+        ret[dir_len] = '/';
+        pos = dir_len + 1;
+
+        memcpy(&ret[pos], base, base_len);
+        pos += base_len;
+        ret[pos + 1] = 't';
+        ret[pos + 2] = '\0';
+
+        /* First try -t */
+        ret[pos] = '-';
+        if (stat(ret, &sb) != -1) {
+            if (!S_ISREG(sb.st_mode))
+                die(0, "%s is not a regular file!\n", ret);
+            return ret;
+        }
+
+        /* Next is .t */
+        ret[pos] = '.';
+        if (stat(ret, &sb) != -1) {
+            if (!S_ISREG(sb.st_mode))
+                die(0, "%s is not a regular file!\n", ret);
+            return ret;
+        }
+    }
+
+    free(ret);
+    return NULL;
+}
+
+/* Returns 1 if the cache header matches this run */
+static int
+load_header(test_discovery *dc, FILE *file)
+{
+    char *line = NULL;
+    size_t cap = 0;
+    ssize_t len;
+    int i;
+    const char *want[3];
+    const char *keys[3] = { "list\t", "build\t", "source\t" };
+
+    want[0] = dc->list;
+    want[1] = (dc->build != NULL) ? dc->build : "";
+    want[2] = (dc->source != NULL) ? dc->source : "";
+
+    len = getline(&line, &cap, file);
+    if (len != sizeof(DISCOVERY_MAGIC "\n") - 1
+            || memcmp(line, DISCOVERY_MAGIC "\n", len) != 0)
+        goto mismatch;
+
+    for (i = 0; i < 3; ++i) {
+        len = getline(&line, &cap, file);
+        if (len <= 0 || line[len - 1] != '\n')
+            goto mismatch;
+
+        line[len - 1] = '\0';
+        if (strncmp(line, keys[i], strlen(keys[i])) != 0)
+            goto mismatch;
+
+        if (strcmp(line + strlen(keys[i]), want[i]) != 0)
+            goto mismatch;
+    }
+
+    free(line);
+    return 1;
+
+mismatch:
+    free(line);
+    return 0;
+}
+
+static void
+load_cache(test_discovery *dc)
+{
+    FILE *file;
+    char *line = NULL;
+    char *path;
+    char *tab;
+    char *end;
+    size_t cap = 0;
+    ssize_t len;
+    long long sec;
+    long nsec;
+    struct dir_state *ds;
+
+    file = fopen(dc->cache_file, "r");
+    if (file == NULL)
+        return;
+
+    if (!load_header(dc, file)) {
+        fclose(file);
+        return;
+    }
+
+    while ((len = getline(&line, &cap, file)) > 0) {
+        if (line[len - 1] != '\n')
+            break;
+        line[len - 1] = '\0';
+
+        if (strncmp(line, "dir\t", 4) == 0) {
+            /* dir <path> <sec> <nsec> */
+            tab = strrchr(line + 4, '\t');
+            if (tab == NULL)
+                continue;
+            nsec = strtol(tab + 1, &end, 10);
+            *tab = '\0';
+
+            tab = strrchr(line + 4, '\t');
+            if (tab == NULL)
+                continue;
+            sec = strtoll(tab + 1, &end, 10);
+            *tab = '\0';
+
+            ds = dir_state_get(dc, line + 4);
+            ds->recorded = 1;
+            ds->rec_sec = sec;
+            ds->rec_nsec = nsec;
+        }
+        else if (strncmp(line, "test\t", 5) == 0) {
+            /* test <name> <path> */
+            tab = strchr(line + 5, '\t');
+            if (tab == NULL)
+                continue;
+            *tab = '\0';
+
+            path = strdup(tab + 1);
+            if (path == NULL)
+                die(errno, "strdup(path)");
+
+            /* A test listed twice, the last one wins */
+            free(strmap_put(&dc->cached, line + 5, path));
+        }
+    }
+
+    free(line);
+    fclose(file);
+}
+
+void
+discovery_init(test_discovery *dc, const char *cache_file,
+               const char *list, const char *build, const char *source)
+{
+    memset(dc, 0, sizeof(*dc));
+
+    dc->cache_file = cache_file;
+    dc->list = list;
+    dc->build = build;
+    dc->source = source;
+
+    strmap_init(&dc->cached);
+    strmap_init(&dc->dirs);
+    strmap_init(&dc->resolved);
+
+    if (cache_file != NULL)
+        load_cache(dc);
+}
+
+char*
+discovery_find(test_discovery *dc, const char *base)
+{
+    char *path;
+    char *cached;
+
+    if (dc->cache_file == NULL)
+        return find_test(dc, base);
+
+    /* Stat the candidate directories before searching so a change
+     * racing with the search invalidates the entry next time */
+    if (candidates_unchanged(dc, base)) {
+        cached = (char *)strmap_get(&dc->cached, base);
+        if (cached != NULL) {
+            path = strdup(cached);
+            if (path == NULL)
+                die(errno, "strdup(path)");
+            goto found;
+        }
+    }
+
+    /* Miss or stale, fall back to a fresh search */
+    path = find_test(dc, base);
+    if (path == NULL)
+        return NULL;
+
+    dc->dirty = 1;
+
+found:
+    if (strmap_get(&dc->resolved, base) == NULL) {
+        char *copy = strdup(path);
+        if (copy == NULL)
+            die(errno, "strdup(path)");
+        strmap_put(&dc->resolved, base, copy);
+    }
+
+    return path;
+}
+
+static void
+write_dir(const char *dir, void *value, void *arg)
+{
+    struct dir_state *ds = (struct dir_state *)value;
+
+    /* Only directories looked at this run are still trustworthy */
+    if (!ds->stated)
+        return;
+
+    fprintf((FILE *)arg, "dir\t%s\t%lld\t%ld\n", dir, ds->cur_sec, ds->cur_nsec);
+}
+
+static void
+write_test(const char *name, void *value, void *arg)
+{
+    fprintf((FILE *)arg, "test\t%s\t%s\n", name, (const char *)value);
+}
+
+static void
+free_value(const char *key, void *value, void *arg)
+{
+    (void)key;
+    (void)arg;
+    free(value);
+}
+
+static void
+write_cache(test_discovery *dc)
+{
+    FILE *file;
+    char *tmp;
+    size_t len;
+
+    len = strlen(dc->cache_file);
+    tmp = (char *)malloc(len + sizeof(".tmp"));
+    if (tmp == NULL)
+        die(errno, "malloc()");
+
+    memcpy(tmp, dc->cache_file, len);
+    memcpy(tmp + len, ".tmp", sizeof(".tmp"));
+
+    /* Failing to write the cache isn't fatal, it just costs time */
+    file = fopen(tmp, "w");
+    if (file == NULL) {
+        free(tmp);
+        return;
+    }
+
+    fprintf(file, DISCOVERY_MAGIC "\n");
+    fprintf(file, "list\t%s\n", dc->list);
+    fprintf(file, "build\t%s\n", (dc->build != NULL) ? dc->build : "");
+    fprintf(file, "source\t%s\n", (dc->source != NULL) ? dc->source : "");
+
+    strmap_each(&dc->dirs, write_dir, file);
+    strmap_each(&dc->resolved, write_test, file);
+
+    if (fclose(file) != 0 || rename(tmp, dc->cache_file) != 0)
+        unlink(tmp);
+
+    free(tmp);
+}
+
+void
+discovery_fini(test_discovery *dc)
+{
+    /* Entries dropped from the list also make the cache dirty */
+    if (dc->cache_file != NULL
+            && (dc->dirty || dc->resolved.count != dc->cached.count)) {
+        write_cache(dc);
+    }
+
+    strmap_each(&dc->cached, free_value, NULL);
+    strmap_each(&dc->dirs, free_value, NULL);
+    strmap_each(&dc->resolved, free_value, NULL);
+
+    strmap_fini(&dc->cached);
+    strmap_fini(&dc->dirs);
+    strmap_fini(&dc->resolved);
+}
+
+/* vim: set ts=4 sw=4 sws=4 expandtab: */
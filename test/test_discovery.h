@@ -0,0 +1,38 @@
+#ifndef _H_TEST_DISCOVERY
+#define _H_TEST_DISCOVERY
+
+#include "test_hash.h"
+
+/* Resolves test names from a list file into paths.
+ *
+ * Resolution searches ".", the build directory and then the source
+ * directory for "name-t" and then "name.t".  When a cache file is
+ * given, previous resolutions are reused as long as the list file,
+ * build and source directories match, and the directories that
+ * could hold a candidate haven't changed their mtime.  Each of those
+ * directories is stat'ed at most once per run.
+ */
+typedef struct {
+    const char *cache_file; /* NULL to disable the cache */
+    const char *list;
+    const char *build;
+    const char *source;
+
+    int dirty;      /* Cache needs to be written back */
+    strmap cached;  /* name -> path, loaded from the cache file */
+    strmap dirs;    /* directory -> struct dir_state */
+    strmap resolved; /* name -> path, resolved during this run */
+} test_discovery;
+
+extern void discovery_init(test_discovery *dc, const char *cache_file,
+                           const char *list, const char *build,
+                           const char *source);
+
+/* Writes the cache back out if anything changed */
+extern void discovery_fini(test_discovery *dc);
+
+/* Returns a malloc'd path for base, or NULL if it can't be found */
+extern char* discovery_find(test_discovery *dc, const char *base);
+
+#endif /* _H_TEST_DISCOVERY */
+/* vim: set ts=4 sw=4 sws=4 expandtab: */
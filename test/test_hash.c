@@ -0,0 +1,140 @@
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "test_utils.h"
+#include "test_hash.h"
+
+#define STRMAP_INITIAL_SIZE 64
+
+unsigned long
+strmap_hash(const char *key)
+{
+    /* 64 bit FNV-1a, truncated on 32 bit longs */
+    unsigned long long hash = 14695981039346656037ULL;
+
+    while (*key != '\0') {
+        hash ^= (unsigned char)*key++;
+        hash *= 1099511628211ULL;
+    }
+
+    return (unsigned long)hash;
+}
+
+void
+strmap_init(strmap *map)
+{
+    memset(map, 0, sizeof(*map));
+}
+
+void
+strmap_fini(strmap *map)
+{
+    size_t i;
+
+    for (i = 0; i < map->size; ++i) {
+        if (map->slots[i].key != NULL)
+            free(map->slots[i].key);
+    }
+
+    if (map->slots != NULL)
+        free(map->slots);
+
+    memset(map, 0, sizeof(*map));
+}
+
+static inline strmap_slot*
+strmap_find(const strmap *map, const char *key)
+{
+    size_t i;
+    size_t mask;
+    strmap_slot *slot;
+
+    mask = map->size - 1;
+    i = strmap_hash(key) & mask;
+
+    /* Linear probe, the table is never allowed to fill up */
+    for (;;) {
+        slot = &map->slots[i];
+        if (slot->key == NULL || strcmp(slot->key, key) == 0)
+            return slot;
+        i = (i + 1) & mask;
+    }
+}
+
+static void
+strmap_grow(strmap *map)
+{
+    size_t i;
+    strmap old;
+    strmap_slot *slot;
+
+    old = *map;
+
+    map->size = (old.size == 0) ? STRMAP_INITIAL_SIZE : old.size * 2;
+    map->slots = (strmap_slot *)calloc(map->size, sizeof(strmap_slot));
+    if (map->slots == NULL)
+        die(errno, "calloc(strmap)");
+
+    for (i = 0; i < old.size; ++i) {
+        if (old.slots[i].key == NULL)
+            continue;
+
+        /* Keys are moved, not copied */
+        slot = strmap_find(map, old.slots[i].key);
+        *slot = old.slots[i];
+    }
+
+    if (old.slots != NULL)
+        free(old.slots);
+}
+
+void*
+strmap_get(const strmap *map, const char *key)
+{
+    strmap_slot *slot;
+
+    if (map->count == 0)
+        return NULL;
+
+    slot = strmap_find(map, key);
+    return slot->value;
+}
+
+void*
+strmap_put(strmap *map, const char *key, void *value)
+{
+    void *old;
+    strmap_slot *slot;
+
+    /* Keep the load factor under 3/4 */
+    if ((map->count + 1) * 4 > map->size * 3)
+        strmap_grow(map);
+
+    slot = strmap_find(map, key);
+    if (slot->key == NULL) {
+        slot->key = strdup(key);
+        if (slot->key == NULL)
+            die(errno, "strdup(strmap key)");
+        map->count++;
+    }
+
+    old = slot->value;
+    slot->value = value;
+    return old;
+}
+
+void
+strmap_each(const strmap *map,
+            void (*fn)(const char *key, void *value, void *arg),
+            void *arg)
+{
+    size_t i;
+
+    for (i = 0; i < map->size; ++i) {
+        if (map->slots[i].key != NULL)
+            fn(map->slots[i].key, map->slots[i].value, arg);
+    }
+}
+
+/* vim: set ts=4 sw=4 sws=4 expandtab: */
@@ -0,0 +1,39 @@
+#ifndef _H_TEST_HASH
+#define _H_TEST_HASH
+
+#include <stddef.h>
+
+/* Small open addressing string -> pointer map.
+ * Keys are copied into the map, values are owned by the caller. */
+
+typedef struct {
+    char *key;
+    void *value;
+} strmap_slot;
+
+typedef struct {
+    strmap_slot *slots;
+    size_t size;  /* Number of allocated slots, always a power of 2 */
+    size_t count; /* Number of used slots */
+} strmap;
+
+extern void strmap_init(strmap *map);
+extern void strmap_fini(strmap *map);
+
+/* Returns the value for key or NULL if it isn't in the map */
+extern void* strmap_get(const strmap *map, const char *key);
+
+/* Insert or replace the value for key, returns the value replaced
+ * (for the caller to free) or NULL if key is new */
+extern void* strmap_put(strmap *map, const char *key, void *value);
+
+/* Call fn on every key/value pair, in no particular order */
+extern void strmap_each(const strmap *map,
+                        void (*fn)(const char *key, void *value, void *arg),
+                        void *arg);
+
+/* FNV-1a, exposed since it's handy for stable hashing elsewhere */
+extern unsigned long strmap_hash(const char *key);
+
+#endif /* _H_TEST_HASH */
+/* vim: set ts=4 sw=4 sws=4 expandtab: */
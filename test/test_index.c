@@ -0,0 +1,478 @@
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "test_utils.h"
+#include "test_hash.h"
+#include "test_index.h"
+
+/* Layout, in native byte order:
+ *
+ *   header
+ *   records of the first test run, records of the second...
+ *   directory: dir_slots slots, then the test names
+ *
+ * The records of a test are an array indexed by test number, the
+ * directory an open addressing hash table of the tests, probed
+ * linearly from strmap_hash(name).  dir_offset is 0 until the index
+ * is closed, a harness that didn't get that far leaves no directory.
+ */
+#define INDEX_MAGIC "TAPLIDX1"
+
+/* Test numbers past this aren't indexed */
+#define INDEX_MAX_TESTS (1L << 24)
+
+typedef struct {
+    char magic[8];
+    uint64_t log_size;   /* log bytes the index covers */
+    uint64_t dir_offset;
+    uint64_t dir_slots;  /* power of 2 */
+} index_header;
+
+typedef struct {
+    uint64_t hash;
+    uint64_t records;    /* file offset of the records, 0 for an empty slot */
+    uint64_t name_offset;
+    uint32_t name_len;
+    uint32_t count;      /* records, the highest test number + 1 */
+} index_slot;
+
+typedef struct {
+    uint64_t offset;
+    uint64_t len;        /* 0 when there's no such test */
+} index_record;
+
+/* A test in the directory */
+typedef struct {
+    uint64_t records;
+    uint32_t count;
+} index_entry;
+
+static int idx_fd = -1;
+static char *idx_name = NULL;
+static uint64_t idx_end;      /* where the next records go */
+static strmap entries;
+
+/* The test running now */
+static char *cur_test = NULL;
+static index_record *cur = NULL;
+static long cur_alloc = 0;
+static long cur_count = 0;
+static long cur_last = -1;    /* its length isn't known yet */
+static uint64_t line_offset;
+
+static void
+write_at(const void *buf, size_t len, uint64_t offset)
+{
+    ssize_t ret;
+    const char *p = (const char *)buf;
+
+    while (len > 0) {
+        ret = pwrite(idx_fd, p, len, (off_t)offset);
+        if (ret == -1 && errno == EINTR)
+            continue;
+        if (ret == -1)
+            die(errno, "Failed to write %s", idx_name);
+
+        p += ret;
+        len -= (size_t)ret;
+        offset += (uint64_t)ret;
+    }
+}
+
+/* Returns 0 or errno, EINVAL for a short read */
+static int
+read_at(int fd, void *buf, size_t len, uint64_t offset)
+{
+    ssize_t ret;
+    char *p = (char *)buf;
+
+    while (len > 0) {
+        ret = pread(fd, p, len, (off_t)offset);
+        if (ret == -1 && errno == EINTR)
+            continue;
+        if (ret == -1)
+            return errno;
+        if (ret == 0)
+            return EINVAL;
+
+        p += ret;
+        len -= (size_t)ret;
+        offset += (uint64_t)ret;
+    }
+
+    return 0;
+}
+
+static int
+read_header(int fd, index_header *hdr)
+{
+    int ret;
+
+    ret = read_at(fd, hdr, sizeof(*hdr), 0);
+    if (ret != 0)
+        return ret;
+
+    if (memcmp(hdr->magic, INDEX_MAGIC, sizeof(hdr->magic)) != 0
+            || hdr->dir_offset == 0 || hdr->dir_slots == 0
+            || (hdr->dir_slots & (hdr->dir_slots - 1)) != 0)
+        return EINVAL;
+
+    return 0;
+}
+
+static char*
+index_path(const char *logname)
+{
+    char *ret;
+
+    ret = (char *)malloc(strlen(logname) + sizeof(".idx"));
+    if (ret == NULL)
+        die(errno, "malloc()");
+
+    strcpy(ret, logname);
+    strcat(ret, ".idx");
+    return ret;
+}
+
+static void
+put_entry(const char *name, uint64_t records, uint32_t count)
+{
+    index_entry *entry;
+
+    entry = (index_entry *)strmap_get(&entries, name);
+    if (entry == NULL) {
+        entry = (index_entry *)malloc(sizeof(*entry));
+        if (entry == NULL)
+            die(errno, "malloc()");
+        strmap_put(&entries, name, entry);
+    }
+
+    entry->records = records;
+    entry->count = count;
+}
+
+/* Take over the tests of the index being appended to.
+ * Returns 0 if there's nothing usable in it. */
+static int
+load_index(uint64_t base)
+{
+    uint64_t i;
+    char *name;
+    index_slot slot;
+    index_header hdr;
+
+    if (read_header(idx_fd, &hdr) != 0 || hdr.log_size != base)
+        return 0;
+
+    for (i = 0; i < hdr.dir_slots; ++i) {
+        if (read_at(idx_fd, &slot, sizeof(slot),
+                    hdr.dir_offset + i * sizeof(slot)) != 0)
+            return 0;
+        if (slot.records == 0)
+            continue;
+
+        name = (char *)malloc((size_t)slot.name_len + 1);
+        if (name == NULL)
+            die(errno, "malloc()");
+        if (read_at(idx_fd, name, slot.name_len, slot.name_offset) != 0) {
+            free(name);
+            return 0;
+        }
+        name[slot.name_len] = '\0';
+
+        put_entry(name, slot.records, slot.count);
+        free(name);
+    }
+
+    /* The records stay, the directory is written again at close */
+    idx_end = hdr.dir_offset;
+    return 1;
+}
+
+static void
+free_entry(const char *key, void *value, void *arg)
+{
+    (void)key;
+    (void)arg;
+
+    free(value);
+}
+
+void
+index_open(const char *logname, unsigned long long base, int append)
+{
+    index_header hdr;
+
+    if (idx_fd != -1)
+        index_close();
+
+    idx_name = index_path(logname);
+    strmap_init(&entries);
+    line_offset = base;
+
+    idx_fd = open(idx_name, O_RDWR | O_CREAT | O_CLOEXEC, 0666);
+    if (idx_fd == -1)
+        die(errno, "Failed to open %s", idx_name);
+
+    if (!append || !load_index(base)) {
+        strmap_each(&entries, free_entry, NULL);
+        strmap_fini(&entries);
+        strmap_init(&entries);
+        idx_end = sizeof(hdr);
+    }
+
+    if (ftruncate(idx_fd, (off_t)idx_end) == -1)
+        die(errno, "Failed to truncate %s", idx_name);
+
+    /* Not usable until closed */
+    memset(&hdr, 0, sizeof(hdr));
+    memcpy(hdr.magic, INDEX_MAGIC, sizeof(hdr.magic));
+    write_at(&hdr, sizeof(hdr), 0);
+}
+
+typedef struct {
+    index_slot *slots;
+    uint64_t mask;
+    uint64_t name_offset;
+} dir_state;
+
+static void
+add_slot(const char *key, void *value, void *arg)
+{
+    uint64_t i;
+    size_t len;
+    dir_state *ds = (dir_state *)arg;
+    index_entry *entry = (index_entry *)value;
+    index_slot *slot;
+
+    i = (uint64_t)strmap_hash(key) & ds->mask;
+    while (ds->slots[i].records != 0)
+        i = (i + 1) & ds->mask;
+
+    len = strlen(key);
+    slot = &ds->slots[i];
+    slot->hash = (uint64_t)strmap_hash(key);
+    slot->records = entry->records;
+    slot->name_offset = ds->name_offset;
+    slot->name_len = (uint32_t)len;
+    slot->count = entry->count;
+
+    write_at(key, len, ds->name_offset);
+    ds->name_offset += len;
+}
+
+void
+index_close(void)
+{
+    uint64_t size;
+    dir_state ds;
+    index_header hdr;
+
+    if (idx_fd == -1)
+        return;
+
+    /* At most half full, probes stay short */
+    size = 1;
+    while (size < 2 * (uint64_t)entries.count)
+        size <<= 1;
+
+    ds.slots = (index_slot *)calloc(size, sizeof(index_slot));
+    if (ds.slots == NULL)
+        die(errno, "calloc()");
+    ds.mask = size - 1;
+    ds.name_offset = idx_end + size * sizeof(index_slot);
+
+    strmap_each(&entries, add_slot, &ds);
+    write_at(ds.slots, size * sizeof(index_slot), idx_end);
+    free(ds.slots);
+
+    memset(&hdr, 0, sizeof(hdr));
+    memcpy(hdr.magic, INDEX_MAGIC, sizeof(hdr.magic));
+    hdr.log_size = line_offset;
+    hdr.dir_offset = idx_end;
+    hdr.dir_slots = size;
+    write_at(&hdr, sizeof(hdr), 0);
+
+    close(idx_fd);
+    idx_fd = -1;
+
+    strmap_each(&entries, free_entry, NULL);
+    strmap_fini(&entries);
+    free(idx_name);
+    idx_name = NULL;
+    free(cur_test);
+    cur_test = NULL;
+    free(cur);
+    cur = NULL;
+    cur_alloc = 0;
+}
+
+void
+index_test_begin(const char *test, unsigned long long offset)
+{
+    if (idx_fd == -1)
+        return;
+
+    free(cur_test);
+    cur_test = strdup(test);
+    if (cur_test == NULL)
+        die(errno, "strdup()");
+
+    if (cur_alloc == 0) {
+        cur_alloc = 64;
+        cur = (index_record *)malloc(cur_alloc * sizeof(*cur));
+        if (cur == NULL)
+            die(errno, "malloc()");
+    }
+
+    cur[0].offset = offset;
+    cur[0].len = 0;
+    cur_count = 1;
+    cur_last = -1;
+    line_offset = offset;
+}
+
+void
+index_line(unsigned long long offset)
+{
+    line_offset = offset;
+}
+
+void
+index_assertion(long num)
+{
+    long i;
+
+    if (idx_fd == -1 || cur_test == NULL || num < 1 || num >= INDEX_MAX_TESTS)
+        return;
+
+    if (num >= cur_alloc) {
+        while (cur_alloc <= num)
+            cur_alloc *= 2;
+        cur = (index_record *)realloc(cur, cur_alloc * sizeof(*cur));
+        if (cur == NULL)
+            die(errno, "realloc()");
+    }
+
+    /* Numbers skipped over have no output */
+    for (i = cur_count; i <= num; ++i)
+        cur[i].offset = cur[i].len = 0;
+    if (cur_count <= num)
+        cur_count = num + 1;
+
+    if (cur_last != -1)
+        cur[cur_last].len = line_offset - cur[cur_last].offset;
+
+    cur[num].offset = line_offset;
+    cur[num].len = 0;
+    cur_last = num;
+}
+
+void
+index_test_end(unsigned long long offset)
+{
+    if (idx_fd == -1 || cur_test == NULL)
+        return;
+
+    if (cur_last != -1)
+        cur[cur_last].len = offset - cur[cur_last].offset;
+    cur[0].len = offset - cur[0].offset;
+    line_offset = offset;
+
+    write_at(cur, cur_count * sizeof(*cur), idx_end);
+    put_entry(cur_test, idx_end, (uint32_t)cur_count);
+    idx_end += cur_count * sizeof(*cur);
+
+    free(cur_test);
+    cur_test = NULL;
+}
+
+int
+index_lookup(const char *logname, const char *test, long num,
+             unsigned long long *offset, unsigned long long *len)
+{
+    int fd;
+    int ret;
+    int found = 0;
+    char *path;
+    char *name;
+    uint64_t i;
+    uint64_t hash;
+    uint64_t probes;
+    size_t name_len;
+    index_slot slot;
+    index_header hdr;
+    index_record rec;
+
+    path = index_path(logname);
+    fd = open(path, O_RDONLY | O_CLOEXEC);
+    free(path);
+    if (fd == -1)
+        return errno;
+
+    ret = read_header(fd, &hdr);
+    if (ret != 0)
+        goto out;
+
+    name_len = strlen(test);
+    name = (char *)malloc(name_len + 1);
+    if (name == NULL)
+        die(errno, "malloc()");
+
+    hash = (uint64_t)strmap_hash(test);
+    i = hash & (hdr.dir_slots - 1);
+    for (probes = 0; probes < hdr.dir_slots; ++probes) {
+        ret = read_at(fd, &slot, sizeof(slot), hdr.dir_offset + i * sizeof(slot));
+        if (ret != 0 || slot.records == 0)
+            break;
+
+        if (slot.hash == hash && slot.name_len == name_len) {
+            ret = read_at(fd, name, name_len, slot.name_offset);
+            if (ret != 0)
+                break;
+            if (memcmp(name, test, name_len) == 0) {
+                found = 1;
+                break;
+            }
+        }
+
+        i = (i + 1) & (hdr.dir_slots - 1);
+    }
+    free(name);
+
+    if (!found) {
+        if (ret == 0)
+            ret = ENOENT;
+        goto out;
+    }
+
+    ret = ENOENT;
+    if (num < 0 || (uint64_t)num >= slot.count)
+        goto out;
+
+    ret = read_at(fd, &rec, sizeof(rec), slot.records + (uint64_t)num * sizeof(rec));
+    if (ret != 0)
+        goto out;
+
+    ret = ENOENT;
+    if (rec.len == 0 && num != 0)
+        goto out;
+
+    *offset = rec.offset;
+    *len = rec.len;
+    ret = 0;
+
+out:
+    close(fd);
+    return ret;
+}
+
+/* vim: set ts=4 sw=4 sts=4 expandtab: */
@@ -0,0 +1,40 @@
+#ifndef _H_TEST_INDEX
+#define _H_TEST_INDEX
+
+/* Sidecar index of the -L log, written to <log>.idx next to it.
+ *
+ * For every test run the index has the byte offset and length of
+ * the output of each of its assertions in the log, from the test
+ * line up to the next one, and of the whole test as test number 0.
+ * Looking one up reads a fixed number of small pieces of the index,
+ * however big the log.  The layout is in test_index.c.
+ *
+ * The harness feeds it as the log is written: index_line() is where
+ * the line the parser is about to see starts in the log.
+ */
+
+/* Start the index of logname, whose size is base.  Appending keeps the
+ * tests already in the index if it matches the log.  Dies on errors. */
+extern void index_open(const char *logname, unsigned long long base, int append);
+
+/* Write out the directory of tests and close the index */
+extern void index_close(void);
+
+/* A test starts writing at offset */
+extern void index_test_begin(const char *test, unsigned long long offset);
+
+/* The next line parsed starts at offset */
+extern void index_line(unsigned long long offset);
+
+/* The line just parsed is test num */
+extern void index_assertion(long num);
+
+/* The test's output ended at offset */
+extern void index_test_end(unsigned long long offset);
+
+/* Find test num of test (0 for all of it) in the index of logname.
+ * Returns 0 or errno, ENOENT when it isn't in the index. */
+extern int index_lookup(const char *logname, const char *test, long num,
+                        unsigned long long *offset, unsigned long long *len);
+
+#endif /* _H_TEST_INDEX */
@@ -1,73 +1,469 @@
+/* O_DIRECT */
+#define _GNU_SOURCE
+
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <signal.h>
 #include <stdarg.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
 
 #include "test_log.h"
 
-static FILE* logfile = NULL;
+/* Bytes queued between the harness and the writer thread */
+#define LOG_RING_SZ (1024 * 1024)
+
+/* Largest single write, and what O_DIRECT writes are aligned to */
+#define LOG_WRITE_SZ (256 * 1024)
+#define LOG_BLOCK 4096
+
+/* Single producer (the harness), single consumer (the writer).
+ * head and tail only grow, they're taken modulo LOG_RING_SZ.
+ * Bytes between tail and head haven't been written yet. */
+static struct {
+	char *data;
+	size_t head;
+	size_t tail;
+} ring;
+
+static int logfd = -1;
+static int owned = 0;  /* logfd is ours to close */
+static int direct = 0; /* logfd has O_DIRECT */
+static int no_splice = 0; /* splicing into logfd failed */
+static pid_t owner = -1;
+
+/* Size of the log file with everything put or spliced so far */
+static unsigned long long logged = 0;
+
+static char *wbuf = NULL;
+static pthread_t writer;
+
+/* Only used to sleep, the ring itself is lock free */
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t data_cond = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t space_cond = PTHREAD_COND_INITIALIZER;
+static int writer_sleeping = 0;
+static int producer_waiting = 0;
+static int stopping = 0;
+
+static const int crash_signals[] = { SIGSEGV, SIGBUS, SIGILL, SIGFPE, SIGABRT };
+#define crash_signals_len (sizeof(crash_signals)/sizeof(int))
+
+static void
+write_all(const char *str, size_t len)
+{
+	ssize_t ret;
+
+	while (len > 0) {
+		ret = write(logfd, str, len);
+		if (ret == -1) {
+			if (errno == EINTR)
+				continue;
+			/* Nothing sensible to do about a failing log */
+			return;
+		}
+
+		str += ret;
+		len -= (size_t)ret;
+	}
+}
+
+/* Copy n bytes starting at pos out of the ring */
+static void
+ring_copy(char *dst, size_t pos, size_t n)
+{
+	size_t off = pos % LOG_RING_SZ;
+	size_t first = LOG_RING_SZ - off;
+
+	if (first > n)
+		first = n;
+
+	memcpy(dst, ring.data + off, first);
+	memcpy(dst + first, ring.data, n - first);
+}
+
+static void
+drop_direct(void)
+{
+	int flags;
+
+	if (!direct)
+		return;
+
+	/* The tail isn't a whole block */
+	flags = fcntl(logfd, F_GETFL);
+	if (flags != -1)
+		fcntl(logfd, F_SETFL, flags & ~O_DIRECT);
+	direct = 0;
+}
+
+static void*
+writer_main(void *arg)
+{
+	size_t n;
+	size_t head;
+	size_t tail;
+	int stop;
+
+	(void)arg;
+
+	for (;;) {
+		head = __atomic_load_n(&ring.head, __ATOMIC_SEQ_CST);
+		tail = ring.tail;
+		stop = __atomic_load_n(&stopping, __ATOMIC_SEQ_CST);
+
+		n = head - tail;
+		if (n > LOG_WRITE_SZ)
+			n = LOG_WRITE_SZ;
+		/* O_DIRECT only takes whole blocks, the rest waits */
+		if (direct && !stop)
+			n -= n % LOG_BLOCK;
+
+		if (n == 0) {
+			if (stop)
+				break;
+
+			pthread_mutex_lock(&lock);
+			__atomic_store_n(&writer_sleeping, 1, __ATOMIC_SEQ_CST);
+			if (__atomic_load_n(&ring.head, __ATOMIC_SEQ_CST) == head
+					&& !__atomic_load_n(&stopping, __ATOMIC_SEQ_CST)) {
+				pthread_cond_wait(&data_cond, &lock);
+			}
+			__atomic_store_n(&writer_sleeping, 0, __ATOMIC_SEQ_CST);
+			pthread_mutex_unlock(&lock);
+			continue;
+		}
+
+		if (direct && stop)
+			drop_direct();
+
+		ring_copy(wbuf, tail, n);
+		write_all(wbuf, n);
+
+		/* Only now is the space free, a crash before this
+		 * writes these bytes again rather than losing them */
+		__atomic_store_n(&ring.tail, tail + n, __ATOMIC_SEQ_CST);
+
+		if (__atomic_load_n(&producer_waiting, __ATOMIC_SEQ_CST)) {
+			pthread_mutex_lock(&lock);
+			pthread_cond_signal(&space_cond);
+			pthread_mutex_unlock(&lock);
+		}
+	}
+
+	return NULL;
+}
+
+static void
+wake_writer(void)
+{
+	pthread_mutex_lock(&lock);
+	pthread_cond_signal(&data_cond);
+	pthread_mutex_unlock(&lock);
+}
+
+/* Write what's left straight from the ring and die of the signal */
+static void
+crash_handler(int sig)
+{
+	size_t n;
+	size_t off;
+	size_t head;
+	size_t tail;
+
+	if (logfd != -1 && getpid() == owner) {
+		drop_direct();
+
+		head = __atomic_load_n(&ring.head, __ATOMIC_SEQ_CST);
+		tail = __atomic_load_n(&ring.tail, __ATOMIC_SEQ_CST);
+		while (tail != head) {
+			off = tail % LOG_RING_SZ;
+			n = LOG_RING_SZ - off;
+			if (n > head - tail)
+				n = head - tail;
+			write_all(ring.data + off, n);
+			tail += n;
+		}
+	}
+
+	signal(sig, SIG_DFL);
+	raise(sig);
+}
+
+static void
+log_exit(void)
+{
+	log_close();
+}
+
+static int
+open_file(const char *filename, int flags)
+{
+	int fd;
+	int oflags;
+
+	oflags = O_WRONLY | O_CREAT | O_CLOEXEC;
+	oflags |= (flags & LOG_APPEND) ? O_APPEND : O_TRUNC;
+
+	if (flags & LOG_DIRECT) {
+		fd = open(filename, oflags | O_DIRECT, 0666);
+		if (fd != -1) {
+			struct stat sb;
+
+			/* Appending has to start on a block boundary */
+			if (fstat(fd, &sb) == 0 && sb.st_size % LOG_BLOCK == 0) {
+				direct = 1;
+				return fd;
+			}
+
+			close(fd);
+		}
+		/* Not supported here (tmpfs for one), go without */
+	}
+
+	return open(filename, oflags, 0666);
+}
 
 int
-log_open(const char *filename, int append)
+log_open(const char *filename, int flags)
 {
-	if (logfile != NULL)
+	int ret;
+	size_t i;
+	sigset_t all;
+	sigset_t old;
+	struct sigaction sa;
+	static int registered = 0;
+
+	if (logfd != -1)
 		log_close();
 
-	if (strcmp(filename, "stdout") == 0) {
-		logfile = stdout;
-		return 0;
+	direct = 0;
+	owned = 0;
+	no_splice = 0;
+
+	if (strcmp(filename, "stdout") == 0)
+		logfd = STDOUT_FILENO;
+	else if (strcmp(filename, "stderr") == 0)
+		logfd = STDERR_FILENO;
+	else {
+		logfd = open_file(filename, flags);
+		owned = 1;
+	}
+
+	if (logfd == -1)
+		return 1;
+
+	logged = 0;
+	if (owned && (flags & LOG_APPEND)) {
+		struct stat sb;
+
+		if (fstat(logfd, &sb) == 0)
+			logged = (unsigned long long)sb.st_size;
+	}
+
+	ring.head = ring.tail = 0;
+	stopping = 0;
+	if (ring.data == NULL) {
+		ring.data = (char *)malloc(LOG_RING_SZ);
+		if (ring.data == NULL)
+			goto fail;
+	}
+
+	if (wbuf == NULL && posix_memalign((void **)&wbuf, LOG_BLOCK, LOG_WRITE_SZ) != 0)
+		goto fail;
+
+	owner = getpid();
+
+	/* Signals are for the harness, not the writer */
+	sigfillset(&all);
+	pthread_sigmask(SIG_SETMASK, &all, &old);
+	ret = pthread_create(&writer, NULL, writer_main, NULL);
+	pthread_sigmask(SIG_SETMASK, &old, NULL);
+
+	if (ret != 0) {
+		errno = ret;
+		goto fail;
 	}
 
-	if (strcmp(filename, "stderr") == 0) {
-		logfile = stderr;
-		return 0;
+	if (!registered) {
+		memset(&sa, 0, sizeof(sa));
+		sa.sa_handler = crash_handler;
+		sa.sa_flags = SA_RESETHAND;
+		sigemptyset(&sa.sa_mask);
+		for (i = 0; i < crash_signals_len; ++i)
+			sigaction(crash_signals[i], &sa, NULL);
+
+		atexit(log_exit);
+		registered = 1;
 	}
 
-	if (append)
-		logfile = fopen(filename, "a");
-	else
-		logfile = fopen(filename, "w");
+	return 0;
 
-	/* 0 if ! NULL */
-	return (logfile == NULL);
+fail:
+	ret = errno;
+	if (owned)
+		close(logfd);
+	logfd = -1;
+	errno = ret;
+	return 1;
 }
 
 void
 log_close(void)
 {
-	if (logfile == NULL)
+	if (logfd == -1)
 		return;
 
-	if (logfile == stdout)
+	/* A forked child only has this thread, just let go of the fd */
+	if (getpid() != owner) {
+		if (owned)
+			close(logfd);
+		logfd = -1;
 		return;
+	}
+
+	__atomic_store_n(&stopping, 1, __ATOMIC_SEQ_CST);
+	wake_writer();
+	pthread_join(writer, NULL);
 
-	if (logfile == stderr)
+	if (owned)
+		close(logfd);
+	logfd = -1;
+}
+
+void
+log_put(const char *str, size_t len)
+{
+	size_t n;
+	size_t off;
+	size_t head;
+	size_t space;
+
+	if (logfd == -1)
 		return;
 
-	fclose(logfile);
-	logfile = NULL;
+	logged += len;
+	head = ring.head;
+	while (len > 0) {
+		space = LOG_RING_SZ - (head - __atomic_load_n(&ring.tail, __ATOMIC_SEQ_CST));
+		if (space == 0) {
+			/* Full, wait for the writer to catch up */
+			pthread_mutex_lock(&lock);
+			__atomic_store_n(&producer_waiting, 1, __ATOMIC_SEQ_CST);
+			pthread_cond_signal(&data_cond);
+			if (__atomic_load_n(&ring.tail, __ATOMIC_SEQ_CST) + LOG_RING_SZ == head)
+				pthread_cond_wait(&space_cond, &lock);
+			__atomic_store_n(&producer_waiting, 0, __ATOMIC_SEQ_CST);
+			pthread_mutex_unlock(&lock);
+			continue;
+		}
+
+		n = (len < space) ? len : space;
+		off = head % LOG_RING_SZ;
+		if (n > LOG_RING_SZ - off)
+			n = LOG_RING_SZ - off;
+
+		memcpy(ring.data + off, str, n);
+		head += n;
+		str += n;
+		len -= n;
+
+		__atomic_store_n(&ring.head, head, __ATOMIC_SEQ_CST);
+	}
+
+	if (__atomic_load_n(&writer_sleeping, __ATOMIC_SEQ_CST))
+		wake_writer();
 }
 
 void
 log_write(const char *fmt, ...)
 {
+	int len;
+	char small[512];
+	char *str;
 	va_list vargs;
 
-	if (logfile == NULL)
+	if (logfd == -1)
 		return;
 
 	va_start(vargs, fmt);
-	vfprintf(logfile, fmt, vargs);
+	len = vsnprintf(small, sizeof(small), fmt, vargs);
 	va_end(vargs);
 
-	fflush(logfile);
+	if (len < 0)
+		return;
+
+	if ((size_t)len < sizeof(small)) {
+		log_put(small, (size_t)len);
+		return;
+	}
+
+	str = (char *)malloc((size_t)len + 1);
+	if (str == NULL)
+		return;
+
+	va_start(vargs, fmt);
+	vsnprintf(str, (size_t)len + 1, fmt, vargs);
+	va_end(vargs);
+
+	log_put(str, (size_t)len);
+	free(str);
 }
 
 void
 log_writeln(const char *str)
 {
-	if (logfile == NULL)
-		return;
+	log_put(str, strlen(str));
+	log_put("\n", 1);
+}
+
+/* Wait for the writer to empty the ring */
+static void
+log_drain(void)
+{
+	while (__atomic_load_n(&ring.tail, __ATOMIC_SEQ_CST) != ring.head) {
+		pthread_mutex_lock(&lock);
+		__atomic_store_n(&producer_waiting, 1, __ATOMIC_SEQ_CST);
+		pthread_cond_signal(&data_cond);
+		if (__atomic_load_n(&ring.tail, __ATOMIC_SEQ_CST) != ring.head)
+			pthread_cond_wait(&space_cond, &lock);
+		__atomic_store_n(&producer_waiting, 0, __ATOMIC_SEQ_CST);
+		pthread_mutex_unlock(&lock);
+	}
+}
 
-	fprintf(logfile, "%s\n", str);
-	fflush(logfile);
+int
+log_splice_fd(void)
+{
+	/* O_DIRECT wants aligned writes, splice doesn't do that */
+	if (logfd == -1 || direct || no_splice)
+		return -1;
+
+	/* Anything queued has to land first */
+	log_drain();
+	return logfd;
+}
+
+void
+log_splice_failed(void)
+{
+	no_splice = 1;
+}
+
+void
+log_spliced(size_t len)
+{
+	logged += len;
+}
+
+unsigned long long
+log_offset(void)
+{
+	return logged;
 }
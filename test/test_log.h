@@ -1,10 +1,33 @@
 #ifndef _H_TEST_LOG
 #define _H_TEST_LOG
 
-extern int log_open(const char *file, int append);
+#include <stddef.h>
+
+/* log_open flags */
+#define LOG_APPEND 1 /* append to the log instead of truncating it */
+#define LOG_DIRECT 2 /* write with O_DIRECT where the file system allows */
+
+/* Writes to the log are queued in a ring and written out by a
+ * writer thread, log_close (also run at exit) waits for them. */
+extern int log_open(const char *file, int flags);
 extern void log_close(void);
 
 extern void log_write(const char *fmt, ...);
 extern void log_writeln(const char *str);
+extern void log_put(const char *str, size_t len);
+
+/* An fd raw output can be spliced into, -1 when it has to go through
+ * log_put().  Everything put before is written when this returns. */
+extern int log_splice_fd(void);
+
+/* Splicing into the fd didn't work, don't offer it again */
+extern void log_splice_failed(void);
+
+/* len bytes were spliced into log_splice_fd() */
+extern void log_spliced(size_t len);
+
+/* Where the next byte goes in the log file, counting what's still
+ * queued.  Appending starts at the size the file had. */
+extern unsigned long long log_offset(void);
 
 #endif /* _H_TEST_LOG */
@@ -0,0 +1,492 @@
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "tap_parser.h"
+#include "test_utils.h"
+#include "test_results.h"
+#include "test_report.h"
+
+static test_reporter *reporters = NULL;
+static const ttr_node *current = NULL;
+
+/* Helpers */
+
+static FILE*
+report_open(const char *filename)
+{
+    FILE *file;
+
+    if (strcmp(filename, "-") == 0)
+        return stdout;
+
+    file = fopen(filename, "w");
+    if (file == NULL)
+        die(errno, "Failed to open %s", filename);
+
+    return file;
+}
+
+static void
+report_close(FILE *file)
+{
+    if (file == stdout)
+        fflush(file);
+    else
+        fclose(file);
+}
+
+static test_reporter*
+report_new(const char *filename)
+{
+    test_reporter *r;
+
+    r = (test_reporter *)calloc(1, sizeof(*r));
+    if (r == NULL)
+        die(errno, "calloc(test_reporter)");
+
+    r->file = report_open(filename);
+    return r;
+}
+
+static const char*
+type_name(enum tap_test_type type)
+{
+    switch (type) {
+    case TTT_OK:
+        return "ok";
+    case TTT_NOT_OK:
+        return "not_ok";
+    case TTT_TODO:
+        return "todo";
+    case TTT_TODO_PASSED:
+        return "todo_passed";
+    case TTT_SKIP:
+        return "skip";
+    case TTT_SKIP_FAILED:
+        return "skip_failed";
+    case TTT_INVALID:
+        break;
+    }
+
+    return "missing";
+}
+
+/* Overall status of a test, same rules as the console */
+static const char*
+test_status(const report_test *rt)
+{
+    if (rt->node->aborted)
+        return "aborted";
+
+    if (rt->node->status != 0 || rt->failed || rt->tests_run < rt->plan)
+        return "failed";
+
+    if (rt->plan == 0)
+        return "skipped";
+
+    return "passed";
+}
+
+/* A planned assertion that never showed up */
+static inline int
+assertion_missing(const tap_results *tr, long num)
+{
+    long first;
+    long end;
+
+    /* Nothing is known about what a stream (--window) let go of */
+    tap_results_range(tr, &first, &end);
+    if (tr != NULL && tr->recent_end > 0 && num < first)
+        return 0;
+
+    return tap_results_get(tr, num) == TTT_INVALID;
+}
+
+static void
+xml_escape(FILE *file, const char *str)
+{
+    for (; *str != '\0'; ++str) {
+        switch (*str) {
+        case '<':
+            fputs("&lt;", file);
+            break;
+        case '>':
+            fputs("&gt;", file);
+            break;
+        case '&':
+            fputs("&amp;", file);
+            break;
+        case '"':
+            fputs("&quot;", file);
+            break;
+        case '\n':
+            fputs("&#10;", file);
+            break;
+        default:
+            /* Control characters aren't allowed in XML 1.0 */
+            if ((unsigned char)*str < 0x20 && *str != '\t')
+                fputc('?', file);
+            else
+                fputc(*str, file);
+            break;
+        }
+    }
+}
+
+static void
+json_string(FILE *file, const char *str)
+{
+    if (str == NULL) {
+        fputs("null", file);
+        return;
+    }
+
+    fputc('"', file);
+    for (; *str != '\0'; ++str) {
+        switch (*str) {
+        case '"':
+            fputs("\\\"", file);
+            break;
+        case '\\':
+            fputs("\\\\", file);
+            break;
+        case '\n':
+            fputs("\\n", file);
+            break;
+        case '\r':
+            fputs("\\r", file);
+            break;
+        case '\t':
+            fputs("\\t", file);
+            break;
+        default:
+            if ((unsigned char)*str < 0x20)
+                fprintf(file, "\\u%04x", (unsigned char)*str);
+            else
+                fputc(*str, file);
+            break;
+        }
+    }
+    fputc('"', file);
+}
+
+/* JUnit XML
+ *
+ * The counts of a <testsuite> have to come before its testcases, so
+ * the testcases of the running test are spooled to a temporary file
+ * and copied out once the test is done. */
+
+struct junit_data {
+    FILE *spool;
+    long tests;
+    long failures;
+    long skipped;
+};
+
+static void
+junit_testcase(struct junit_data *jd, const ttr_node *node, long num,
+               const char *reason)
+{
+    fprintf(jd->spool, "    <testcase classname=\"");
+    xml_escape(jd->spool, node->file);
+    fprintf(jd->spool, "\" name=\"%ld", num);
+    if (reason != NULL) {
+        fputs(" - ", jd->spool);
+        xml_escape(jd->spool, reason);
+    }
+    fputc('"', jd->spool);
+
+    jd->tests++;
+}
+
+static void
+junit_begin_test(test_reporter *r, const ttr_node *node)
+{
+    struct junit_data *jd = (struct junit_data *)r->data;
+
+    (void)node;
+
+    rewind(jd->spool);
+    if (ftruncate(fileno(jd->spool), 0) == -1)
+        die(errno, "ftruncate(junit spool)");
+
+    jd->tests = jd->failures = jd->skipped = 0;
+}
+
+static void
+junit_assertion(test_reporter *r, const ttr_node *node,
+                const tap_test_result *ttr)
+{
+    const char *kind;
+    struct junit_data *jd = (struct junit_data *)r->data;
+
+    junit_testcase(jd, node, ttr->test_num, ttr->reason);
+
+    switch (ttr->type) {
+    case TTT_OK:
+        fputs("/>\n", jd->spool);
+        return;
+    case TTT_TODO:
+    case TTT_SKIP:
+        kind = "skipped";
+        jd->skipped++;
+        break;
+    default:
+        kind = "failure";
+        jd->failures++;
+        break;
+    }
+
+    fprintf(jd->spool, ">\n      <%s message=\"%s", kind, type_name(ttr->type));
+    if (ttr->directive != NULL) {
+        fputs(": ", jd->spool);
+        xml_escape(jd->spool, ttr->directive);
+    }
+    fprintf(jd->spool, "\"/>\n    </testcase>\n");
+}
+
+static void
+junit_end_test(test_reporter *r, const report_test *rt)
+{
+    long i;
+    int c;
+    long errors;
+    const ttr_node *node = rt->node;
+    const tap_results *tr = node->tr;
+    struct junit_data *jd = (struct junit_data *)r->data;
+
+    for (i = 1; !node->cached && i <= rt->plan; ++i) {
+        if (!assertion_missing(tr, i))
+            continue;
+        junit_testcase(jd, node, i, NULL);
+        fputs(">\n      <failure message=\"missing\"/>\n    </testcase>\n",
+              jd->spool);
+        jd->failures++;
+    }
+
+    errors = 0;
+    if (node->aborted) {
+        fprintf(jd->spool, "    <testcase classname=\"");
+        xml_escape(jd->spool, node->file);
+        fprintf(jd->spool, "\" name=\"harness\">\n      <error message=\"");
+        xml_escape(jd->spool, rt->verdict);
+        fprintf(jd->spool, "\"/>\n    </testcase>\n");
+        errors = 1;
+    }
+
+    fprintf(r->file, "  <testsuite name=\"");
+    xml_escape(r->file, node->file);
+    fprintf(r->file, "\" tests=\"%ld\" failures=\"%ld\" errors=\"%ld\" "
+                     "skipped=\"%ld\" time=\"%.6f\">\n",
+            jd->tests + errors,
+            jd->failures, errors, jd->skipped, node->duration);
+
+    /* Reported from the result store, the assertions weren't seen */
+    if (node->cached) {
+        fprintf(r->file, "    <properties><property name=\"cached\" "
+                         "value=\"true\"/></properties>\n");
+    }
+
+    rewind(jd->spool);
+    while ((c = getc(jd->spool)) != EOF)
+        putc(c, r->file);
+
+    fprintf(r->file, "  </testsuite>\n");
+    fflush(r->file);
+}
+
+static void
+junit_finish(test_reporter *r, const test_results *tsr)
+{
+    struct junit_data *jd = (struct junit_data *)r->data;
+
+    (void)tsr;
+
+    fprintf(r->file, "</testsuites>\n");
+    report_close(r->file);
+    fclose(jd->spool);
+    free(jd);
+}
+
+test_reporter*
+report_junit_new(const char *filename)
+{
+    test_reporter *r;
+    struct junit_data *jd;
+
+    r = report_new(filename);
+
+    jd = (struct junit_data *)calloc(1, sizeof(*jd));
+    if (jd == NULL)
+        die(errno, "calloc(junit_data)");
+
+    jd->spool = tmpfile();
+    if (jd->spool == NULL)
+        die(errno, "tmpfile()");
+
+    r->data = jd;
+    r->begin_test = junit_begin_test;
+    r->assertion = junit_assertion;
+    r->end_test = junit_end_test;
+    r->finish = junit_finish;
+
+    fprintf(r->file, "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n");
+    fprintf(r->file, "<testsuites>\n");
+    fflush(r->file);
+
+    return r;
+}
+
+/* JSON Lines, one object per line as things happen */
+
+static void
+jsonl_begin_test(test_reporter *r, const ttr_node *node)
+{
+    fputs("{\"type\":\"test_start\",\"file\":", r->file);
+    json_string(r->file, node->file);
+    fputs("}\n", r->file);
+}
+
+static void
+jsonl_assertion(test_reporter *r, const ttr_node *node,
+                const tap_test_result *ttr)
+{
+    fputs("{\"type\":\"assertion\",\"file\":", r->file);
+    json_string(r->file, node->file);
+    fprintf(r->file, ",\"number\":%ld,\"status\":\"%s\",\"reason\":",
+            ttr->test_num, type_name(ttr->type));
+    json_string(r->file, ttr->reason);
+    fputs(",\"directive\":", r->file);
+    json_string(r->file, ttr->directive);
+    fputs("}\n", r->file);
+}
+
+static void
+jsonl_end_test(test_reporter *r, const report_test *rt)
+{
+    long i;
+    const ttr_node *node = rt->node;
+    const tap_results *tr = node->tr;
+
+    for (i = 1; !node->cached && i <= rt->plan; ++i) {
+        if (!assertion_missing(tr, i))
+            continue;
+        fputs("{\"type\":\"assertion\",\"file\":", r->file);
+        json_string(r->file, node->file);
+        fprintf(r->file, ",\"number\":%ld,\"status\":\"missing\","
+                         "\"reason\":null,\"directive\":null}\n", i);
+    }
+
+    fputs("{\"type\":\"test_end\",\"file\":", r->file);
+    json_string(r->file, node->file);
+    fprintf(r->file, ",\"status\":\"%s\",\"verdict\":", test_status(rt));
+    json_string(r->file, rt->verdict);
+    fprintf(r->file, ",\"plan\":%ld,\"tests_run\":%ld,\"failed\":%ld,"
+                     "\"skipped\":%ld,\"todo\":%ld,\"exit_status\":%d,"
+                     "\"duration\":%.6f,\"cached\":%s}\n",
+            rt->plan, rt->tests_run, rt->failed, rt->skipped, rt->todo,
+            node->status, node->duration, node->cached ? "true" : "false");
+    fflush(r->file);
+}
+
+static void
+jsonl_finish(test_reporter *r, const test_results *tsr)
+{
+    fprintf(r->file, "{\"type\":\"summary\",\"tests\":%lu,\"tests_run\":%ld,"
+                     "\"failed\":%ld,\"skipped\":%ld,\"todo\":%ld,"
+                     "\"aborted\":%ld,\"parse_errors\":%ld}\n",
+            (unsigned long)tsr->len, tsr->total_tests_run, tsr->total_failed,
+            tsr->total_skipped, tsr->total_todo, tsr->total_aborted,
+            tsr->total_parse_errors);
+    report_close(r->file);
+}
+
+test_reporter*
+report_jsonl_new(const char *filename)
+{
+    test_reporter *r;
+
+    r = report_new(filename);
+
+    r->begin_test = jsonl_begin_test;
+    r->assertion = jsonl_assertion;
+    r->end_test = jsonl_end_test;
+    r->finish = jsonl_finish;
+
+    return r;
+}
+
+/* Dispatch */
+
+void
+report_add(test_reporter *r)
+{
+    test_reporter **tail;
+
+    /* Keep them in the order they were given */
+    for (tail = &reporters; *tail != NULL; tail = &(*tail)->next)
+        ;
+
+    r->next = NULL;
+    *tail = r;
+}
+
+int
+report_enabled(void)
+{
+    return reporters != NULL;
+}
+
+void
+report_begin_test(const ttr_node *node)
+{
+    test_reporter *r;
+
+    current = node;
+    for (r = reporters; r != NULL; r = r->next)
+        r->begin_test(r, node);
+}
+
+void
+report_assertion(const tap_test_result *ttr)
+{
+    test_reporter *r;
+
+    /* Only tests run from a list are reported */
+    if (current == NULL)
+        return;
+
+    for (r = reporters; r != NULL; r = r->next)
+        r->assertion(r, current, ttr);
+}
+
+void
+report_end_test(const report_test *rt)
+{
+    test_reporter *r;
+
+    for (r = reporters; r != NULL; r = r->next)
+        r->end_test(r, rt);
+
+    current = NULL;
+}
+
+void
+report_finish(const test_results *tsr)
+{
+    test_reporter *r;
+    test_reporter *next;
+
+    for (r = reporters; r != NULL; r = next) {
+        next = r->next;
+        r->finish(r, tsr);
+        free(r);
+    }
+
+    reporters = NULL;
+}
+
+/* vim: set ts=4 sw=4 sws=4 expandtab: */
@@ -0,0 +1,55 @@
+#ifndef _H_TEST_REPORT
+#define _H_TEST_REPORT
+
+#include <stdio.h>
+
+#include "tap_parser.h"
+#include "test_results.h"
+
+/* What a reporter gets told when a test finishes */
+typedef struct {
+    const ttr_node *node;
+    const char *verdict; /* cooked result line, without the newline */
+    long plan;
+    long tests_run;
+    long failed;
+    long skipped;
+    long todo;
+} report_test;
+
+struct _test_reporter;
+typedef struct _test_reporter test_reporter;
+
+/* Reporters stream records as tests run, they must not hold on to
+ * anything that grows with the number of tests or assertions. */
+struct _test_reporter {
+    /* Before a test runs (or is reported from the result store) */
+    void (*begin_test)(test_reporter *r, const ttr_node *node);
+    /* For every assertion of the running test */
+    void (*assertion)(test_reporter *r, const ttr_node *node,
+                      const tap_test_result *ttr);
+    /* After a test finished and its results were cooked */
+    void (*end_test)(test_reporter *r, const report_test *rt);
+    /* After the list is done, the reporter is freed after this */
+    void (*finish)(test_reporter *r, const test_results *tsr);
+
+    FILE *file;
+    void *data;
+    test_reporter *next;
+};
+
+/* Create a reporter writing to filename, dies on failure */
+extern test_reporter* report_junit_new(const char *filename);
+extern test_reporter* report_jsonl_new(const char *filename);
+
+/* Add a reporter, every added reporter sees every event */
+extern void report_add(test_reporter *r);
+extern int report_enabled(void);
+
+extern void report_begin_test(const ttr_node *node);
+extern void report_assertion(const tap_test_result *ttr);
+extern void report_end_test(const report_test *rt);
+extern void report_finish(const test_results *tsr);
+
+#endif /* _H_TEST_REPORT */
+/* vim: set ts=4 sw=4 sws=4 expandtab: */
@@ -7,48 +7,42 @@
 #include "test_results.h"
 #include "tap_parser.h"
 
-ttr_node*
-ttr_node_new(void)
-{
-    ttr_node *ret = (ttr_node *)malloc(sizeof(*ret));
-    if (ret == NULL)
-        die(errno, "malloc(ttr_node)");
-
-    memset(ret, 0, sizeof(*ret));
+/* Size of a string block, bigger strings get a block of their own */
+#define TTR_STRINGS_BLOCK (64 * 1024)
 
-    return ret;
-}
+/* Initial number of nodes */
+#define TTR_NODES_INITIAL 64
 
-void
-ttr_node_delete(ttr_node *n)
+const char*
+test_results_strdup(test_results *tsr, const char *str)
 {
-    if (n->file)
-        free(n->file);
-
-    if (n->path)
-        free(n->path);
+    char *ret;
+    size_t len;
+    size_t size;
+    struct _ttr_strings *block;
 
-    if (n->tr)
-        free(n->tr);
+    len = strlen(str) + 1;
+    block = tsr->strings;
 
-    free(n);
-}
+    if (block == NULL || block->size - block->used < len) {
+        size = (len > TTR_STRINGS_BLOCK) ? len : TTR_STRINGS_BLOCK;
 
-static inline ttr_node*
-ttr_node_walk(ttr_node *n)
-{
-    ttr_node *cur;
+        block = (struct _ttr_strings *)malloc(sizeof(*block) + size);
+        if (block == NULL)
+            die(errno, "malloc(ttr_strings)");
 
-    cur = n;
-    n = n->next;
-    while (n != NULL) {
-        cur = n;
-        n = n->next;
+        block->used = 0;
+        block->size = size;
+        block->next = tsr->strings;
+        tsr->strings = block;
     }
 
-    return cur;
-}
+    ret = &block->data[block->used];
+    memcpy(ret, str, len);
+    block->used += len;
 
+    return ret;
+}
 
 void
 test_results_init(test_results *tsr)
@@ -59,39 +53,75 @@ test_results_init(test_results *tsr)
 void
 test_results_fini(test_results *tsr)
 {
-    if (tsr->root != NULL) {
-        ttr_node *next, *cur;
-        cur = tsr->root;
-        next = cur->next;
-        while (next != NULL) {
-            ttr_node_delete(cur);
-            cur = next;
-            next = cur->next;
-        }
-        ttr_node_delete(cur);
+    size_t i;
+    struct _ttr_strings *block;
+    struct _ttr_strings *next;
+
+    for (i = 0; i < tsr->len; ++i) {
+        if (tsr->nodes[i].tr)
+            tap_results_fini(tsr->nodes[i].tr);
+        if (tsr->nodes[i].err)
+            stderr_free(tsr->nodes[i].err);
+    }
+
+    if (tsr->nodes != NULL)
+        free(tsr->nodes);
+
+    for (block = tsr->strings; block != NULL; block = next) {
+        next = block->next;
+        free(block);
     }
+
+    memset(tsr, 0, sizeof(*tsr));
 }
 
-void
-test_results_push(test_results *tsr, ttr_node *n)
+size_t
+test_results_add(test_results *tsr, const char *file, const char *path)
 {
-    if (tsr->root == NULL) {
-        tsr->root = n;
-        tsr->top = ttr_node_walk(n);
-        return;
-    }
+    ttr_node *n;
+    size_t cap;
 
-    if (tsr->top != NULL) {
-        tsr->top->next = n;
-        tsr->top = ttr_node_walk(n);
-        return;
+    if (tsr->len == tsr->cap) {
+        cap = (tsr->cap == 0) ? TTR_NODES_INITIAL : tsr->cap * 2;
+
+        n = (ttr_node *)realloc(tsr->nodes, cap * sizeof(ttr_node));
+        if (n == NULL)
+            die(errno, "realloc(ttr_node)");
+
+        tsr->nodes = n;
+        tsr->cap = cap;
     }
 
-    /* If we here someone was stupid... (probably me) */
-    tsr->top = ttr_node_walk(tsr->root);
-    tsr->top-> next = n;
-    tsr->top = ttr_node_walk(n);
+    n = &tsr->nodes[tsr->len];
+    memset(n, 0, sizeof(*n));
+
+    n->file = test_results_strdup(tsr, file);
+    n->path = test_results_strdup(tsr, path);
+
+    return tsr->len++;
 }
 
+void
+test_results_filter(test_results *tsr, const char *keep)
+{
+    size_t i;
+    size_t len;
+
+    len = 0;
+    for (i = 0; i < tsr->len; ++i) {
+        if (keep[i]) {
+            tsr->nodes[len++] = tsr->nodes[i];
+            continue;
+        }
+
+        if (tsr->nodes[i].tr)
+            tap_results_fini(tsr->nodes[i].tr);
+        if (tsr->nodes[i].err)
+            stderr_free(tsr->nodes[i].err);
+    }
+
+    /* Strings of the dropped nodes stay in the arena until fini */
+    tsr->len = len;
+}
 
 /* vim: set ts=4 sw=4 sws=4 expandtab: */
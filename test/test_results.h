@@ -1,19 +1,38 @@
 #ifndef _H_TEST_RESULTS
 #define _H_TEST_RESULTS
 
+#include <stddef.h>
+
 #include "tap_parser.h"
+#include "test_stderr.h"
 
+/* One test from the list.  Records live in one array in the
+ * test_results and are addressed by their position in the list. */
 struct _ttr_node {
-    char *file;  /* filename of the test */
-    char *path;  /* path to the test */
+    const char *file;  /* filename of the test, in the string arena */
+    const char *path;  /* path to the test, in the string arena */
     int aborted; /* did we abort? */
     int status;  /* status after running the test */
     int child_status; /* child status from waitpid */
+    int cached;  /* reported from the result store, not run */
+    int timed_out; /* killed for running too long */
+    double timeout;  /* from the list, < 0 when not given */
+    int ring;        /* "ring" in the list */
+    double duration; /* wall clock seconds */
     tap_results *tr;
-    struct _ttr_node *next;
+    test_stderr *err; /* captured stderr with -e, kept for failing tests */
 };
 typedef struct _ttr_node ttr_node;
 
+/* Strings are carved out of large blocks, they stay put
+ * and are all released with the test_results. */
+struct _ttr_strings {
+    struct _ttr_strings *next;
+    size_t used;
+    size_t size;
+    char data[];
+};
+
 typedef struct {
     long total_tests_run;
     long total_failed;
@@ -23,16 +42,26 @@ typedef struct {
     long total_parse_errors;
 
     tap_parser *tp;
-    ttr_node *root;
-    ttr_node *top;
-} test_results;
 
-extern ttr_node* ttr_node_new(void);
-extern void ttr_node_delete(ttr_node *n);
+    ttr_node *nodes; /* The list, in order */
+    size_t len;      /* Number of nodes in use */
+    size_t cap;      /* Number of nodes allocated */
+
+    struct _ttr_strings *strings;
+} test_results;
 
 extern void test_results_init(test_results *tsr);
 extern void test_results_fini(test_results *tsr);
-extern void test_results_push(test_results *tsr, ttr_node *n);
+
+/* Append a test, file and path are copied into the arena.
+ * Returns the index of the new node. */
+extern size_t test_results_add(test_results *tsr, const char *file, const char *path);
+
+/* Keep only the nodes with keep[i] set, in order */
+extern void test_results_filter(test_results *tsr, const char *keep);
+
+/* Copy str into the string arena */
+extern const char* test_results_strdup(test_results *tsr, const char *str);
 
 #endif /* _H_TEST_RESULTS */
 /* vim: set ts=4 sw=4 sws=4 expandtab: */
@@ -0,0 +1,151 @@
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "test_utils.h"
+#include "test_hash.h"
+#include "test_results.h"
+#include "test_store.h"
+#include "test_shard.h"
+
+struct shard_entry {
+    const ttr_node *node;
+    size_t order; /* position in the list */
+    double weight;
+    int shard;
+};
+
+int
+shard_parse(const char *spec, int *index, int *count)
+{
+    long i, n;
+    char *end;
+
+    errno = 0;
+    i = strtol(spec, &end, 10);
+    if (errno != 0 || end == spec || *end != '/')
+        return -1;
+
+    spec = end + 1;
+    n = strtol(spec, &end, 10);
+    if (errno != 0 || end == spec || *end != '\0')
+        return -1;
+
+    if (n < 1 || i < 1 || i > n)
+        return -1;
+
+    *index = (int)(i - 1);
+    *count = (int)n;
+    return 0;
+}
+
+static int
+cmp_double(const void *a, const void *b)
+{
+    double x = *(const double *)a;
+    double y = *(const double *)b;
+
+    return (x > y) - (x < y);
+}
+
+/* Heaviest first, ties broken by name so the order is stable */
+static int
+cmp_entry(const void *a, const void *b)
+{
+    const struct shard_entry *x = (const struct shard_entry *)a;
+    const struct shard_entry *y = (const struct shard_entry *)b;
+
+    if (x->weight != y->weight)
+        return (x->weight < y->weight) ? 1 : -1;
+
+    return strcmp(x->node->file, y->node->file);
+}
+
+static void
+assign_by_duration(struct shard_entry *entries, size_t len,
+                   double *known, size_t known_len, int count)
+{
+    size_t i;
+    int s, best;
+    double median;
+    double *loads;
+
+    qsort(known, known_len, sizeof(double), cmp_double);
+    median = known[known_len / 2];
+
+    for (i = 0; i < len; ++i) {
+        if (entries[i].weight <= 0.0)
+            entries[i].weight = median;
+    }
+
+    qsort(entries, len, sizeof(*entries), cmp_entry);
+
+    loads = (double *)calloc((size_t)count, sizeof(double));
+    if (loads == NULL)
+        die(errno, "calloc(loads)");
+
+    for (i = 0; i < len; ++i) {
+        best = 0;
+        for (s = 1; s < count; ++s) {
+            if (loads[s] < loads[best])
+                best = s;
+        }
+
+        entries[i].shard = best;
+        loads[best] += entries[i].weight;
+    }
+
+    free(loads);
+}
+
+void
+shard_select(test_results *tsr, const test_store *st, int index, int count)
+{
+    size_t i;
+    size_t len;
+    size_t known_len;
+    char *keep;
+    double *known;
+    store_record *rec;
+    struct shard_entry *entries;
+
+    len = tsr->len;
+    if (len == 0)
+        return;
+
+    entries = (struct shard_entry *)calloc(len, sizeof(*entries));
+    known = (double *)calloc(len, sizeof(double));
+    keep = (char *)calloc(len, sizeof(char));
+    if (entries == NULL || known == NULL || keep == NULL)
+        die(errno, "calloc(shard)");
+
+    known_len = 0;
+    for (i = 0; i < len; ++i) {
+        entries[i].node = &tsr->nodes[i];
+        entries[i].order = i;
+
+        rec = (st != NULL) ? store_lookup(st, tsr->nodes[i].path) : NULL;
+        if (rec != NULL && rec->duration > 0.0) {
+            entries[i].weight = rec->duration;
+            known[known_len++] = rec->duration;
+        }
+    }
+
+    if (known_len == 0) {
+        for (i = 0; i < len; ++i)
+            entries[i].shard = (int)(strmap_hash(entries[i].node->file) % count);
+    }
+    else
+        assign_by_duration(entries, len, known, known_len, count);
+
+    for (i = 0; i < len; ++i)
+        keep[entries[i].order] = (entries[i].shard == index);
+
+    test_results_filter(tsr, keep);
+
+    free(keep);
+    free(known);
+    free(entries);
+}
+
+/* vim: set ts=4 sw=4 sws=4 expandtab: */
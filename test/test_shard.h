@@ -0,0 +1,22 @@
+#ifndef _H_TEST_SHARD
+#define _H_TEST_SHARD
+
+#include "test_results.h"
+#include "test_store.h"
+
+/* Parse "i/N" into a 0 based index and a count, 0 on success */
+extern int shard_parse(const char *spec, int *index, int *count);
+
+/* Drop every test from tsr that isn't part of shard index of count.
+ *
+ * Tests are balanced by the durations recorded in st (which may be
+ * NULL), longest first onto the least loaded shard.  Tests without a
+ * recorded duration are assumed to take the median.  With no history at
+ * all the tests are split by a stable hash of their name.  Either way
+ * every machine running the same list and history agrees on the split.
+ */
+extern void shard_select(test_results *tsr, const test_store *st,
+                         int index, int count);
+
+#endif /* _H_TEST_SHARD */
+/* vim: set ts=4 sw=4 sws=4 expandtab: */
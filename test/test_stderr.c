@@ -0,0 +1,119 @@
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "test_utils.h"
+#include "test_stderr.h"
+
+test_stderr*
+stderr_new(double start)
+{
+    test_stderr *se;
+
+    se = (test_stderr *)malloc(sizeof(*se));
+    if (se == NULL)
+        die(errno, "malloc(test_stderr)");
+
+    se->start = start;
+    se->head = 0;
+    se->nlines = 0;
+    se->partial = 0;
+
+    return se;
+}
+
+void
+stderr_free(test_stderr *se)
+{
+    free(se);
+}
+
+static void
+ring_put(test_stderr *se, const char *buf, size_t len)
+{
+    size_t off;
+    size_t n;
+
+    /* Only the tail of a huge write survives anyway */
+    if (len > STDERR_RING_SZ) {
+        se->head += len - STDERR_RING_SZ;
+        buf += len - STDERR_RING_SZ;
+        len = STDERR_RING_SZ;
+    }
+
+    while (len > 0) {
+        off = se->head % STDERR_RING_SZ;
+        n = STDERR_RING_SZ - off;
+        if (n > len)
+            n = len;
+
+        memcpy(se->data + off, buf, n);
+        se->head += n;
+        buf += n;
+        len -= n;
+    }
+}
+
+void
+stderr_append(test_stderr *se, const char *buf, size_t len, double now)
+{
+    size_t n;
+    const char *nl;
+
+    while (len > 0) {
+        if (!se->partial) {
+            se->lines[se->nlines % STDERR_LINES].stamp = now;
+            se->lines[se->nlines % STDERR_LINES].pos = se->head;
+            se->nlines++;
+        }
+
+        nl = (const char *)memchr(buf, '\n', len);
+        n = (nl == NULL) ? len : (size_t)(nl - buf) + 1;
+        se->partial = (nl == NULL);
+
+        ring_put(se, buf, n);
+        buf += n;
+        len -= n;
+    }
+}
+
+void
+stderr_dump(const test_stderr *se, strbuf *out, const char *indent)
+{
+    size_t i;
+    size_t pos;
+    size_t end;
+    size_t first;
+    size_t oldest;
+    size_t dropped;
+
+    oldest = (se->head > STDERR_RING_SZ) ? se->head - STDERR_RING_SZ : 0;
+    first = (se->nlines > STDERR_LINES) ? se->nlines - STDERR_LINES : 0;
+
+    /* Skip lines that were partly overwritten */
+    while (first < se->nlines && se->lines[first % STDERR_LINES].pos < oldest)
+        ++first;
+
+    dropped = first;
+    if (dropped) {
+        strbuf_printf(out, "%s(%lu earlier lines dropped)\n", indent,
+                      (unsigned long)dropped);
+    }
+
+    for (i = first; i < se->nlines; ++i) {
+        pos = se->lines[i % STDERR_LINES].pos;
+        end = (i + 1 < se->nlines) ? se->lines[(i + 1) % STDERR_LINES].pos : se->head;
+
+        strbuf_printf(out, "%s[%8.3f] ", indent,
+                      se->lines[i % STDERR_LINES].stamp - se->start);
+
+        for (; pos < end; ++pos) {
+            char c = se->data[pos % STDERR_RING_SZ];
+            if (c != '\n')
+                strbuf_putc(out, c);
+        }
+        strbuf_putc(out, '\n');
+    }
+}
+
+/* vim: set ts=4 sw=4 sws=4 expandtab: */
@@ -0,0 +1,39 @@
+#ifndef _H_TEST_STDERR
+#define _H_TEST_STDERR
+
+#include <stddef.h>
+
+#include "test_strbuf.h"
+
+/* How much of a test's stderr is kept, the oldest is dropped first */
+#define STDERR_RING_SZ (16 * 1024)
+#define STDERR_LINES 256
+
+/* Captured stderr of one test, lines are stamped with when they
+ * started to arrive so they can be lined up with the test output. */
+typedef struct {
+    double start;  /* monotonic time the test started */
+
+    char data[STDERR_RING_SZ];
+    size_t head;   /* bytes appended, ever */
+
+    struct {
+        double stamp;
+        size_t pos;  /* where the line starts, like head */
+    } lines[STDERR_LINES];
+    size_t nlines; /* lines started, ever */
+
+    int partial;   /* the last line hasn't ended yet */
+} test_stderr;
+
+extern test_stderr* stderr_new(double start);
+extern void stderr_free(test_stderr *se);
+
+/* Add output read at monotonic time now */
+extern void stderr_append(test_stderr *se, const char *buf, size_t len, double now);
+
+/* Format what's kept, each line prefixed with indent and its stamp */
+extern void stderr_dump(const test_stderr *se, strbuf *out, const char *indent);
+
+#endif /* _H_TEST_STDERR */
+/* vim: set ts=4 sw=4 sws=4 expandtab: */
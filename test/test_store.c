@@ -0,0 +1,405 @@
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "test_utils.h"
+#include "test_hash.h"
+#include "test_store.h"
+
+#define STORE_MAGIC "tap-results 3"
+
+/* path name dev ino size mtime_sec mtime_nsec status aborted plan
+ * tests_run failed skipped todo parse_errors duration stamp history summary */
+#define STORE_FIELDS 19
+
+static char*
+dup_field(const char *str)
+{
+    char *ret;
+
+    ret = strdup(str);
+    if (ret == NULL)
+        die(errno, "strdup()");
+
+    return ret;
+}
+
+/* Split line on tabs in place, returns the number of fields */
+static int
+split_fields(char *line, char *fields[], int max)
+{
+    int count;
+    char *tab;
+
+    count = 0;
+    while (count < max) {
+        fields[count++] = line;
+        tab = strchr(line, '\t');
+        if (tab == NULL)
+            break;
+        *tab = '\0';
+        line = tab + 1;
+    }
+
+    return count;
+}
+
+/* Comma separated durations, oldest first */
+static void
+load_history(store_record *rec, const char *str)
+{
+    char *end;
+    double d;
+
+    rec->history_len = 0;
+    while (*str != '\0' && rec->history_len < STORE_HISTORY) {
+        d = strtod(str, &end);
+        if (end == str)
+            break;
+
+        rec->history[rec->history_len++] = d;
+
+        str = end;
+        if (*str == ',')
+            ++str;
+    }
+}
+
+static void
+load_store(test_store *st)
+{
+    FILE *file;
+    char *line = NULL;
+    char *fields[STORE_FIELDS];
+    size_t cap = 0;
+    ssize_t len;
+    store_record *rec;
+
+    file = fopen(st->file, "r");
+    if (file == NULL)
+        return;
+
+    len = getline(&line, &cap, file);
+    if (len <= 0 || strncmp(line, STORE_MAGIC "\n", len) != 0) {
+        /* Unknown format, start over */
+        free(line);
+        fclose(file);
+        return;
+    }
+
+    while ((len = getline(&line, &cap, file)) > 0) {
+        if (line[len - 1] != '\n')
+            break;
+        line[len - 1] = '\0';
+
+        if (split_fields(line, fields, STORE_FIELDS) != STORE_FIELDS)
+            continue;
+
+        rec = (store_record *)calloc(1, sizeof(*rec));
+        if (rec == NULL)
+            die(errno, "calloc(store_record)");
+
+        rec->name = dup_field(fields[1]);
+        rec->dev = strtoull(fields[2], NULL, 10);
+        rec->ino = strtoull(fields[3], NULL, 10);
+        rec->size = strtoll(fields[4], NULL, 10);
+        rec->mtime_sec = strtoll(fields[5], NULL, 10);
+        rec->mtime_nsec = strtol(fields[6], NULL, 10);
+        rec->status = (int)strtol(fields[7], NULL, 10);
+        rec->aborted = (int)strtol(fields[8], NULL, 10);
+        rec->plan = strtol(fields[9], NULL, 10);
+        rec->tests_run = strtol(fields[10], NULL, 10);
+        rec->failed = strtol(fields[11], NULL, 10);
+        rec->skipped = strtol(fields[12], NULL, 10);
+        rec->todo = strtol(fields[13], NULL, 10);
+        rec->parse_errors = strtol(fields[14], NULL, 10);
+        rec->duration = strtod(fields[15], NULL);
+        rec->stamp = strtoll(fields[16], NULL, 10);
+        load_history(rec, fields[17]);
+        rec->summary = dup_field(fields[18]);
+
+        strmap_put(&st->records, fields[0], rec);
+    }
+
+    free(line);
+    fclose(file);
+}
+
+void
+store_open(test_store *st, const char *file)
+{
+    memset(st, 0, sizeof(*st));
+    st->file = file;
+    strmap_init(&st->records);
+
+    /* No file, an in memory store */
+    if (file != NULL)
+        load_store(st);
+}
+
+static void
+write_record(const char *path, void *value, void *arg)
+{
+    int i;
+    FILE *file = (FILE *)arg;
+    store_record *rec = (store_record *)value;
+
+    fprintf(file,
+            "%s\t%s\t%llu\t%llu\t%lld\t%lld\t%ld\t%d\t%d"
+            "\t%ld\t%ld\t%ld\t%ld\t%ld\t%ld\t%.6f\t%lld\t",
+            path, rec->name, rec->dev, rec->ino, rec->size,
+            rec->mtime_sec, rec->mtime_nsec, rec->status, rec->aborted,
+            rec->plan, rec->tests_run, rec->failed, rec->skipped, rec->todo,
+            rec->parse_errors, rec->duration, rec->stamp);
+
+    for (i = 0; i < rec->history_len; ++i)
+        fprintf(file, (i == 0) ? "%.6f" : ",%.6f", rec->history[i]);
+
+    fprintf(file, "\t%s\n", rec->summary);
+}
+
+static void
+free_record(const char *path, void *value, void *arg)
+{
+    store_record *rec = (store_record *)value;
+
+    (void)path;
+    (void)arg;
+
+    free(rec->name);
+    free(rec->summary);
+    free(rec);
+}
+
+static void
+write_store(test_store *st)
+{
+    FILE *file;
+    char *tmp;
+    size_t len;
+
+    len = strlen(st->file);
+    tmp = (char *)malloc(len + sizeof(".tmp"));
+    if (tmp == NULL)
+        die(errno, "malloc()");
+
+    memcpy(tmp, st->file, len);
+    memcpy(tmp + len, ".tmp", sizeof(".tmp"));
+
+    file = fopen(tmp, "w");
+    if (file == NULL) {
+        fprintf(stderr, "Failed to write results to %s: %s\n",
+                st->file, strerror(errno));
+        free(tmp);
+        return;
+    }
+
+    fprintf(file, STORE_MAGIC "\n");
+    strmap_each(&st->records, write_record, file);
+
+    if (fclose(file) != 0 || rename(tmp, st->file) != 0) {
+        fprintf(stderr, "Failed to write results to %s: %s\n",
+                st->file, strerror(errno));
+        unlink(tmp);
+    }
+
+    free(tmp);
+}
+
+void
+store_close(test_store *st)
+{
+    if (st->dirty && st->file != NULL)
+        write_store(st);
+
+    strmap_each(&st->records, free_record, NULL);
+    strmap_fini(&st->records);
+}
+
+store_record*
+store_lookup(const test_store *st, const char *path)
+{
+    return (store_record *)strmap_get(&st->records, path);
+}
+
+void
+store_identify(const char *path, store_identity *id)
+{
+    struct stat sb;
+
+    memset(id, 0, sizeof(*id));
+
+    if (stat(path, &sb) == -1)
+        return;
+
+    id->valid = 1;
+    id->dev = (unsigned long long)sb.st_dev;
+    id->ino = (unsigned long long)sb.st_ino;
+    id->size = (long long)sb.st_size;
+    id->mtime_sec = (long long)sb.st_mtim.tv_sec;
+    id->mtime_nsec = (long)sb.st_mtim.tv_nsec;
+}
+
+int
+store_unchanged(const store_record *rec, const store_identity *id)
+{
+    if (!id->valid)
+        return 0;
+
+    return rec->dev == id->dev
+        && rec->ino == id->ino
+        && rec->size == id->size
+        && rec->mtime_sec == id->mtime_sec
+        && rec->mtime_nsec == id->mtime_nsec;
+}
+
+int
+store_passed(const store_record *rec)
+{
+    return rec->status == 0 && !rec->aborted && rec->failed == 0
+        && rec->tests_run >= rec->plan;
+}
+
+/* Tabs and newlines would break the record format */
+static char*
+dup_summary(const char *summary)
+{
+    char *ret;
+    char *c;
+
+    ret = dup_field(summary);
+    for (c = ret; *c != '\0'; ++c) {
+        if (*c == '\t' || *c == '\n' || *c == '\r')
+            *c = ' ';
+    }
+
+    return ret;
+}
+
+static store_record*
+store_insert(test_store *st, const char *path, const store_record *rec)
+{
+    store_record *n;
+    store_record *old;
+
+    n = (store_record *)malloc(sizeof(*n));
+    if (n == NULL)
+        die(errno, "malloc(store_record)");
+
+    *n = *rec;
+    n->name = dup_summary(rec->name);
+    n->summary = dup_summary((rec->summary != NULL) ? rec->summary : "");
+
+    old = store_lookup(st, path);
+    if (old != NULL)
+        free_record(path, old, NULL);
+
+    strmap_put(&st->records, path, n);
+    st->dirty = 1;
+
+    return n;
+}
+
+void
+store_update(test_store *st, const char *path,
+             const store_identity *id, const store_record *rec)
+{
+    int len;
+    double history[STORE_HISTORY] = { 0 };
+    store_record *n;
+
+    /* Carry the duration history over from the previous run */
+    len = 0;
+    n = store_lookup(st, path);
+    if (n != NULL) {
+        len = n->history_len;
+        memcpy(history, n->history, sizeof(history));
+    }
+
+    if (len == STORE_HISTORY) {
+        memmove(history, history + 1, (STORE_HISTORY - 1) * sizeof(double));
+        --len;
+    }
+    history[len++] = rec->duration;
+
+    n = store_insert(st, path, rec);
+    memcpy(n->history, history, sizeof(history));
+    n->history_len = len;
+
+    n->dev = id->dev;
+    n->ino = id->ino;
+    n->size = id->size;
+    n->mtime_sec = id->mtime_sec;
+    n->mtime_nsec = id->mtime_nsec;
+    n->stamp = (long long)time(NULL);
+}
+
+static int
+cmp_duration(const void *a, const void *b)
+{
+    double x = *(const double *)a;
+    double y = *(const double *)b;
+
+    return (x > y) - (x < y);
+}
+
+double
+store_p95(const store_record *rec)
+{
+    int idx;
+    double sorted[STORE_HISTORY];
+
+    if (rec->history_len == 0)
+        return 0.0;
+
+    memcpy(sorted, rec->history, rec->history_len * sizeof(double));
+    qsort(sorted, rec->history_len, sizeof(double), cmp_duration);
+
+    /* Nearest rank */
+    idx = (rec->history_len * 95 + 99) / 100 - 1;
+    return sorted[idx];
+}
+
+static void
+merge_record(const char *path, void *value, void *arg)
+{
+    store_record *rec = (store_record *)value;
+    store_record *old;
+    test_store *dst = (test_store *)arg;
+
+    /* Newest result wins, the first one seen on a tie */
+    old = store_lookup(dst, path);
+    if (old != NULL && old->stamp >= rec->stamp)
+        return;
+
+    store_insert(dst, path, rec);
+}
+
+void
+store_merge(test_store *dst, const test_store *src)
+{
+    strmap_each(&src->records, merge_record, dst);
+}
+
+void
+store_each(const test_store *st,
+           void (*fn)(const char *path, store_record *rec, void *arg),
+           void *arg)
+{
+    size_t i;
+
+    for (i = 0; i < st->records.size; ++i) {
+        if (st->records.slots[i].key != NULL) {
+            fn(st->records.slots[i].key,
+               (store_record *)st->records.slots[i].value, arg);
+        }
+    }
+}
+
+/* vim: set ts=4 sw=4 sws=4 expandtab: */
@@ -0,0 +1,92 @@
+#ifndef _H_TEST_STORE
+#define _H_TEST_STORE
+
+#include "test_hash.h"
+
+/* Number of durations remembered per test */
+#define STORE_HISTORY 20
+
+/* On-disk store of previous test results.
+ *
+ * Records are keyed by the path of the test and remember the
+ * identity (device, inode, size and mtime) of the test when it ran.
+ * Records for tests not run this time are kept as they are.
+ */
+typedef struct {
+    char *name;     /* name of the test in the list */
+    char *summary;  /* cooked result line, without the newline */
+
+    /* Identity of the test file when it ran */
+    unsigned long long dev;
+    unsigned long long ino;
+    long long size;
+    long long mtime_sec;
+    long mtime_nsec;
+
+    int status;   /* status after running the test */
+    int aborted;  /* did we abort? */
+
+    long plan;
+    long tests_run;
+    long failed;
+    long skipped;
+    long todo;
+    long parse_errors;
+
+    double duration; /* wall clock seconds */
+    long long stamp; /* when the result was recorded, seconds since epoch */
+
+    /* Durations of the last runs, oldest first */
+    double history[STORE_HISTORY];
+    int history_len;
+} store_record;
+
+typedef struct {
+    const char *file;
+    int dirty;
+    strmap records; /* path -> store_record */
+} test_store;
+
+/* Identity of a test file, filled in by store_identify() */
+typedef struct {
+    int valid;
+    unsigned long long dev;
+    unsigned long long ino;
+    long long size;
+    long long mtime_sec;
+    long mtime_nsec;
+} store_identity;
+
+extern void store_open(test_store *st, const char *file);
+
+/* Writes the store back if it changed */
+extern void store_close(test_store *st);
+
+extern store_record* store_lookup(const test_store *st, const char *path);
+
+/* stat path into id, id->valid is 0 on failure */
+extern void store_identify(const char *path, store_identity *id);
+
+/* Returns 1 if the record was made from a test with identity id */
+extern int store_unchanged(const store_record *rec, const store_identity *id);
+
+/* Returns 1 if the recorded run passed */
+extern int store_passed(const store_record *rec);
+
+/* Replace the record for path, rec is copied and its strings duped */
+extern void store_update(test_store *st, const char *path,
+                         const store_identity *id, const store_record *rec);
+
+/* 95th percentile of the duration history, 0 without history */
+extern double store_p95(const store_record *rec);
+
+/* Copy records from src into dst, keeping the newest of each path */
+extern void store_merge(test_store *dst, const test_store *src);
+
+/* Call fn on every record, in no particular order */
+extern void store_each(const test_store *st,
+                       void (*fn)(const char *path, store_record *rec, void *arg),
+                       void *arg);
+
+#endif /* _H_TEST_STORE */
+/* vim: set ts=4 sw=4 sws=4 expandtab: */
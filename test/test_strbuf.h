@@ -0,0 +1,107 @@
+#ifndef _H_TEST_STRBUF
+#define _H_TEST_STRBUF
+
+#include <errno.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "test_utils.h"
+
+/* Growable, always nul terminated string */
+typedef struct {
+    char *str;
+    size_t len;
+    size_t cap;
+} strbuf;
+
+static inline void
+strbuf_init(strbuf *sb)
+{
+    memset(sb, 0, sizeof(*sb));
+}
+
+static inline void
+strbuf_fini(strbuf *sb)
+{
+    if (sb->str != NULL)
+        free(sb->str);
+
+    memset(sb, 0, sizeof(*sb));
+}
+
+static inline void
+strbuf_reset(strbuf *sb)
+{
+    sb->len = 0;
+    if (sb->str != NULL)
+        sb->str[0] = '\0';
+}
+
+static inline void
+strbuf_reserve(strbuf *sb, size_t extra)
+{
+    char *n;
+    size_t cap;
+
+    if (sb->len + extra + 1 <= sb->cap)
+        return;
+
+    cap = (sb->cap == 0) ? 128 : sb->cap;
+    while (cap < sb->len + extra + 1)
+        cap *= 2;
+
+    n = (char *)realloc(sb->str, cap);
+    if (n == NULL)
+        die(errno, "realloc(strbuf)");
+
+    sb->str = n;
+    sb->cap = cap;
+}
+
+static inline void
+strbuf_append(strbuf *sb, const char *str, size_t len)
+{
+    strbuf_reserve(sb, len);
+    memcpy(sb->str + sb->len, str, len);
+    sb->len += len;
+    sb->str[sb->len] = '\0';
+}
+
+static inline void
+strbuf_putc(strbuf *sb, char c)
+{
+    strbuf_append(sb, &c, 1);
+}
+
+static inline void
+strbuf_vprintf(strbuf *sb, const char *fmt, va_list ap)
+{
+    int len;
+    va_list copy;
+
+    va_copy(copy, ap);
+    len = vsnprintf(NULL, 0, fmt, copy);
+    va_end(copy);
+
+    if (len <= 0)
+        return;
+
+    strbuf_reserve(sb, (size_t)len);
+    vsnprintf(sb->str + sb->len, (size_t)len + 1, fmt, ap);
+    sb->len += (size_t)len;
+}
+
+static inline void
+strbuf_printf(strbuf *sb, const char *fmt, ...)
+{
+    va_list ap;
+
+    va_start(ap, fmt);
+    strbuf_vprintf(sb, fmt, ap);
+    va_end(ap);
+}
+
+#endif /* _H_TEST_STRBUF */
+/* vim: set ts=4 sw=4 sws=4 expandtab: */
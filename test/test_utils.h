@@ -6,6 +6,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 
 static void
 die(int err, const char *fmt, ...)
@@ -23,4 +24,14 @@ die(int err, const char *fmt, ...)
 	exit(EXIT_FAILURE);
 }
 
+/* CLOCK_MONOTONIC in seconds */
+static inline double
+monotonic_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
 #endif /* _H_TEST_UTILS */
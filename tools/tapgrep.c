@@ -0,0 +1,423 @@
+/* tapgrep: print the interesting lines of big TAP logs
+ *
+ * Streams files (or stdin), gzip/zstd compressed or not, through the
+ * parser and prints the lines whose status was asked for, with the
+ * comment lines right after a matching test (its diagnostics).
+ * Lines are handed to the parser straight out of the read buffer and
+ * printed from there, they're never copied besides into the parser.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "tap_parser.h"
+#include "tap_source.h"
+
+/* Lines are longer than this only in pathological logs */
+#define TAPGREP_BUFFER_LEN 4096
+
+/* Initial read buffer, grows for lines that don't fit */
+#define READ_LEN (1024 * 1024)
+
+/* Statuses to print */
+enum {
+    ST_NOT_OK      = 1 << 0,
+    ST_TODO_PASSED = 1 << 1,
+    ST_SKIP_FAILED = 1 << 2,
+    ST_BAIL        = 1 << 3,
+    ST_PARSE_ERROR = 1 << 4,
+    ST_ALL         = (1 << 5) - 1
+};
+
+static const struct {
+    const char *name;
+    int bit;
+} status_names[] = {
+    { "not-ok",      ST_NOT_OK },
+    { "todo-passed", ST_TODO_PASSED },
+    { "skip-failed", ST_SKIP_FAILED },
+    { "bail",        ST_BAIL },
+    { "parse-error", ST_PARSE_ERROR },
+};
+#define status_names_len (sizeof(status_names)/sizeof(status_names[0]))
+
+/* Options */
+static int statuses = ST_ALL;
+static int line_numbers = 0;
+static int count_only = 0;
+static int comments = 1;
+static int with_names = 0;
+
+/* What the parser said about the current line */
+static int line_status;
+static int line_is_test;
+static int line_is_comment;
+
+static int
+grep_test_cb(tap_parser *tp, tap_test_result *ttr)
+{
+    line_is_test = 1;
+
+    switch (ttr->type) {
+    case TTT_NOT_OK:
+        line_status |= ST_NOT_OK;
+        break;
+    case TTT_TODO_PASSED:
+        line_status |= ST_TODO_PASSED;
+        break;
+    case TTT_SKIP_FAILED:
+        line_status |= ST_SKIP_FAILED;
+        break;
+    default:
+        break;
+    }
+
+    return tap_default_test_callback(tp, ttr);
+}
+
+static int
+grep_invalid_cb(tap_parser *tp, int err, const char *msg)
+{
+    (void)msg;
+
+    /* Those two are statuses of their own */
+    if (err != TE_TODO_PASS && err != TE_SKIP_FAIL)
+        line_status |= ST_PARSE_ERROR;
+
+    tp->parse_errors++;
+    return 0;
+}
+
+static int
+grep_bailout_cb(tap_parser *tp, char *msg)
+{
+    (void)msg;
+
+    /* Keep going, there may be more to find after it */
+    tp->bailed = 1;
+    line_status |= ST_BAIL;
+    return 0;
+}
+
+static int
+grep_comment_cb(tap_parser *tp)
+{
+    (void)tp;
+
+    line_is_comment = 1;
+    return 0;
+}
+
+static void
+usage(FILE *file, const char *name)
+{
+    size_t i;
+
+    fprintf(file, "usage: %s [options] [file...]\n", name);
+    fprintf(file, " -h             display this message\n");
+    fprintf(file, " -s list        statuses to print, comma separated from:\n");
+    fprintf(file, "               ");
+    for (i = 0; i < status_names_len; ++i)
+        fprintf(file, " %s", status_names[i].name);
+    fprintf(file, "\n                (all of them by default)\n");
+    fprintf(file, " -n             prefix lines with their line number\n");
+    fprintf(file, " -c             only print how many lines matched\n");
+    fprintf(file, " --no-comments  don't print the comments after a test\n");
+    fprintf(file, "Reads stdin without files or for -, gzip and zstd are\n");
+    fprintf(file, "decompressed on the fly.\n");
+    fflush(file);
+}
+
+static int
+parse_statuses(const char *list)
+{
+    size_t i;
+    size_t len;
+    int ret = 0;
+    const char *end;
+
+    while (*list != '\0') {
+        end = strchr(list, ',');
+        len = (end == NULL) ? strlen(list) : (size_t)(end - list);
+
+        for (i = 0; i < status_names_len; ++i) {
+            if (strlen(status_names[i].name) == len
+                    && strncmp(status_names[i].name, list, len) == 0)
+                break;
+        }
+
+        if (i == status_names_len) {
+            fprintf(stderr, "Unknown status: %.*s\n", (int)len, list);
+            return -1;
+        }
+
+        ret |= status_names[i].bit;
+        list += len;
+        if (*list == ',')
+            ++list;
+    }
+
+    return ret;
+}
+
+typedef struct {
+    const char *name;
+    tap_parser *tp;
+    unsigned long lineno;
+    unsigned long matches;
+    int attached;   /* comments belong to a printed test */
+} grep_state;
+
+static void
+print_line(grep_state *gs, const char *line, size_t len)
+{
+    gs->matches++;
+    if (count_only)
+        return;
+
+    if (with_names)
+        printf("%s:", gs->name);
+    if (line_numbers)
+        printf("%lu:", gs->lineno);
+
+    fwrite(line, 1, len, stdout);
+    if (len == 0 || line[len - 1] != '\n')
+        putchar('\n');
+}
+
+static void
+grep_line(grep_state *gs, const char *line, size_t len)
+{
+    int match;
+
+    line_status = 0;
+    line_is_test = 0;
+    line_is_comment = 0;
+    gs->lineno++;
+
+    tap_parser_line(gs->tp, line, len);
+
+    match = (line_status & statuses) != 0;
+
+    if (line_is_test)
+        gs->attached = match;
+    else if (line_is_comment)
+        match = match || (gs->attached && comments);
+    else
+        gs->attached = 0;
+
+    if (match)
+        print_line(gs, line, len);
+}
+
+static int
+grep_source(grep_state *gs, tap_source *src)
+{
+    char *p;
+    char *nl;
+    char *end;
+    char *buf;
+    size_t len;
+    size_t size;
+    ssize_t ret;
+
+    size = READ_LEN;
+    buf = (char *)malloc(size);
+    if (buf == NULL)
+        return errno;
+
+    len = 0;
+    for (;;) {
+        ret = src->ops->read(src, buf + len, size - len);
+        if (ret == -1 && errno == EAGAIN) {
+            if (src->ops->wait(src, -1) == -1)
+                break;
+            continue;
+        }
+        if (ret <= 0)
+            break;
+
+        len += (size_t)ret;
+        end = buf + len;
+
+        for (p = buf; (nl = (char *)memchr(p, '\n', end - p)) != NULL; p = nl + 1)
+            grep_line(gs, p, nl - p + 1);
+
+        len = end - p;
+        memmove(buf, p, len);
+
+        /* A line longer than the buffer, make room for all of it */
+        if (len == size) {
+            p = (char *)realloc(buf, size * 2);
+            if (p == NULL) {
+                ret = -1;
+                break;
+            }
+            buf = p;
+            size *= 2;
+        }
+    }
+
+    if (ret == -1) {
+        ret = errno;
+        free(buf);
+        return (int)ret;
+    }
+
+    /* The last line may not have a newline */
+    if (len > 0)
+        grep_line(gs, buf, len);
+
+    free(buf);
+    return 0;
+}
+
+static int
+grep_file(tap_parser *tp, const char *name, unsigned long *matches)
+{
+    int fd;
+    int ret;
+    tap_source fsrc;
+    tap_source dsrc;
+    grep_state gs;
+
+    if (strcmp(name, "-") == 0) {
+        fd = dup(STDIN_FILENO);
+        name = "(standard input)";
+    }
+    else {
+        fd = open(name, O_RDONLY);
+    }
+
+    if (fd == -1)
+        return errno;
+
+    tap_source_init_fd(&fsrc, fd);
+    ret = tap_source_init_decompress(&dsrc, &fsrc);
+    if (ret != 0) {
+        tap_source_close(&fsrc);
+        return ret;
+    }
+
+    ret = tap_parser_reset(tp);
+    if (ret == 0) {
+        tap_parser_set_test_callback(tp, grep_test_cb);
+        tap_parser_set_invalid_callback(tp, grep_invalid_cb);
+        tap_parser_set_bailout_callback(tp, grep_bailout_cb);
+        tap_parser_set_comment_callback(tp, grep_comment_cb);
+
+        memset(&gs, 0, sizeof(gs));
+        gs.name = name;
+        gs.tp = tp;
+
+        ret = grep_source(&gs, &dsrc);
+
+        if (count_only) {
+            if (with_names)
+                printf("%s:", name);
+            printf("%lu\n", gs.matches);
+        }
+        *matches += gs.matches;
+    }
+
+    tap_source_close(&dsrc);
+    return ret;
+}
+
+int
+main(int argc, char *argv[])
+{
+    int i;
+    int ret;
+    int opt;
+    int failed;
+    unsigned long matches;
+    const char *name;
+    tap_parser tp;
+
+    enum {
+        OPT_NO_COMMENTS = 256
+    };
+
+    static const struct option long_opts[] = {
+        { "no-comments", no_argument, NULL, OPT_NO_COMMENTS },
+        { "help",        no_argument, NULL, 'h' },
+        { NULL, 0, NULL, 0 }
+    };
+
+    name = argv[0];
+
+    while ((opt = getopt_long(argc, argv, "hs:nc", long_opts, NULL)) != -1) {
+        switch (opt) {
+        case 's':
+            statuses = parse_statuses(optarg);
+            if (statuses <= 0) {
+                usage(stderr, name);
+                return 2;
+            }
+            break;
+        case 'n':
+            line_numbers = 1;
+            break;
+        case 'c':
+            count_only = 1;
+            break;
+        case OPT_NO_COMMENTS:
+            comments = 0;
+            break;
+        case 'h':
+            usage(stdout, name);
+            return 0;
+        default:
+            usage(stderr, name);
+            return 2;
+        }
+    }
+
+    /* Output can be as big as the input, write it in big blocks */
+    setvbuf(stdout, NULL, _IOFBF, READ_LEN);
+
+    ret = tap_parser_init(&tp, TAPGREP_BUFFER_LEN);
+    if (ret != 0) {
+        fprintf(stderr, "tap_parser_init(): %s\n", strerror(ret));
+        return 2;
+    }
+
+    with_names = (argc - optind > 1);
+    matches = 0;
+    failed = 0;
+
+    if (optind == argc) {
+        ret = grep_file(&tp, "-", &matches);
+        if (ret != 0) {
+            fprintf(stderr, "(standard input): %s\n", strerror(ret));
+            failed = 1;
+        }
+    }
+
+    for (i = optind; i < argc; ++i) {
+        ret = grep_file(&tp, argv[i], &matches);
+        if (ret != 0) {
+            fflush(stdout);
+            fprintf(stderr, "%s: %s\n", argv[i], strerror(ret));
+            failed = 1;
+        }
+    }
+
+    tap_parser_fini(&tp);
+
+    if (fflush(stdout) == EOF)
+        failed = 1;
+
+    /* Like grep: 0 found something, 1 nothing, 2 trouble */
+    if (failed)
+        return 2;
+    return (matches > 0) ? 0 : 1;
+}
+
+/* vim: set ts=4 sw=4 sts=4 expandtab: */